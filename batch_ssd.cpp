@@ -0,0 +1,169 @@
+//
+//  batch_ssd.cpp
+//  Project2
+//
+//  Batched sum of squared differences by cache-blocked matrix multiply.
+//
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <queue>
+#include "batch_ssd.hpp"
+#include "util.hpp"
+
+// Bytes of feature rows per row tile, sized for the L2 cache
+static const size_t TILE_BYTES = 256*1024;
+// Most queries per task; a task keeps its query block in cache while streaming row tiles
+static const int MAX_QUERY_BLOCK = 64;
+
+// Sum of 8 partial sums
+static inline float sumLanes8(const float *l){
+    return ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+}
+
+// Dot products of a block of queries with a block of rows.
+// Four queries share every load of a row, each accumulating into 8 partial sums.
+void blockDots(const float *queries, int numQueries, int queryStride,
+               const float *rows, int numRows, int rowStride,
+               int len, float *dots, int dotStride){
+    for (int r = 0; r < numRows; r++){
+        const float *x = rows + (size_t)r*rowStride;
+        int q = 0;
+        for (; q + 4 <= numQueries; q += 4){
+            const float *q0 = queries + (size_t)q*queryStride;
+            const float *q1 = q0 + queryStride;
+            const float *q2 = q1 + queryStride;
+            const float *q3 = q2 + queryStride;
+            float a0[8] = {0}, a1[8] = {0}, a2[8] = {0}, a3[8] = {0};
+            for (int d = 0; d < len; d += 8){
+                for (int u = 0; u < 8; u++){
+                    float xv = x[d+u];
+                    a0[u] += q0[d+u]*xv;
+                    a1[u] += q1[d+u]*xv;
+                    a2[u] += q2[d+u]*xv;
+                    a3[u] += q3[d+u]*xv;
+                }
+            }
+            dots[(size_t)q*dotStride + r] = sumLanes8(a0);
+            dots[(size_t)(q+1)*dotStride + r] = sumLanes8(a1);
+            dots[(size_t)(q+2)*dotStride + r] = sumLanes8(a2);
+            dots[(size_t)(q+3)*dotStride + r] = sumLanes8(a3);
+        }
+        for (; q < numQueries; q++){
+            const float *q0 = queries + (size_t)q*queryStride;
+            float a0[8] = {0};
+            for (int d = 0; d < len; d += 8){
+                for (int u = 0; u < 8; u++) a0[u] += q0[d+u]*x[d+u];
+            }
+            dots[(size_t)q*dotStride + r] = sumLanes8(a0);
+        }
+    }
+}
+
+int batchSumSquaredTopK(const std::vector<FeatureDatabase> &queries,
+                        const std::vector<FeatureDatabase> &databases,
+                        const std::vector<double> &weights,
+                        int k,
+                        ThreadPool *pool,
+                        std::vector<std::vector<std::pair<float, int>>> &topK){
+    int numQueries = queries.empty() ? 0 : queries[0].size();
+    topK.assign(numQueries, std::vector<std::pair<float, int>>());
+    if (numQueries == 0 || databases.empty()) return 0;
+    int numRows = databases[0].size();
+    k = std::min(k, numRows);
+    if (k <= 0) return 0;
+    
+    size_t rowBytes = 0;
+    for (const FeatureDatabase &db : databases) rowBytes += db.stride()*sizeof(float);
+    int tileRows = (int)std::max((size_t)16, TILE_BYTES/std::max(rowBytes, (size_t)1));
+    tileRows = std::min(tileRows, numRows);
+    int numThreads = pool ? pool->size() : 1;
+    int queryBlock = std::min(MAX_QUERY_BLOCK, std::max(4, (numQueries + numThreads - 1)/numThreads));
+    int numBlocks = (numQueries + queryBlock - 1)/queryBlock;
+    
+    auto task = [&](int block, int){
+        int first = block*queryBlock;
+        int count = std::min(queryBlock, numQueries - first);
+        std::vector<float> dots((size_t)count*tileRows);
+        std::vector<float> scores((size_t)count*tileRows);
+        std::vector<float> bounds((size_t)count*tileRows);
+        // Max-heap of the K smallest upper bounds of every query, the worst on top
+        std::vector<std::priority_queue<float>> upper(count);
+        // (lower bound, row) of the rows of every query that may still be in its top K
+        std::vector<std::vector<std::pair<float, int>>> candidates(count);
+        
+        for (int start = 0; start < numRows; start += tileRows){
+            int rows = std::min(tileRows, numRows - start);
+            for (int i = 0; i < databases.size(); i++){
+                const FeatureDatabase &db = databases[i];
+                const FeatureDatabase &qdb = queries[i];
+                blockDots(qdb.row(first), count, qdb.stride(), db.row(start), rows, db.stride(),
+                          db.stride(), dots.data(), tileRows);
+                float w = (float)weights[i];
+                // Bound on the rounding error of the dot product, the norms and the sums of |q|^2 + |x|^2 - 2 q.x,
+                // and of sumSquared of the same rows, relative to |q|^2 + |x|^2; twice the worst case
+                float eps = std::fabs(w)*4*(db.stride() + 8)*FLT_EPSILON;
+                for (int q = 0; q < count; q++){
+                    float qn = qdb.norm(first + q);
+                    float *s = &scores[(size_t)q*tileRows];
+                    float *e = &bounds[(size_t)q*tileRows];
+                    const float *d = &dots[(size_t)q*tileRows];
+                    for (int r = 0; r < rows; r++){
+                        float xn = db.norm(start + r);
+                        float ssd = std::max(0.0f, qn + xn - 2*d[r]);
+                        s[r] = i == 0 ? w*ssd : s[r] + w*ssd;
+                        e[r] = i == 0 ? eps*(qn + xn) : e[r] + eps*(qn + xn);
+                    }
+                }
+            }
+            // A row is kept while its lower bound is within the K-th smallest upper bound,
+            // which is at least the K-th smallest exact distance
+            for (int q = 0; q < count; q++){
+                std::priority_queue<float> &heap = upper[q];
+                std::vector<std::pair<float, int>> &kept = candidates[q];
+                const float *s = &scores[(size_t)q*tileRows];
+                const float *e = &bounds[(size_t)q*tileRows];
+                for (int r = 0; r < rows; r++){
+                    if ((int)heap.size() < k) heap.push(s[r] + e[r]);
+                    else if (s[r] + e[r] < heap.top()){
+                        heap.pop();
+                        heap.push(s[r] + e[r]);
+                    }
+                    if ((int)heap.size() < k || s[r] - e[r] <= heap.top()) kept.push_back(std::pair<float, int>(s[r] - e[r], start + r));
+                }
+                // Drop the rows the bound has since excluded, once they outnumber the top K
+                if ((int)kept.size() > 4*k + 64){
+                    float bound = heap.top();
+                    kept.erase(std::remove_if(kept.begin(), kept.end(),
+                                              [&](const std::pair<float, int> &c){ return c.first > bound; }), kept.end());
+                }
+            }
+        }
+        
+        // Re-rank the candidates with the exact distance, summed like exactTopK
+        std::vector<DistanceMetric> metrics(databases.size());
+        for (int i = 0; i < databases.size(); i++){
+            metrics[i] = specializeDistanceMetric(&sumSquared, databases[i].dims());
+        }
+        for (int q = 0; q < count; q++){
+            std::vector<std::pair<float, int>> exact;
+            float bound = upper[q].top();
+            for (std::pair<float, int> &c : candidates[q]){
+                if (c.first > bound) continue;
+                int j = c.second;
+                float total = 0;
+                for (int i = 0; i < databases.size(); i++){
+                    float distance = weights[i] * metrics[i](queries[i].row(first + q), databases[i].row(j), databases[i].dims());
+                    total = i == 0 ? distance : total + distance;
+                }
+                exact.push_back(std::pair<float, int>(total, j));
+            }
+            std::partial_sort(exact.begin(), exact.begin() + k, exact.end());
+            topK[first + q].assign(exact.begin(), exact.begin() + k);
+        }
+    };
+    if (pool) pool->run(numBlocks, task);
+    else for (int b = 0; b < numBlocks; b++) task(b, 0);
+    return 0;
+}
@@ -0,0 +1,51 @@
+//
+//  batch_ssd.hpp
+//  Project2
+//
+//  Batched sum of squared differences. The distances of many queries to many rows
+//  are computed as |q|^2 + |x|^2 - 2 q.x from the stored row norms and a
+//  cache-blocked matrix multiply, which keeps the scan compute-bound.
+//
+
+#ifndef batch_ssd_hpp
+#define batch_ssd_hpp
+
+#include <utility>
+#include <vector>
+#include "feature_db.hpp"
+#include "thread_pool.hpp"
+
+// Dot products of a block of queries with a block of rows.
+// Rows of both blocks are len floats long, len a multiple of 8 (a FeatureDatabase stride).
+// queries - numQueries vectors, queryStride floats apart
+// numQueries - number of queries
+// queryStride - distance in floats between queries
+// rows - numRows vectors, rowStride floats apart
+// numRows - number of rows
+// rowStride - distance in floats between rows
+// len - number of floats per dot product
+// dots - numQueries x numRows dot products, row-major with dotStride floats per query
+// dotStride - distance in floats between the dot products of consecutive queries
+void blockDots(const float *queries, int numQueries, int queryStride,
+               const float *rows, int numRows, int rowStride,
+               int len, float *dots, int dotStride);
+
+// Top K rows of every query by weighted sum of squared differences,
+// sum_i weights[i] * sumSquared(queries[i].row(q), databases[i].row(j)).
+// Rows are scored by the matrix multiply form, and every row whose score is within its
+// rounding error bound, eps * (|q|^2 + |x|^2), of the K-th best is re-ranked with sumSquared,
+// so the results are the same as exactTopK's.
+// queries - Query vectors, one FeatureDatabase per feature database, with the same dims
+// databases - Feature databases, all with the same rows
+// weights - Weight of each database
+// k - Number of top matching rows per query
+// pool - Threads computing blocks of queries in parallel, or NULL for the calling thread
+// topK - (distance, row index) of the top K rows of every query, nearest first
+int batchSumSquaredTopK(const std::vector<FeatureDatabase> &queries,
+                        const std::vector<FeatureDatabase> &databases,
+                        const std::vector<double> &weights,
+                        int k,
+                        ThreadPool *pool,
+                        std::vector<std::vector<std::pair<float, int>>> &topK);
+
+#endif /* batch_ssd_hpp */
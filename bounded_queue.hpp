@@ -0,0 +1,61 @@
+//
+//  bounded_queue.hpp
+//  Project2
+//
+//  Blocking queue of bounded capacity, connecting the stages of a pipeline
+//  running on separate threads. A full queue blocks the producer, so a fast
+//  stage cannot run ahead of a slow one by more than the capacity.
+//
+
+#ifndef bounded_queue_hpp
+#define bounded_queue_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template <typename T>
+class BoundedQueue {
+public:
+    // capacity - most items held at a time
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    // Add an item, waiting while the queue is full
+    // item - item to add
+    void push(T item){
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]{ return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    // Take the oldest item, waiting while the queue is empty.
+    // Returns false once the queue is closed and empty.
+    // item - the item taken
+    bool pop(T &item){
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]{ return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Signal that no more items will be pushed
+    void close(){
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+#endif /* bounded_queue_hpp */
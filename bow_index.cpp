@@ -0,0 +1,408 @@
+//
+//  bow_index.cpp
+//  Project2
+//
+//  Bag of visual words over ORB keypoints, with a binary vocabulary trained by
+//  k-majority clustering, a TF-IDF inverted file and geometric re-ranking.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include "bow_index.hpp"
+
+static const char BOW_MAGIC[8] = "BOWIDX1";
+
+// 64-bit blocks of a descriptor
+static const int DESCRIPTOR_BLOCKS = BowIndex::DESCRIPTOR_BYTES / 8;
+
+// Hamming distance between two descriptors of DESCRIPTOR_BLOCKS 64-bit blocks
+static inline int descriptorDistance(const uint64_t *a, const uint64_t *b){
+    int d = 0;
+    for (int i = 0; i < DESCRIPTOR_BLOCKS; i++) d += __builtin_popcountll(a[i] ^ b[i]);
+    return d;
+}
+
+// Index of the word nearest to a descriptor
+// x - DESCRIPTOR_BLOCKS blocks
+// vocabulary - numWords x DESCRIPTOR_BLOCKS blocks
+static int nearestWord(const uint64_t *x, const uint64_t *vocabulary, int numWords){
+    int best = 0;
+    int bestDistance = INT32_MAX;
+    for (int w = 0; w < numWords; w++){
+        int d = descriptorDistance(x, vocabulary + (size_t)w*DESCRIPTOR_BLOCKS);
+        if (d < bestDistance){
+            bestDistance = d;
+            best = w;
+        }
+    }
+    return best;
+}
+
+// Label each of the n descriptors with its nearest word, in parallel
+// descriptors - n x DESCRIPTOR_BLOCKS blocks
+// vocabulary - numWords x DESCRIPTOR_BLOCKS blocks
+// labels - n labels
+static void assignWords(const uint64_t *descriptors, int n, const uint64_t *vocabulary, int numWords, std::vector<int> &labels){
+    labels.resize(n);
+    int numThreads = std::max(1, std::min((int)std::thread::hardware_concurrency(), n / 1024 + 1));
+    auto work = [&](int begin, int end){
+        for (int i = begin; i < end; i++){
+            labels[i] = nearestWord(descriptors + (size_t)i*DESCRIPTOR_BLOCKS, vocabulary, numWords);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++){
+        threads.emplace_back(work, (int)((long)n*t/numThreads), (int)((long)n*(t+1)/numThreads));
+    }
+    for (std::thread &t : threads) t.join();
+}
+
+// Normalized TF-IDF vector of a list of words
+// sortedWords - words of the keypoints of an image, sorted
+// idf - idf weight of every word
+// vec - (word, weight) pairs with unit L2 norm; empty if no word has a positive weight
+static void tfidfVector(const std::vector<int> &sortedWords, const std::vector<float> &idf,
+                        std::vector<std::pair<int, float>> &vec){
+    vec.clear();
+    double norm = 0;
+    for (size_t i = 0; i < sortedWords.size(); ){
+        size_t j = i;
+        while (j < sortedWords.size() && sortedWords[j] == sortedWords[i]) j++;
+        float weight = (float)(j - i) * idf[sortedWords[i]];
+        if (weight > 0){
+            vec.push_back(std::pair<int, float>(sortedWords[i], weight));
+            norm += (double)weight*weight;
+        }
+        i = j;
+    }
+    if (norm <= 0) return;
+    float scale = (float)(1.0/std::sqrt(norm));
+    for (std::pair<int, float> &v : vec) v.second *= scale;
+}
+
+int appendOrbFeatures(const char *filename, const char *path, const std::vector<cv::KeyPoint> &keypoints,
+                      const cv::Mat &descriptors, int reset){
+    FILE *fp = fopen(filename, reset ? "wb" : "ab");
+    if (!fp){
+        printf("Unable to open keypoint file %s\n", filename);
+        exit(-1);
+    }
+    int len = (int)strlen(path);
+    int n = std::min((int)keypoints.size(), descriptors.rows);
+    fwrite(&len, sizeof(int), 1, fp);
+    fwrite(path, 1, len, fp);
+    fwrite(&n, sizeof(int), 1, fp);
+    for (int i = 0; i < n; i++){
+        float xy[2] = {keypoints[i].pt.x, keypoints[i].pt.y};
+        fwrite(xy, sizeof(float), 2, fp);
+    }
+    for (int i = 0; i < n; i++){
+        fwrite(descriptors.ptr<uchar>(i), 1, BowIndex::DESCRIPTOR_BYTES, fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Read the next record of a keypoint file
+// Returns 1 if a record was read, 0 at the end of the file and -1 if the file is truncated
+// fp - Keypoint file
+// path - Image path
+// xy - (x, y) position of every keypoint
+// descriptors - DESCRIPTOR_BLOCKS blocks per keypoint
+static int readOrbRecord(FILE *fp, std::string &path, std::vector<float> &xy, std::vector<uint64_t> &descriptors){
+    int len, n;
+    if (fread(&len, sizeof(int), 1, fp) != 1) return 0;
+    if (len < 0) return -1;
+    path.resize(len);
+    if (fread(&path[0], 1, len, fp) != (size_t)len || fread(&n, sizeof(int), 1, fp) != 1 || n < 0) return -1;
+    xy.resize(2*(size_t)n);
+    descriptors.resize((size_t)n*DESCRIPTOR_BLOCKS);
+    if (fread(xy.data(), sizeof(float), xy.size(), fp) != xy.size() ||
+        fread(descriptors.data(), sizeof(uint64_t), descriptors.size(), fp) != descriptors.size()) return -1;
+    return 1;
+}
+
+BowIndex::BowIndex() : numWords(0), maxKeypoints(0) {
+}
+
+int BowIndex::build(const char *orbFile, int numWords, int keypointsPerImage, int maxTrainDescriptors,
+                    int iterations, unsigned seed){
+    FILE *fp = fopen(orbFile, "rb");
+    if (!fp){
+        printf("Unable to open keypoint file %s\n", orbFile);
+        return -1;
+    }
+    std::mt19937 rng(seed);
+    std::string imagePath;
+    std::vector<float> xy;
+    std::vector<uint64_t> descriptors;
+
+    // Pass 1: reservoir sample of the descriptors
+    std::vector<uint64_t> sample;
+    long seen = 0;
+    int status;
+    while ((status = readOrbRecord(fp, imagePath, xy, descriptors)) == 1){
+        for (size_t i = 0; i < descriptors.size(); i += DESCRIPTOR_BLOCKS, seen++){
+            long slot = (long)sample.size()/DESCRIPTOR_BLOCKS;
+            if (slot >= maxTrainDescriptors) slot = (long)(rng() % (unsigned long)(seen + 1));
+            if (slot >= maxTrainDescriptors) continue;
+            if ((size_t)slot*DESCRIPTOR_BLOCKS == sample.size()) sample.resize(sample.size() + DESCRIPTOR_BLOCKS);
+            memcpy(&sample[(size_t)slot*DESCRIPTOR_BLOCKS], &descriptors[i], DESCRIPTOR_BYTES);
+        }
+    }
+    int numSamples = (int)(sample.size()/DESCRIPTOR_BLOCKS);
+    if (status < 0 || numSamples == 0){
+        printf(status < 0 ? "Truncated keypoint file %s\n" : "No keypoints in %s\n", orbFile);
+        fclose(fp);
+        return -1;
+    }
+
+    // k-majority: assign the samples to their nearest word, then set every bit of a word
+    // to the majority of that bit over its samples. Empty words restart from a random sample.
+    this->numWords = std::min(numWords, numSamples);
+    maxKeypoints = keypointsPerImage;
+    std::vector<int> order(numSamples);
+    for (int i = 0; i < numSamples; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    vocabulary.resize((size_t)this->numWords*DESCRIPTOR_BLOCKS);
+    for (int w = 0; w < this->numWords; w++){
+        memcpy(&vocabulary[(size_t)w*DESCRIPTOR_BLOCKS], &sample[(size_t)order[w]*DESCRIPTOR_BLOCKS], DESCRIPTOR_BYTES);
+    }
+    std::vector<int> labels;
+    std::vector<int> bitCounts((size_t)this->numWords*DESCRIPTOR_BYTES*8);
+    std::vector<int> members(this->numWords);
+    for (int it = 0; it < iterations; it++){
+        assignWords(sample.data(), numSamples, vocabulary.data(), this->numWords, labels);
+        std::fill(bitCounts.begin(), bitCounts.end(), 0);
+        std::fill(members.begin(), members.end(), 0);
+        for (int i = 0; i < numSamples; i++){
+            int *counts = &bitCounts[(size_t)labels[i]*DESCRIPTOR_BYTES*8];
+            const uint64_t *x = &sample[(size_t)i*DESCRIPTOR_BLOCKS];
+            for (int b = 0; b < DESCRIPTOR_BYTES*8; b++) counts[b] += (x[b/64] >> (b%64)) & 1;
+            members[labels[i]]++;
+        }
+        for (int w = 0; w < this->numWords; w++){
+            uint64_t *word = &vocabulary[(size_t)w*DESCRIPTOR_BLOCKS];
+            if (members[w] == 0){
+                memcpy(word, &sample[(size_t)(rng() % numSamples)*DESCRIPTOR_BLOCKS], DESCRIPTOR_BYTES);
+                continue;
+            }
+            const int *counts = &bitCounts[(size_t)w*DESCRIPTOR_BYTES*8];
+            for (int i = 0; i < DESCRIPTOR_BLOCKS; i++) word[i] = 0;
+            for (int b = 0; b < DESCRIPTOR_BYTES*8; b++){
+                if (2*counts[b] > members[w]) word[b/64] |= (uint64_t)1 << (b%64);
+            }
+        }
+    }
+
+    // Pass 2: quantize the images in batches of descriptors
+    pathPool.clear();
+    pathOffsets.clear();
+    keypointStart.assign(1, 0);
+    keypointXY.clear();
+    keypointWords.clear();
+    rewind(fp);
+    std::vector<std::string> batchPaths;
+    std::vector<int> batchStart(1, 0);
+    std::vector<float> batchXY;
+    std::vector<uint64_t> batchDescriptors;
+    auto flush = [&](){
+        assignWords(batchDescriptors.data(), batchStart.back(), vocabulary.data(), this->numWords, labels);
+        for (size_t b = 0; b < batchPaths.size(); b++){
+            addImage(batchPaths[b].c_str(), batchXY.data() + 2*(size_t)batchStart[b], labels.data() + batchStart[b],
+                     batchStart[b+1] - batchStart[b]);
+        }
+        batchPaths.clear();
+        batchStart.assign(1, 0);
+        batchXY.clear();
+        batchDescriptors.clear();
+    };
+    while ((status = readOrbRecord(fp, imagePath, xy, descriptors)) == 1){
+        batchPaths.push_back(imagePath);
+        batchStart.push_back(batchStart.back() + (int)(xy.size()/2));
+        batchXY.insert(batchXY.end(), xy.begin(), xy.end());
+        batchDescriptors.insert(batchDescriptors.end(), descriptors.begin(), descriptors.end());
+        if (batchStart.back() >= 65536) flush();
+    }
+    flush();
+    fclose(fp);
+    if (status < 0){
+        printf("Truncated keypoint file %s\n", orbFile);
+        return -1;
+    }
+
+    // idf = log(images / images containing the word)
+    std::vector<int> documents(this->numWords, 0);
+    std::vector<int> imageWords;
+    for (int i = 0; i < size(); i++){
+        imageWords.assign(keypointWords.begin() + keypointStart[i], keypointWords.begin() + keypointStart[i+1]);
+        std::sort(imageWords.begin(), imageWords.end());
+        imageWords.erase(std::unique(imageWords.begin(), imageWords.end()), imageWords.end());
+        for (int w : imageWords) documents[w]++;
+    }
+    idf.assign(this->numWords, 0.0f);
+    for (int w = 0; w < this->numWords; w++){
+        if (documents[w] > 0) idf[w] = (float)std::log((double)size()/documents[w]);
+    }
+    buildPostings();
+    return 0;
+}
+
+void BowIndex::addImage(const char *imagePath, const float *xy, const int *imageWords, int n){
+    pathOffsets.push_back(pathPool.size());
+    pathPool.insert(pathPool.end(), imagePath, imagePath + strlen(imagePath) + 1);
+    keypointXY.insert(keypointXY.end(), xy, xy + 2*(size_t)n);
+    keypointWords.insert(keypointWords.end(), imageWords, imageWords + n);
+    keypointStart.push_back((int)keypointWords.size());
+}
+
+void BowIndex::buildPostings(){
+    postings.assign(numWords, std::vector<std::pair<int, float>>());
+    std::vector<int> imageWords;
+    std::vector<std::pair<int, float>> vec;
+    for (int i = 0; i < size(); i++){
+        imageWords.assign(keypointWords.begin() + keypointStart[i], keypointWords.begin() + keypointStart[i+1]);
+        std::sort(imageWords.begin(), imageWords.end());
+        tfidfVector(imageWords, idf, vec);
+        for (std::pair<int, float> &v : vec) postings[v.first].push_back(std::pair<int, float>(i, v.second));
+    }
+}
+
+int BowIndex::quantize(const uint8_t *descriptor) const {
+    uint64_t x[DESCRIPTOR_BLOCKS];
+    memcpy(x, descriptor, DESCRIPTOR_BYTES);
+    return nearestWord(x, vocabulary.data(), numWords);
+}
+
+int BowIndex::geometricInliers(const std::vector<float> &queryXY, const std::vector<int> &queryWords, int image) const {
+    // Keypoint of every word that occurs once in the image, -1 for repeated words
+    std::unordered_map<int, int> imageKeypoint;
+    for (int j = keypointStart[image]; j < keypointStart[image+1]; j++){
+        auto inserted = imageKeypoint.insert(std::pair<int, int>(keypointWords[j], j));
+        if (!inserted.second) inserted.first->second = -1;
+    }
+    std::unordered_map<int, int> queryCount;
+    for (int w : queryWords) queryCount[w]++;
+
+    std::vector<cv::Point2f> src, dst;
+    for (size_t i = 0; i < queryWords.size(); i++){
+        if (queryCount[queryWords[i]] != 1) continue;
+        auto it = imageKeypoint.find(queryWords[i]);
+        if (it == imageKeypoint.end() || it->second < 0) continue;
+        src.push_back(cv::Point2f(queryXY[2*i], queryXY[2*i+1]));
+        dst.push_back(cv::Point2f(keypointXY[2*(size_t)it->second], keypointXY[2*(size_t)it->second+1]));
+    }
+    if (src.size() < 4) return 0; // a homography needs 4 pairs
+
+    cv::Mat mask;
+    cv::Mat homography = cv::findHomography(src, dst, cv::RANSAC, 5.0, mask);
+    if (homography.empty()) return 0;
+    int inliers = 0;
+    for (int r = 0; r < mask.rows; r++) inliers += mask.at<uchar>(r) != 0;
+    return inliers;
+}
+
+int BowIndex::search(const std::vector<cv::KeyPoint> &keypoints, const cv::Mat &descriptors, int k, int rerank,
+                     std::vector<std::pair<float, int>> &results) const {
+    results.clear();
+    if (size() == 0 || k <= 0) return 0;
+
+    int n = std::min((int)keypoints.size(), descriptors.rows);
+    std::vector<int> queryWords(n);
+    std::vector<float> queryXY(2*(size_t)n);
+    for (int i = 0; i < n; i++){
+        queryWords[i] = quantize(descriptors.ptr<uchar>(i));
+        queryXY[2*i] = keypoints[i].pt.x;
+        queryXY[2*i+1] = keypoints[i].pt.y;
+    }
+    std::vector<int> sortedWords = queryWords;
+    std::sort(sortedWords.begin(), sortedWords.end());
+    std::vector<std::pair<int, float>> queryVec;
+    tfidfVector(sortedWords, idf, queryVec);
+
+    // Cosine similarities, accumulated over the postings of the query words only
+    std::unordered_map<int, float> scores;
+    for (std::pair<int, float> &q : queryVec){
+        for (const std::pair<int, float> &p : postings[q.first]) scores[p.first] += q.second*p.second;
+    }
+    std::vector<std::pair<float, int>> candidates;
+    candidates.reserve(scores.size());
+    for (std::pair<const int, float> &s : scores) candidates.push_back(std::pair<float, int>(1.0f - s.second, s.first));
+
+    int pool = std::min((int)candidates.size(), std::max(k, rerank));
+    std::partial_sort(candidates.begin(), candidates.begin() + pool, candidates.end());
+    for (int c = 0; c < std::min(rerank, pool); c++){
+        candidates[c].first /= 1 + geometricInliers(queryXY, queryWords, candidates[c].second);
+    }
+    std::sort(candidates.begin(), candidates.begin() + pool);
+    results.assign(candidates.begin(), candidates.begin() + std::min(k, pool));
+    return 0;
+}
+
+int BowIndex::save(const char *filename) const {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp){
+        printf("Unable to open index file %s\n", filename);
+        return -1;
+    }
+    int header[5] = {numWords, maxKeypoints, size(), (int)keypointWords.size(), (int)pathPool.size()};
+    fwrite(BOW_MAGIC, 1, sizeof(BOW_MAGIC), fp);
+    fwrite(header, sizeof(int), 5, fp);
+    fwrite(vocabulary.data(), sizeof(uint64_t), vocabulary.size(), fp);
+    fwrite(idf.data(), sizeof(float), idf.size(), fp);
+    fwrite(keypointStart.data(), sizeof(int), keypointStart.size(), fp);
+    fwrite(keypointXY.data(), sizeof(float), keypointXY.size(), fp);
+    fwrite(keypointWords.data(), sizeof(int), keypointWords.size(), fp);
+    fwrite(pathPool.data(), 1, pathPool.size(), fp);
+    int err = ferror(fp);
+    fclose(fp);
+    return err ? -1 : 0;
+}
+
+int BowIndex::load(const char *filename){
+    FILE *fp = fopen(filename, "rb");
+    if (!fp){
+        printf("Unable to open index file %s\n", filename);
+        return -1;
+    }
+    char magic[sizeof(BOW_MAGIC)];
+    int header[5];
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, BOW_MAGIC, sizeof(magic)) != 0 ||
+        fread(header, sizeof(int), 5, fp) != 5 || header[0] < 0 || header[2] < 0 || header[3] < 0 || header[4] < 0){
+        printf("Invalid index file %s\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    numWords = header[0];
+    maxKeypoints = header[1];
+    vocabulary.resize((size_t)numWords*DESCRIPTOR_BLOCKS);
+    idf.resize(numWords);
+    keypointStart.resize((size_t)header[2] + 1);
+    keypointXY.resize(2*(size_t)header[3]);
+    keypointWords.resize(header[3]);
+    pathPool.resize(header[4]);
+    bool ok = fread(vocabulary.data(), sizeof(uint64_t), vocabulary.size(), fp) == vocabulary.size() &&
+              fread(idf.data(), sizeof(float), idf.size(), fp) == idf.size() &&
+              fread(keypointStart.data(), sizeof(int), keypointStart.size(), fp) == keypointStart.size() &&
+              fread(keypointXY.data(), sizeof(float), keypointXY.size(), fp) == keypointXY.size() &&
+              fread(keypointWords.data(), sizeof(int), keypointWords.size(), fp) == keypointWords.size() &&
+              fread(pathPool.data(), 1, pathPool.size(), fp) == pathPool.size();
+    fclose(fp);
+    ok = ok && (pathPool.empty() || pathPool.back() == '\0') && keypointStart[0] == 0;
+    for (size_t i = 1; ok && i < keypointStart.size(); i++) ok = keypointStart[i] >= keypointStart[i-1];
+    for (size_t j = 0; ok && j < keypointWords.size(); j++) ok = keypointWords[j] >= 0 && keypointWords[j] < numWords;
+    pathOffsets.clear();
+    for (size_t p = 0; ok && p < pathPool.size(); p += strlen(&pathPool[p]) + 1) pathOffsets.push_back(p);
+    if (!ok || size() != header[2] || keypointStart.back() != header[3]){
+        printf("Truncated index file %s\n", filename);
+        *this = BowIndex();
+        return -1;
+    }
+    buildPostings();
+    return 0;
+}
@@ -0,0 +1,105 @@
+//
+//  bow_index.hpp
+//  Project2
+//
+//  Bag of visual words over ORB keypoints, for matching images by their local
+//  features: crops, partial views and objects on different backgrounds.
+//  The 256-bit ORB descriptors are quantized to a binary vocabulary trained by
+//  k-majority clustering (k-means with Hamming distance and per-bit majority votes).
+//  Each image is a sparse TF-IDF vector of visual words stored in an inverted file,
+//  so a query only touches the postings of its own words. The top candidates can be
+//  re-ranked by the number of keypoints consistent with a homography.
+//
+
+#ifndef bow_index_hpp
+#define bow_index_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Append the ORB keypoints and descriptors of one image to a binary keypoint file.
+// Each record is the image path, the number of keypoints, their (x, y) positions and their 32-byte descriptors.
+// filename - Keypoint file
+// path - Image path
+// keypoints - Keypoints of the image
+// descriptors - One 32-byte CV_8U row per keypoint
+// reset - Erase the file first
+int appendOrbFeatures(const char *filename, const char *path, const std::vector<cv::KeyPoint> &keypoints,
+                      const cv::Mat &descriptors, int reset);
+
+class BowIndex {
+public:
+    // Bytes of an ORB descriptor
+    static const int DESCRIPTOR_BYTES = 32;
+
+    BowIndex();
+
+    // Build the index of a keypoint file written by appendOrbFeatures: train the vocabulary on
+    // a random sample of the descriptors, then quantize every image into the inverted file.
+    // Returns non-zero if the file cannot be read or holds no descriptors
+    // orbFile - Keypoint file
+    // numWords - Number of visual words
+    // keypointsPerImage - Maximum number of keypoints extracted per image, used for the queries too
+    // maxTrainDescriptors - Maximum number of descriptors the vocabulary is trained on
+    // iterations - k-majority iterations
+    // seed - Random seed of the sample and the initial words
+    int build(const char *orbFile, int numWords, int keypointsPerImage, int maxTrainDescriptors = 100000,
+              int iterations = 8, unsigned seed = 1);
+
+    // Visual word of a descriptor, the word nearest to it by Hamming distance
+    // descriptor - DESCRIPTOR_BYTES bytes
+    int quantize(const uint8_t *descriptor) const;
+
+    // Find the images sharing the most weighted visual words with a query.
+    // Scores are TF-IDF cosine similarities, accumulated over the postings of the query words only.
+    // With rerank > 0, the rerank best candidates are verified geometrically: keypoints sharing
+    // a word that occurs once in both images are paired, and the pairs consistent with a RANSAC
+    // homography counted as inliers.
+    // keypoints - Query keypoints
+    // descriptors - Query descriptors, one 32-byte row per keypoint
+    // k - Number of results
+    // rerank - Number of candidates verified geometrically, 0 for none
+    // results - (distance, image) pairs, nearest first. The distance is 1 - cosine similarity,
+    //           divided by 1 + the number of inliers for verified candidates.
+    int search(const std::vector<cv::KeyPoint> &keypoints, const cv::Mat &descriptors, int k, int rerank,
+               std::vector<std::pair<float, int>> &results) const;
+
+    // Write the index to a binary file. Returns non-zero on error
+    int save(const char *filename) const;
+    // Read an index written by save. Returns non-zero on error
+    int load(const char *filename);
+
+    // Number of images
+    int size() const { return (int)pathOffsets.size(); }
+    // Number of visual words
+    int words() const { return numWords; }
+    // Maximum number of keypoints extracted per image
+    int keypointsPerImage() const { return maxKeypoints; }
+    // Image path of image i
+    const char *path(int i) const { return &pathPool[pathOffsets[i]]; }
+
+private:
+    // Append an image with its keypoint positions and words
+    void addImage(const char *imagePath, const float *xy, const int *imageWords, int n);
+    // Compute the TF-IDF postings of every image from the idf weights
+    void buildPostings();
+    // Number of query keypoints consistent with a homography to image, see search
+    int geometricInliers(const std::vector<float> &queryXY, const std::vector<int> &queryWords, int image) const;
+
+    int numWords;
+    int maxKeypoints;
+    std::vector<uint64_t> vocabulary; // numWords x 4 64-bit blocks
+    std::vector<float> idf;           // log(images / images containing the word)
+    std::vector<char> pathPool;
+    std::vector<size_t> pathOffsets;
+    std::vector<int> keypointStart;   // keypoints of image i are keypointStart[i] .. keypointStart[i+1]
+    std::vector<float> keypointXY;
+    std::vector<int> keypointWords;
+    std::vector<std::vector<std::pair<int, float>>> postings; // (image, normalized TF-IDF weight) per word
+};
+
+#endif /* bow_index_hpp */
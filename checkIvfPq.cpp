@@ -0,0 +1,168 @@
+//
+//  checkIvfPq.cpp
+//  Project2
+//
+//  Standalone check of the IVF-PQ search on synthetic data.
+//  Writes a feature file of clustered random vectors, trains, encodes and searches
+//  its IVF-PQ index, and compares the results to a brute-force search:
+//  the fraction of the exact top K among the 10K nearest rows by product-quantized distance,
+//  and recall@K of the search re-ranking its shortlist with rows read from disk.
+//  It then rewrites the feature file with the rows in another order and checks that
+//  the saved index is rebuilt rather than reused.
+//  Returns non-zero if a check fails.
+//
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "retrieval.hpp"
+#include "ivfpq.hpp"
+#include "feature_rows.hpp"
+#include "thread_pool.hpp"
+
+// Write rows to a feature file, in the given order
+// filename - Feature file
+// data - n rows of dims floats
+// dims - number of features per row
+// order - rows to write, in that order
+int writeFeatureFile(const char *filename, std::vector<float> &data, int dims, std::vector<int> &order){
+    FILE *fp = fopen(filename, "w");
+    if (!fp){
+        printf("Unable to write %s\n", filename);
+        return -1;
+    }
+    for (int r : order){
+        fprintf(fp, "row%06d.jpg", r);
+        for (int d = 0; d<dims; d++) fprintf(fp, ",%.9g", data[(size_t)r*dims + d]);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Fraction of the exact top K found by an approximate search, comparing image paths
+// exact - Exact results
+// approx - Approximate results
+// exactPath - Image path of a row of the exact results
+// approxPath - Image path of a row of the approximate results
+template <typename ExactPath, typename ApproxPath>
+double recallOf(std::vector<std::pair<float, int>> &exact, std::vector<std::pair<float, int>> &approx,
+                ExactPath exactPath, ApproxPath approxPath){
+    int hits = 0;
+    for (std::pair<float, int> &e : exact){
+        for (std::pair<float, int> &a : approx){
+            if (strcmp(exactPath(e.second), approxPath(a.second)) == 0){
+                hits++;
+                break;
+            }
+        }
+    }
+    return exact.empty() ? 1.0 : (double)hits/exact.size();
+}
+
+int main(int argc, char *argv[]) {
+    const int numRows = 20000, dims = 64, numClusters = 200, numQueries = 100, k = 10;
+    const int numLists = 64, codeBytes = 16, shortlist = 200;
+    std::string dir = argc > 1 ? argv[1] : ".";
+    std::string csvFile = dir + "/checkIvfPq.csv";
+
+    // Clustered vectors: random centers with gaussian noise around them
+    std::mt19937 rng(7);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    std::uniform_real_distribution<float> uniform(-1.5f, 1.5f);
+    std::vector<float> centers((size_t)numClusters*dims), data((size_t)numRows*dims);
+    for (float &c : centers) c = uniform(rng);
+    for (int r = 0; r<numRows; r++){
+        int c = r % numClusters;
+        for (int d = 0; d<dims; d++) data[(size_t)r*dims + d] = centers[(size_t)c*dims + d] + noise(rng);
+    }
+    std::vector<int> order(numRows);
+    for (int r = 0; r<numRows; r++) order[r] = r;
+    if (writeFeatureFile(csvFile.c_str(), data, dims, order) != 0) return -1;
+
+    // Queries near database rows of every cluster
+    Query plan;
+    plan.csvFiles.push_back(&csvFile[0]);
+    plan.weights.push_back(1.0);
+    plan.vectors.push_back(std::vector<float>());
+    plan.distanceMetric = &sumSquared;
+    std::vector<Query> queries(numQueries, plan);
+    for (int q = 0; q<numQueries; q++){
+        int r = (int)((long long)q*7919 % numRows);
+        queries[q].vectors[0].resize(dims);
+        for (int d = 0; d<dims; d++) queries[q].vectors[0][d] = data[(size_t)r*dims + d] + 0.5f*noise(rng);
+    }
+
+    ThreadPool pool(4);
+    int failures = 0;
+    for (int pass = 0; pass<2; pass++){
+        std::vector<FeatureDatabase> databases;
+        loadDatabases(plan, databases);
+        std::vector<IvfPqIndex> ivfIndexes;
+        std::vector<FeatureRows> rows;
+        openIvfPqFiles(plan, numLists, codeBytes, 0, ivfIndexes, rows);
+        if (!rows[0].isCurrent() || !ivfIndexes[0].matches(rows[0].fileStamp(), dims, numLists, codeBytes)){
+            printf("FAIL: the index does not match the feature file it was opened for\n");
+            failures++;
+        }
+        auto dbPath = [&](int r){ return databases[0].path(r); };
+        auto rowPath = [&](int r){ return rows[0].path(r); };
+
+        printf("%s rows, %d lists, %d code bytes, recall@%d over %d queries\n",
+               pass == 0 ? "Original" : "Reordered", numLists, codeBytes, k, numQueries);
+        for (int probes = 1; ; probes *= 2){
+            probes = std::min(probes, numLists);
+            double pqRecall = 0, rerankRecall = 0;
+            int mismatches = 0;
+            for (Query &query : queries){
+                std::vector<std::pair<float, int>> exact, pq, reranked;
+                exactTopK(query, databases, k, exact);
+                ivfIndexes[0].search(query.vectors[0].data(), 10*k, probes, pq);
+                ivfPqTopK(query, ivfIndexes, rows, k, probes, shortlist, reranked, &pool);
+                pqRecall += recallOf(exact, pq, dbPath, rowPath);
+                rerankRecall += recallOf(exact, reranked, dbPath, rowPath);
+                // Re-ranked distances are computed from the rows read from disk exactly as exactTopK does
+                for (int i = 0; probes == numLists && i<std::min(exact.size(), reranked.size()); i++){
+                    mismatches += exact[i].first != reranked[i].first || strcmp(dbPath(exact[i].second), rowPath(reranked[i].second)) != 0;
+                }
+            }
+            pqRecall /= numQueries;
+            rerankRecall /= numQueries;
+            printf("  probes %3d  top %d by PQ distance %.4f  re-ranked %.4f\n", probes, 10*k, pqRecall, rerankRecall);
+            if (probes == numLists){
+                if (pqRecall < 0.95){
+                    printf("FAIL: recall of the PQ distances with every list probed is %.4f, below 0.95\n", pqRecall);
+                    failures++;
+                }
+                if (rerankRecall < 0.99 || mismatches > 0){
+                    printf("FAIL: re-ranked recall with every list probed is %.4f, %d results differ from the exact search\n",
+                           rerankRecall, mismatches);
+                    failures++;
+                }
+                break;
+            }
+        }
+
+        // An index saved for the current feature file is loaded, not rebuilt
+        std::string indexFile = csvFile + ".ivfpq";
+        FeatureFileStamp before, after;
+        featureFileStamp(indexFile.c_str(), before);
+        openIvfPqFiles(plan, numLists, codeBytes, 0, ivfIndexes, rows);
+        featureFileStamp(indexFile.c_str(), after);
+        if (before != after){
+            printf("FAIL: the index of an unchanged feature file was rebuilt\n");
+            failures++;
+        }
+
+        // Rewrite the feature file with the rows in another order, as a re-crawl can
+        std::reverse(order.begin(), order.end());
+        if (pass == 0 && writeFeatureFile(csvFile.c_str(), data, dims, order) != 0) return -1;
+    }
+
+    printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,376 @@
+//
+//  checkLiveIndex.cpp
+//  Project2
+//
+//  Standalone check of the live index under concurrent inserts, deletes, searches and merges.
+//  A writer thread commits batches of inserts, replacements and deletes of synthetic rows while
+//  the background merger runs and reader threads search snapshots. Every snapshot must be the state
+//  of one commit, with no partly written row, must not change while it is held, and must be searched
+//  exactly. The search of a single segment must give the results of exactTopK, and serveLiveIndex
+//  must answer queries with the images added and removed on synthetic images.
+//  Returns non-zero if a check fails.
+//
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "retrieval.hpp"
+#include "live_index.hpp"
+
+static const int DIMS[] = {6, 3};
+static const std::vector<double> WEIGHTS = {1.0, 0.5};
+static std::atomic<int> failures(0);
+
+// Report a failed check, printing the first few
+static void fail(const char *what){
+    if (failures++ < 10) printf("FAIL: %s\n", what);
+}
+
+// Features of the row of a path at a generation, small integers so that distances often tie
+std::vector<std::vector<float>> rowVectors(const std::string &path, int generation){
+    std::minstd_rand rng((unsigned)(std::hash<std::string>()(path) + 7919u*generation));
+    std::uniform_int_distribution<int> value(0, 3);
+    std::vector<std::vector<float>> vectors(2);
+    for (int i = 0; i < 2; i++){
+        for (int d = 0; d < DIMS[i]; d++) vectors[i].push_back((float)value(rng));
+    }
+    // The generation is stored in the row, so a reader can rebuild the row it expects
+    vectors[0][0] = (float)generation;
+    return vectors;
+}
+
+// Order-independent signature of a set of (path, generation) rows
+struct Signature {
+    int rows = 0;
+    uint64_t sum = 0;
+    void add(const std::string &path, int generation){
+        uint64_t h = std::hash<std::string>()(path) ^ (0x9e3779b97f4a7c15ull * (generation + 1));
+        h ^= h >> 31; h *= 0xbf58476d1ce4e5b9ull; h ^= h >> 29;
+        rows++;
+        sum += h;
+    }
+    bool operator==(const Signature &other) const { return rows == other.rows && sum == other.sum; }
+};
+
+// Check the rows of a snapshot and return their signature, and the last commit marker found (-1 if none)
+Signature checkRows(const LiveIndex::Snapshot &snap, int &lastCommit){
+    Signature signature;
+    std::map<std::string, int> seen;
+    lastCommit = -1;
+    int live = 0;
+    for (const LiveIndex::SegmentView &view : snap.segments){
+        const std::vector<FeatureDatabase> &databases = view.segment->databases;
+        int segmentLive = 0;
+        for (int row = 0; row < databases[0].size(); row++){
+            if (view.deleted && (*view.deleted)[row]) continue;
+            segmentLive++;
+            std::string path = databases[0].path(row);
+            int generation = (int)databases[0].row(row)[0];
+            std::vector<std::vector<float>> expected = rowVectors(path, generation);
+            for (int i = 0; i < databases.size(); i++){
+                if (path != databases[i].path(row) || !std::equal(expected[i].begin(), expected[i].end(), databases[i].row(row))){
+                    fail("a snapshot holds a partly written row");
+                }
+            }
+            if (seen.count(path)) fail("a snapshot holds two rows of a path");
+            seen[path] = generation;
+            signature.add(path, generation);
+            if (path.compare(0, 6, "commit") == 0) lastCommit = std::max(lastCommit, atoi(path.c_str() + 6));
+        }
+        if (segmentLive != view.numLive) fail("the live rows of a segment are miscounted");
+        live += segmentLive;
+    }
+    if (live != snap.size()) fail("the size of a snapshot is not its number of live rows");
+    return signature;
+}
+
+// Top K of a snapshot by comparing the query to every live row, ties broken by segment, then row
+void bruteForce(const LiveIndex::Snapshot &snap, const std::vector<std::vector<float>> &vectors, int k,
+                std::vector<std::pair<float, std::string>> &topK){
+    std::vector<std::pair<std::pair<float, long>, std::string>> all;
+    long ordinal = 0;
+    for (const LiveIndex::SegmentView &view : snap.segments){
+        const std::vector<FeatureDatabase> &databases = view.segment->databases;
+        for (int row = 0; row < databases[0].size(); row++, ordinal++){
+            if (view.deleted && (*view.deleted)[row]) continue;
+            float total = 0;
+            for (int i = 0; i < databases.size(); i++){
+                float distance = WEIGHTS[i] * sumSquared(vectors[i].data(), databases[i].row(row), databases[i].dims());
+                total = i == 0 ? distance : total + distance;
+            }
+            all.push_back(std::make_pair(std::make_pair(total, ordinal), std::string(databases[0].path(row))));
+        }
+    }
+    std::sort(all.begin(), all.end());
+    topK.clear();
+    for (int i = 0; i < std::min(k, (int)all.size()); i++) topK.push_back(std::make_pair(all[i].first.first, all[i].second));
+}
+
+// Writer, merger and readers running together
+int checkConcurrent(){
+    const int numBase = 400, numCommits = 300, numReaders = 4, k = 10;
+    LiveIndex live;
+    std::map<std::string, int> state; // path -> generation of the rows of the last commit
+    std::vector<FeatureDatabase> base(2);
+    for (int i = 0; i < 2; i++) base[i].reset(DIMS[i]);
+    for (int r = 0; r < numBase; r++){
+        std::string path = "b" + std::to_string(r);
+        std::vector<std::vector<float>> vectors = rowVectors(path, 0);
+        for (int i = 0; i < 2; i++) base[i].addRow(path.c_str(), vectors[i].data());
+        state[path] = 0;
+    }
+    live.reset(std::move(base));
+
+    // Signature of the state of every commit, the base first
+    std::mutex expectedMutex;
+    std::vector<Signature> expected(1);
+    for (std::pair<const std::string, int> &row : state) expected[0].add(row.first, row.second);
+
+    std::atomic<bool> writing(true);
+    live.startMerger(4, 1);
+    std::thread writer([&]{
+        std::mt19937 rng(5);
+        int next = 0;
+        for (int c = 0; c < numCommits; c++){
+            int numOps = 1 + rng() % 20;
+            for (int op = 0; op < numOps; op++){
+                // A random row, which is not deleted or replaced if it is a commit marker
+                auto row = state.begin();
+                std::advance(row, rng() % state.size());
+                std::string path = row->first;
+                int choice = row->first.compare(0, 6, "commit") == 0 ? 0 : rng() % 4;
+                if (choice == 0){
+                    path = "n" + std::to_string(next++);
+                    live.insert(path.c_str(), rowVectors(path, 0));
+                    state[path] = 0;
+                }
+                else if (choice == 1){
+                    // Replace a row
+                    int generation = state[path] + 1;
+                    live.remove(path.c_str());
+                    live.insert(path.c_str(), rowVectors(path, generation));
+                    state[path] = generation;
+                }
+                else if (choice == 2){
+                    live.remove(path.c_str());
+                    state.erase(path);
+                }
+                else {
+                    // Insert and delete before the commit: no row
+                    path = "n" + std::to_string(next++);
+                    live.insert(path.c_str(), rowVectors(path, 0));
+                    live.remove(path.c_str());
+                }
+            }
+            std::string marker = "commit" + std::to_string(c);
+            live.insert(marker.c_str(), rowVectors(marker, 0));
+            state[marker] = 0;
+            Signature signature;
+            for (std::pair<const std::string, int> &row : state) signature.add(row.first, row.second);
+            {
+                std::lock_guard<std::mutex> lock(expectedMutex);
+                expected.push_back(signature);
+            }
+            live.commit();
+            // Give the readers and the merger time to run between commits
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        writing = false;
+    });
+
+    std::atomic<int> snapshots(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < numReaders; t++){
+        readers.push_back(std::thread([&, t]{
+            std::mt19937 rng(100 + t);
+            std::uniform_int_distribution<int> value(0, 3);
+            while (writing){
+                std::shared_ptr<const LiveIndex::Snapshot> snap = live.snapshot();
+                int lastCommit;
+                Signature before = checkRows(*snap, lastCommit);
+                Signature committed;
+                {
+                    std::lock_guard<std::mutex> lock(expectedMutex);
+                    committed = expected[lastCommit + 1];
+                }
+                if (!(before == committed)) fail("a snapshot is not the state of a commit");
+
+                std::vector<std::vector<float>> query(2);
+                for (int i = 0; i < 2; i++) for (int d = 0; d < DIMS[i]; d++) query[i].push_back((float)value(rng));
+                std::vector<std::pair<float, std::string>> topK, exact;
+                LiveIndex::search(*snap, query, WEIGHTS, &sumSquared, k, topK);
+                bruteForce(*snap, query, k, exact);
+                if (topK != exact) fail("the search of a snapshot differs from comparing every row");
+
+                int lastCommitAfter;
+                if (!(checkRows(*snap, lastCommitAfter) == before) || lastCommitAfter != lastCommit) {
+                    fail("a snapshot changed while it was held");
+                }
+                snapshots++;
+            }
+        }));
+    }
+    writer.join();
+    for (std::thread &reader : readers) reader.join();
+    live.stopMerger();
+
+    // Merged down to at most 4 segments, none with more deleted than live rows, holding the last commit
+    while (live.mergeOnce(4)) {}
+    std::shared_ptr<const LiveIndex::Snapshot> snap = live.snapshot();
+    int lastCommit;
+    Signature last = checkRows(*snap, lastCommit);
+    if (lastCommit != numCommits - 1 || !(last == expected.back())) fail("the index does not hold the last commit");
+    if (snap->segments.size() > 4) fail("the merger left more than 4 segments");
+    for (const LiveIndex::SegmentView &view : snap->segments){
+        if (view.numLive*2 < view.segment->databases[0].size()) fail("the merger left a segment with more deleted than live rows");
+    }
+    printf("  %d snapshots checked during %d commits, %lu segments and %d rows at the end\n",
+           snapshots.load(), numCommits, snap->segments.size(), snap->size());
+    return 0;
+}
+
+// The search of one segment without deletes gives the results of exactTopK
+int checkExact(){
+    const int numRows = 500, k = 20;
+    std::vector<FeatureDatabase> databases(2), copy(2);
+    for (int i = 0; i < 2; i++){
+        databases[i].reset(DIMS[i]);
+        copy[i].reset(DIMS[i]);
+    }
+    for (int r = 0; r < numRows; r++){
+        std::string path = "e" + std::to_string(r);
+        std::vector<std::vector<float>> vectors = rowVectors(path, 1);
+        for (int i = 0; i < 2; i++){
+            databases[i].addRow(path.c_str(), vectors[i].data());
+            copy[i].addRow(path.c_str(), vectors[i].data());
+        }
+    }
+    LiveIndex live;
+    live.reset(std::move(copy));
+    std::shared_ptr<const LiveIndex::Snapshot> snap = live.snapshot();
+
+    int mismatches = 0;
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> value(0, 3);
+    for (int q = 0; q < 50; q++){
+        Query query;
+        query.weights = WEIGHTS;
+        query.distanceMetric = &sumSquared;
+        query.vectors.resize(2);
+        for (int i = 0; i < 2; i++) for (int d = 0; d < DIMS[i]; d++) query.vectors[i].push_back((float)value(rng));
+        std::vector<std::pair<float, int>> exact;
+        std::vector<std::pair<float, std::string>> topK;
+        exactTopK(query, databases, k, exact);
+        LiveIndex::search(*snap, query.vectors, query.weights, query.distanceMetric, k, topK);
+        bool same = exact.size() == topK.size();
+        for (int i = 0; same && i < exact.size(); i++){
+            same = exact[i].first == topK[i].first && topK[i].second == databases[0].path(exact[i].second);
+        }
+        mismatches += !same;
+    }
+    printf("  %d of 50 searches of one segment differ from exactTopK\n", mismatches);
+    if (mismatches > 0) fail("the search of one segment differs from exactTopK");
+    return 0;
+}
+
+// Write an image as a binary PPM file of one color with noise
+// filename - Image file
+int writePpm(const char *filename, std::mt19937 &rng, int size){
+    FILE *fp = fopen(filename, "wb");
+    if (!fp){
+        printf("Unable to write %s\n", filename);
+        return -1;
+    }
+    std::uniform_int_distribution<int> base(40, 215), noise(-20, 20);
+    int color[3] = {base(rng), base(rng), base(rng)};
+    fprintf(fp, "P6 %d %d 255\n", size, size);
+    for (int p = 0; p < size*size*3; p++){
+        unsigned char v = (unsigned char)std::min(255, std::max(0, color[p % 3] + noise(rng)));
+        fwrite(&v, 1, 1, fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+// serveLiveIndex answers queries with the images added and removed before a sync
+int checkServe(const std::string &dir){
+    const int featureType = 2, matchingMethod = 1, k = 5;
+    mkdir(dir.c_str(), 0755);
+    mkdir((dir + "/images").c_str(), 0755);
+    mkdir((dir + "/new").c_str(), 0755);
+    std::mt19937 rng(17);
+    for (int i = 0; i < 20; i++){
+        if (writePpm((dir + "/images/img" + std::to_string(i) + ".ppm").c_str(), rng, 32) != 0) return -1;
+    }
+    for (const char *name : {"a", "b"}){
+        if (writePpm((dir + "/new/" + name + ".ppm").c_str(), rng, 32) != 0) return -1;
+    }
+    if (chdir(dir.c_str()) != 0){
+        printf("Unable to enter %s\n", dir.c_str());
+        return -1;
+    }
+    char images[] = "images";
+    createFeatureVector(images, featureType);
+
+    std::istringstream commands(
+        "query new/a.ppm\n"
+        "add new/a.ppm\n"
+        "add new/b.ppm\n"
+        "add new/a.ppm\n"
+        "sync\n"
+        "query new/a.ppm\n"
+        "remove new/a.ppm\n"
+        "sync\n"
+        "query new/b.ppm\n");
+    if (serveLiveIndex(featureType, matchingMethod, k, commands, "serve.csv") != 0){
+        fail("serveLiveIndex failed");
+        return -1;
+    }
+
+    // Results of the three queries, k lines each after the header
+    std::ifstream results("serve.csv");
+    std::vector<std::vector<std::string>> lines;
+    std::string line;
+    std::getline(results, line);
+    while (std::getline(results, line)){
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        for (std::string field; std::getline(ss, field, ','); ) fields.push_back(field);
+        lines.push_back(fields);
+    }
+    if (lines.size() != 3*k){
+        fail("serveLiveIndex did not answer every query");
+        return 0;
+    }
+    int aFound = 0;
+    for (int i = 0; i < 3*k; i++) aFound += (i < k || i >= 2*k) && lines[i][2] == "new/a.ppm";
+    if (aFound) fail("a query found an image that was not added or was removed");
+    if (lines[k][2] != "new/a.ppm" || atof(lines[k][3].c_str()) != 0) fail("a query did not find the image added before a sync");
+    if (lines[2*k][2] != "new/b.ppm" || atof(lines[2*k][3].c_str()) != 0) fail("a query did not find the image added before a sync");
+    int aRows = 0;
+    for (int i = k; i < 2*k; i++) aRows += lines[i][2] == "new/a.ppm";
+    if (aRows != 1) fail("adding an image twice left two rows");
+    printf("  served 3 queries around 4 adds and removes\n");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "checkLiveIndex";
+    checkConcurrent();
+    checkExact();
+    checkServe(dir);
+    printf(failures ? "%d checks failed\n" : "All checks passed\n", failures.load());
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+//
+//  checkSearchBatch.cpp
+//  Project2
+//
+//  Standalone check of searchBatch with every search mode on synthetic images.
+//  Writes a directory of small clustered random images, computes their feature files,
+//  and for every search mode matches a batch of them at once. The paths of every target
+//  must be those of the same target searched on its own with searchIndex, and, for the
+//  modes that give the exact results, those of the exact search.
+//  Returns non-zero if a check fails.
+//
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "search_index.hpp"
+
+// Write an image as a binary PPM file
+// filename - Image file
+// pixels - rows x cols x 3 bytes, BGR
+int writePpm(const char *filename, std::vector<unsigned char> &pixels, int rows, int cols){
+    FILE *fp = fopen(filename, "wb");
+    if (!fp){
+        printf("Unable to write %s\n", filename);
+        return -1;
+    }
+    fprintf(fp, "P6 %d %d 255\n", cols, rows);
+    // PPM stores RGB
+    for (size_t p = 0; p < pixels.size(); p += 3){
+        unsigned char rgb[3] = {pixels[p+2], pixels[p+1], pixels[p]};
+        fwrite(rgb, 1, 3, fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Paths of the results of a search, nearest first
+std::vector<std::string> resultPaths(SearchIndex &index, std::vector<std::pair<float, int>> &topK){
+    std::vector<std::string> paths;
+    for (std::pair<float, int> &t : topK) paths.push_back(searchResultPath(index, t.second));
+    return paths;
+}
+
+int main(int argc, char *argv[]) {
+    const int numImages = 60, numColors = 6, size = 32, numTargets = 8, k = 5;
+    const int featureType = 2, coarseFeature = 1, matchingMethod = 1;
+    std::string dir = argc > 1 ? argv[1] : "checkSearchBatch";
+    std::string imgDir = dir + "/images";
+    mkdir(dir.c_str(), 0755);
+    mkdir(imgDir.c_str(), 0755);
+
+    // Images of a few base colors with noise, so every color is a cluster
+    std::mt19937 rng(11);
+    std::normal_distribution<float> noise(0.0f, 24.0f);
+    std::uniform_int_distribution<int> base(40, 215);
+    std::vector<std::vector<int>> colors(numColors, std::vector<int>(3));
+    for (std::vector<int> &c : colors) for (int &v : c) v = base(rng);
+    std::vector<std::string> names;
+    for (int i = 0; i < numImages; i++){
+        std::vector<unsigned char> pixels((size_t)size*size*3);
+        for (size_t p = 0; p < pixels.size(); p++){
+            float v = colors[i % numColors][p % 3] + noise(rng);
+            pixels[p] = (unsigned char)std::min(255.0f, std::max(0.0f, v));
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "img%03d.ppm", i);
+        names.push_back(name);
+        if (writePpm((imgDir + "/" + name).c_str(), pixels, size, size) != 0) return -1;
+    }
+
+    // The feature files are written to the working directory
+    if (chdir(dir.c_str()) != 0){
+        printf("Unable to enter %s\n", dir.c_str());
+        return -1;
+    }
+    char images[] = "images";
+    createFeatureVector(images, featureType);
+    createFeatureVector(images, coarseFeature);
+
+    std::vector<cv::Mat> targetImgs;
+    for (int t = 0; t < numTargets; t++){
+        targetImgs.push_back(cv::imread("images/" + names[(t*7) % numImages], cv::IMREAD_COLOR));
+        if (targetImgs.back().empty()){
+            printf("Unable to read target image %s\n", names[(t*7) % numImages].c_str());
+            return -1;
+        }
+    }
+
+    // Paths of the exact search of every target
+    SearchOptions exactOptions;
+    SearchIndex exactIndex;
+    openSearchIndex(featureType, matchingMethod, exactOptions, exactIndex);
+    std::vector<std::vector<std::string>> exact(numTargets);
+    for (int t = 0; t < numTargets; t++){
+        std::vector<std::pair<float, int>> topK;
+        searchIndex(exactIndex, targetImgs[t], k, exactOptions, topK);
+        exact[t] = resultPaths(exactIndex, topK);
+    }
+
+    const char *modeNames[] = {"exact", "pca", "ivfpq", "stream", "anytime", "vptree", "twostage"};
+    const int modes[] = {SEARCH_EXACT, SEARCH_PCA, SEARCH_IVFPQ, SEARCH_STREAM, SEARCH_ANYTIME, SEARCH_VPTREE, SEARCH_TWO_STAGE};
+    int failures = 0;
+    for (int m = 0; m < 7; m++){
+        SearchOptions options;
+        options.mode = modes[m];
+        options.pcaDims = 8;
+        options.numLists = 4;
+        options.codeBytes = 8;
+        options.budgetMs = 60000;
+        options.coarseFeature = coarseFeature;
+        options.rebuild = 1;
+        SearchIndex index;
+        openSearchIndex(featureType, matchingMethod, options, index);
+        std::vector<std::vector<std::pair<float, int>>> topK;
+        std::vector<std::vector<std::string>> topPaths;
+        searchBatch(index, targetImgs, k, options, topK, topPaths);
+
+        // Every target searched on its own after the batch, so the search has moved on from the earlier targets
+        int mismatches = 0, inexact = 0;
+        for (int t = 0; t < numTargets; t++){
+            std::vector<std::pair<float, int>> single;
+            searchIndex(index, targetImgs[t], k, options, single);
+            mismatches += topK[t] != single || topPaths[t] != resultPaths(index, single);
+            inexact += topPaths[t] != exact[t];
+        }
+        bool exactMode = modes[m] != SEARCH_PCA && modes[m] != SEARCH_IVFPQ && modes[m] != SEARCH_TWO_STAGE;
+        printf("  %-8s  %d of %d targets differ from their single search, %d from the exact search\n",
+               modeNames[m], mismatches, numTargets, inexact);
+        if (mismatches > 0 || (exactMode && inexact > 0)){
+            printf("FAIL: the batch results of --search=%s are not those of its single searches%s\n",
+                   modeNames[m], exactMode ? " and of the exact search" : "");
+            failures++;
+        }
+    }
+
+    printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
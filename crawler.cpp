@@ -0,0 +1,279 @@
+//
+//  crawler.cpp
+//  Project2
+//
+//  Parallel recursive crawl of image directories, or of a manifest file listing
+//  image paths, with a cache of the directory listings.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "crawler.hpp"
+
+static const char CRAWL_MAGIC[8] = "CRAWL01";
+
+// Listings modified this recently (in seconds) are not cached: the directory may change
+// again within the resolution of its modification time without the time changing.
+static const int64_t RACY_SECONDS = 2;
+
+// Image and video files and subdirectories of a directory, by name, sorted
+struct DirListing {
+    int64_t mtime = 0; // modification time of the directory in nanoseconds
+    std::vector<std::string> files;
+    std::vector<std::string> dirs;
+};
+
+// Return true if a file name ends in one of the extensions, ignoring case
+// name - File name or path
+// exts - Extensions, with the dot
+static bool hasExtension(const char *name, const char *const *exts, int numExts){
+    size_t len = strlen(name);
+    for (int i = 0; i < numExts; i++){
+        size_t extLen = strlen(exts[i]);
+        if (len > extLen && strcasecmp(name + len - extLen, exts[i]) == 0) return true;
+    }
+    return false;
+}
+
+bool isImageFile(const char *name){
+    static const char *const imageExts[] = {".jpg", ".jpeg", ".png", ".ppm", ".tif", ".tiff"};
+    return hasExtension(name, imageExts, 6);
+}
+
+bool isVideoFile(const char *name){
+    static const char *const videoExts[] = {".mp4", ".avi", ".mov", ".mkv", ".m4v", ".webm"};
+    return hasExtension(name, videoExts, 6);
+}
+
+int64_t modificationTime(const struct stat &st){
+#ifdef __APPLE__
+    return (int64_t)st.st_mtimespec.tv_sec*1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st.st_mtim.tv_sec*1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+// Join a directory and a name with a single slash
+static std::string joinPath(const std::string &dir, const std::string &name){
+    if (!dir.empty() && dir.back() == '/') return dir + name;
+    return dir + "/" + name;
+}
+
+// List the image and video files and the subdirectories of a directory
+// path - Directory
+// listing - Listing, its mtime already set
+// Returns non-zero if the directory cannot be opened
+static int listDirectory(const std::string &path, DirListing &listing){
+    DIR *dirp = opendir(path.c_str());
+    if (!dirp) return -1;
+    struct dirent *dp;
+    while ((dp = readdir(dirp)) != NULL){
+        if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0) continue;
+        bool dir = dp->d_type == DT_DIR;
+        bool file = dp->d_type == DT_REG;
+        if (dp->d_type == DT_UNKNOWN || dp->d_type == DT_LNK){
+            // Follow links to files only, so a link cannot make the crawl loop
+            struct stat st;
+            if (stat(joinPath(path, dp->d_name).c_str(), &st) != 0) continue;
+            dir = dp->d_type == DT_UNKNOWN && S_ISDIR(st.st_mode);
+            file = S_ISREG(st.st_mode);
+        }
+        if (dir) listing.dirs.push_back(dp->d_name);
+        else if (file && (isImageFile(dp->d_name) || isVideoFile(dp->d_name))) listing.files.push_back(dp->d_name);
+    }
+    closedir(dirp);
+    std::sort(listing.files.begin(), listing.files.end());
+    std::sort(listing.dirs.begin(), listing.dirs.end());
+    return 0;
+}
+
+// Write a length-prefixed string
+static void writeString(FILE *fp, const std::string &s){
+    int len = (int)s.size();
+    fwrite(&len, sizeof(int), 1, fp);
+    fwrite(s.data(), 1, s.size(), fp);
+}
+
+// Read a length-prefixed string. Returns false at the end of the file or on a bad length
+static bool readString(FILE *fp, std::string &s){
+    int len;
+    if (fread(&len, sizeof(int), 1, fp) != 1 || len < 0 || len > (1 << 20)) return false;
+    s.resize(len);
+    return fread(&s[0], 1, len, fp) == (size_t)len;
+}
+
+// Read the listing cache. A missing or damaged cache reads as empty
+// filename - Cache file
+// cache - Listing of every cached directory
+static void readListingCache(const char *filename, std::unordered_map<std::string, DirListing> &cache){
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return;
+    char magic[sizeof(CRAWL_MAGIC)];
+    bool ok = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, CRAWL_MAGIC, sizeof(magic)) == 0;
+    std::string path;
+    while (ok && readString(fp, path)){
+        DirListing listing;
+        int counts[2];
+        ok = fread(&listing.mtime, sizeof(listing.mtime), 1, fp) == 1 &&
+             fread(counts, sizeof(int), 2, fp) == 2 && counts[0] >= 0 && counts[1] >= 0;
+        listing.files.resize(ok ? counts[0] : 0);
+        listing.dirs.resize(ok ? counts[1] : 0);
+        for (std::string &f : listing.files) ok = ok && readString(fp, f);
+        for (std::string &d : listing.dirs) ok = ok && readString(fp, d);
+        if (ok) cache[path] = std::move(listing);
+    }
+    fclose(fp);
+    if (!ok) cache.clear();
+}
+
+// Write the listing cache under a temporary name, then rename it into place
+// filename - Cache file
+// cache - Listing of every cached directory
+static int writeListingCache(const char *filename, const std::unordered_map<std::string, DirListing> &cache){
+    std::string staged = std::string(filename) + ".tmp";
+    FILE *fp = fopen(staged.c_str(), "wb");
+    if (!fp){
+        printf("Unable to open crawl cache %s\n", staged.c_str());
+        return -1;
+    }
+    fwrite(CRAWL_MAGIC, 1, sizeof(CRAWL_MAGIC), fp);
+    for (const std::pair<const std::string, DirListing> &c : cache){
+        int counts[2] = {(int)c.second.files.size(), (int)c.second.dirs.size()};
+        writeString(fp, c.first);
+        fwrite(&c.second.mtime, sizeof(c.second.mtime), 1, fp);
+        fwrite(counts, sizeof(int), 2, fp);
+        for (const std::string &f : c.second.files) writeString(fp, f);
+        for (const std::string &d : c.second.dirs) writeString(fp, d);
+    }
+    int err = ferror(fp);
+    fclose(fp);
+    if (err || rename(staged.c_str(), filename) != 0){
+        printf("Unable to write crawl cache %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+int crawlImages(const std::vector<std::string> &roots, const char *manifest, const CrawlOptions &options,
+                BoundedQueue<CrawlItem> &queue, CrawlStats &stats){
+    stats = CrawlStats();
+    std::deque<std::string> pendingDirs(roots.begin(), roots.end());
+
+    // Files listed in the manifest are queued right away, directories crawled with the roots
+    if (manifest){
+        std::ifstream list(manifest);
+        if (!list){
+            printf("Unable to open manifest %s\n", manifest);
+            stats.errors++;
+        }
+        for (std::string line; std::getline(list, line); ){
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            struct stat st;
+            if (stat(line.c_str(), &st) != 0){
+                printf("Unable to find %s\n", line.c_str());
+                stats.errors++;
+            }
+            else if (S_ISDIR(st.st_mode)) pendingDirs.push_back(line);
+            else {
+                CrawlItem item;
+                item.path = line;
+                item.video = options.videos && isVideoFile(line.c_str());
+                queue.push(item);
+                stats.files++;
+            }
+        }
+    }
+
+    // Listings of the directories not visited are kept, for crawls of other roots
+    std::unordered_map<std::string, DirListing> oldCache, newCache;
+    if (options.cacheFile) readListingCache(options.cacheFile, oldCache);
+    newCache = oldCache;
+    int64_t racyAfter = ((int64_t)time(NULL) - RACY_SECONDS)*1000000000;
+
+    // Directories are handed out to the threads from pendingDirs. active counts the directories
+    // being listed, so a thread finding no directory knows whether more may come.
+    // visited holds the canonical paths of the directories handed out.
+    std::mutex mutex;
+    std::condition_variable wake;
+    int active = 0;
+    std::unordered_set<std::string> visited;
+    auto work = [&](){
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;){
+            wake.wait(lock, [&]{ return !pendingDirs.empty() || active == 0; });
+            if (pendingDirs.empty()) return;
+            std::string dir = std::move(pendingDirs.front());
+            pendingDirs.pop_front();
+            active++;
+            lock.unlock();
+
+            // A directory reached twice, through overlapping roots or manifest entries, is listed once
+            char *resolved = realpath(dir.c_str(), NULL);
+            std::string canonical = resolved ? resolved : dir;
+            free(resolved);
+            lock.lock();
+            if (!visited.insert(canonical).second){
+                active--;
+                wake.notify_all();
+                continue;
+            }
+            lock.unlock();
+
+            DirListing listing;
+            struct stat st;
+            int status = stat(dir.c_str(), &st);
+            if (status == 0) listing.mtime = modificationTime(st);
+            auto cached = oldCache.find(dir);
+            bool unchanged = status == 0 && cached != oldCache.end() && cached->second.mtime == listing.mtime;
+            if (unchanged) listing = cached->second;
+            else if (status == 0) status = listDirectory(dir, listing);
+            if (status != 0) printf("Cannot open directory %s\n", dir.c_str());
+
+            long found = 0;
+            for (const std::string &name : listing.files){
+                CrawlItem item;
+                item.path = joinPath(dir, name);
+                item.video = isVideoFile(name.c_str());
+                if (item.video && !options.videos) continue;
+                queue.push(item);
+                found++;
+            }
+
+            lock.lock();
+            for (const std::string &name : listing.dirs) pendingDirs.push_back(joinPath(dir, name));
+            stats.directories++;
+            stats.unchanged += unchanged;
+            stats.files += found;
+            stats.errors += status != 0;
+            if (status == 0 && listing.mtime < racyAfter) newCache[dir] = std::move(listing);
+            else newCache.erase(dir);
+            active--;
+            wake.notify_all();
+        }
+    };
+
+    int numThreads = options.numThreads > 0 ? options.numThreads : std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (int t = 1; t < numThreads; t++) workers.emplace_back(work);
+    work();
+    for (std::thread &w : workers) w.join();
+    queue.close();
+
+    if (options.cacheFile) writeListingCache(options.cacheFile, newCache);
+    return stats.errors ? -1 : 0;
+}
@@ -0,0 +1,68 @@
+//
+//  crawler.hpp
+//  Project2
+//
+//  Parallel recursive crawl of image directories, or of a manifest file listing
+//  image paths. Found files are pushed to a bounded queue as they are discovered,
+//  so the features of the first images are extracted while the crawl goes on.
+//  Directory listings are cached with the modification time of their directory,
+//  and a directory whose modification time has not changed is not listed again.
+//
+
+#ifndef crawler_hpp
+#define crawler_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "bounded_queue.hpp"
+
+// Return true if a file name ends in an image extension (.jpg, .jpeg, .png, .ppm, .tif, .tiff), ignoring case
+// name - File name or path
+bool isImageFile(const char *name);
+
+// Return true if a file name ends in a video extension (.mp4, .avi, .mov, .mkv, .m4v, .webm), ignoring case
+// name - File name or path
+bool isVideoFile(const char *name);
+
+// Modification time of a stat result in nanoseconds
+int64_t modificationTime(const struct stat &st);
+
+// A file found by the crawl
+struct CrawlItem {
+    std::string path;
+    int video = 0; // the file is a video
+};
+
+// Options of crawlImages
+struct CrawlOptions {
+    int videos = 0;               // also report video files
+    int numThreads = 0;           // directories listed in parallel, 0 is one per core
+    const char *cacheFile = NULL; // directory listing cache, read at the start and rewritten at the end, or NULL
+};
+
+// Counts of a crawl
+struct CrawlStats {
+    long directories = 0; // directories visited
+    long unchanged = 0;   // directories whose cached listing was reused
+    long files = 0;       // files pushed to the queue
+    long errors = 0;      // directories or manifest entries that could not be read
+};
+
+// Find the image files (and video files with options.videos) under the root directories, recursively,
+// and the files listed in a manifest. Every file is pushed to the queue as it is found, and the queue
+// is closed at the end. Symbolic links to files are followed, symbolic links to directories are not.
+// A directory reached more than once, by its canonical path, is crawled once.
+// The directories are listed in parallel, so the order of the files in the queue varies from crawl to crawl;
+// the files of a directory are pushed together, sorted by name.
+// roots - Directories to crawl
+// manifest - File listing one path per line, or NULL. Listed files are taken whatever their extension;
+//            listed directories are crawled.
+// options - Crawl options
+// queue - Queue the files are pushed to
+// stats - Set to the counts of the crawl
+int crawlImages(const std::vector<std::string> &roots, const char *manifest, const CrawlOptions &options,
+                BoundedQueue<CrawlItem> &queue, CrawlStats &stats);
+
+#endif /* crawler_hpp */
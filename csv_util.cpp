@@ -14,6 +14,16 @@ The function returns a std::vector of char* for the filenames and a 2D std::vect
 #include <cstdio>
 #include <cstring>
 #include <vector>
+#include <string>
+#include <thread>
+#include <future>
+#include <charconv>
+#include <functional>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "opencv2/opencv.hpp"
 #include "csv_util.hpp"
 
@@ -113,7 +123,6 @@ int getfloat(FILE *fp, float *v) {
   The function returns a non-zero value in case of an error.
  */
 int append_image_data_csv( char *filename, char *image_filename, std::vector<float> &image_data, int reset_file ) {
-  char buffer[256];
   char mode[8];
   FILE *fp;
 
@@ -130,8 +139,8 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
   }
 
   // write the filename and the feature vector to the CSV file
-  strcpy(buffer, image_filename);
-  std::fwrite(buffer, sizeof(char), strlen(buffer), fp );
+  // (written directly, paths can be longer than any fixed buffer)
+  std::fwrite(image_filename, sizeof(char), strlen(image_filename), fp );
   for(int i=0;i<image_data.size();i++) {
     char tmp[256];
     sprintf(tmp, ",%.4f", image_data[i] );
@@ -211,3 +220,502 @@ int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::ve
 
   return(0);
 }
+
+/*
+  Parses the lines in [begin, end) of a mapped CSV file. Every line is
+  a filename followed by numFeatures comma separated floats. Well
+  formed rows are appended to the chunk, malformed lines are recorded
+  by their line number relative to the start of the chunk.
+
+  If rows is not NULL, the features of the n-th well formed row are
+  written at rows + n*stride instead of being appended to chunk.data.
+ */
+static void parse_csv_chunk( const char *begin, const char *end, int numFeatures, CsvChunk &chunk, float *rows = NULL, size_t stride = 0 ) {
+  const char *p = begin;
+  int line = 0;
+
+  while( p < end ) {
+    const char *eol = (const char *)memchr( p, '\n', end - p );
+    if( !eol ) {
+      eol = end;
+    }
+    const char *lend = eol;
+    if( lend > p && lend[-1] == '\r' ) {
+      lend--;
+    }
+
+    if( lend > p ) {
+      const char *comma = (const char *)memchr( p, ',', lend - p );
+      size_t rowStart = chunk.data.size();
+      int count = 0;
+      int bad = (comma == NULL || comma == p);
+
+      if( !bad ) {
+        const char *q = comma;
+        while( q < lend ) {
+          q++; // skip the comma
+          while( q < lend && (*q == ' ' || *q == '\t') ) {
+            q++;
+          }
+          float v;
+          std::from_chars_result r = std::from_chars( q, lend, v );
+          if( r.ec != std::errc() || count >= numFeatures ) {
+            bad = 1;
+            break;
+          }
+          q = r.ptr;
+          while( q < lend && (*q == ' ' || *q == '\t') ) {
+            q++;
+          }
+          if( q < lend && *q != ',' ) {
+            bad = 1;
+            break;
+          }
+          if( rows ) {
+            rows[chunk.nameEnds.size() * stride + count] = v;
+          }
+          else {
+            chunk.data.push_back( v );
+          }
+          count++;
+        }
+      }
+
+      if( bad || count != numFeatures ) {
+        if( !rows ) {
+          chunk.data.resize( rowStart );
+        }
+        chunk.badLines.push_back( line );
+      }
+      else {
+        chunk.names.append( p, comma - p );
+        chunk.nameEnds.push_back( chunk.names.size() );
+        chunk.rowOffsets.push_back( p - begin );
+      }
+    }
+
+    line++;
+    p = eol + 1;
+  }
+  chunk.numLines = line;
+}
+
+/*
+  Reads a CSV file with the same format as read_image_data_csv, but
+  maps the file into memory, splits it into line-aligned chunks and
+  parses the chunks in parallel with std::from_chars, straight into
+  the rows returned by allocate.
+
+  allocate is called once with the number of features and an upper
+  bound on the number of rows (the number of lines), and returns room
+  for that many rows, setting stride to the distance in floats between
+  rows. Each chunk is parsed into the rows of its own lines, then the
+  rows are moved down over those of skipped lines, so that row i of
+  the file ends up at rows + i*stride.
+  names receives the image file names of the rows.
+  numFeatures is set to the number of feature columns on the first
+  line of the file; every line must have the same number of columns.
+  numThreads is the number of parser threads, 0 uses one per core.
+
+  Malformed lines (missing filename, bad number or wrong number of
+  columns) are reported with their line number and skipped.
+
+  The function returns the number of rows read, or -1 if the file
+  cannot be read.
+ */
+long read_image_data_csv_into( char *filename, int &numFeatures, const CsvRowAllocator &allocate, CsvChunk &names, int numThreads ) {
+  names.data.clear();
+  names.names.clear();
+  names.nameEnds.clear();
+  names.rowOffsets.clear();
+  names.badLines.clear();
+  names.numLines = 0;
+  numFeatures = 0;
+
+  int fd = open( filename, O_RDONLY );
+  if( fd < 0 ) {
+    printf("Unable to open feature file %s\n", filename );
+    return(-1);
+  }
+
+  struct stat st;
+  if( fstat( fd, &st ) != 0 ) {
+    printf("Unable to stat feature file %s\n", filename );
+    close( fd );
+    return(-1);
+  }
+
+  size_t size = st.st_size;
+  if( size == 0 ) {
+    close( fd );
+    size_t stride = 0;
+    allocate( 0, 0, stride );
+    return(0);
+  }
+
+  void *map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if( map == MAP_FAILED ) {
+    printf("Unable to map feature file %s\n", filename );
+    return(-1);
+  }
+  // madvise advice values are not flags, so each is given on its own
+  madvise( map, size, MADV_SEQUENTIAL );
+  madvise( map, size, MADV_WILLNEED );
+
+  const char *base = (const char *)map;
+  const char *end = base + size;
+
+  printf("Reading %s\n", filename);
+
+  // the column count is taken from the first line of the file
+  const char *firstEol = (const char *)memchr( base, '\n', size );
+  if( !firstEol ) {
+    firstEol = end;
+  }
+  for( const char *q = base; q < firstEol; q++ ) {
+    if( *q == ',' ) {
+      numFeatures++;
+    }
+  }
+
+  // split the file into line-aligned chunks, one per thread
+  if( numThreads <= 0 ) {
+    numThreads = std::max( 1u, std::thread::hardware_concurrency() );
+  }
+  size_t minChunk = 1 << 20;
+  numThreads = (int)std::max( (size_t)1, std::min( (size_t)numThreads, size / minChunk + 1 ) );
+
+  std::vector<const char *> bounds( numThreads + 1 );
+  bounds[0] = base;
+  bounds[numThreads] = end;
+  for( int t = 1; t < numThreads; t++ ) {
+    const char *b = base + size * t / numThreads;
+    if( b < bounds[t-1] ) {
+      b = bounds[t-1];
+    }
+    const char *nl = (const char *)memchr( b, '\n', end - b );
+    bounds[t] = nl ? nl + 1 : end;
+  }
+
+  // the lines of each chunk bound its rows, and give the first row slot of each chunk
+  std::vector<size_t> firstSlot( numThreads + 1, 0 );
+  {
+    std::vector<std::thread> workers;
+    for( int t = 0; t < numThreads; t++ ) {
+      workers.emplace_back( [&bounds, &firstSlot, t]() {
+        size_t lines = std::count( bounds[t], bounds[t+1], '\n' );
+        if( bounds[t+1] > bounds[t] && bounds[t+1][-1] != '\n' ) {
+          lines++;
+        }
+        firstSlot[t+1] = lines;
+      } );
+    }
+    for( std::thread &w : workers ) {
+      w.join();
+    }
+  }
+  for( int t = 0; t < numThreads; t++ ) {
+    firstSlot[t+1] += firstSlot[t];
+  }
+
+  size_t stride = 0;
+  float *rows = allocate( numFeatures, firstSlot[numThreads], stride );
+
+  std::vector<CsvChunk> chunks( numThreads );
+  std::vector<std::thread> workers;
+  for( int t = 1; t < numThreads; t++ ) {
+    workers.emplace_back( parse_csv_chunk, bounds[t], bounds[t+1], numFeatures, std::ref( chunks[t] ),
+                          rows + firstSlot[t] * stride, stride );
+  }
+  parse_csv_chunk( bounds[0], bounds[1], numFeatures, chunks[0], rows, stride );
+  for( std::thread &w : workers ) {
+    w.join();
+  }
+  munmap( map, size );
+
+  // close the gaps left by skipped lines, in file order
+  size_t numRows = 0;
+  size_t nameBytes = 0;
+  for( CsvChunk &c : chunks ) {
+    nameBytes += c.names.size();
+  }
+  names.names.reserve( nameBytes );
+
+  int lineBase = 1;
+  int numBad = 0;
+  for( int t = 0; t < numThreads; t++ ) {
+    CsvChunk &c = chunks[t];
+    size_t n = c.nameEnds.size();
+    if( n > 0 && numRows != firstSlot[t] ) {
+      memmove( rows + numRows * stride, rows + firstSlot[t] * stride, n * stride * sizeof(float) );
+    }
+    numRows += n;
+
+    size_t offset = names.names.size();
+    names.names.append( c.names );
+    for( size_t e : c.nameEnds ) {
+      names.nameEnds.push_back( offset + e );
+    }
+    for( size_t r : c.rowOffsets ) {
+      names.rowOffsets.push_back( bounds[t] - base + r );
+    }
+    std::string().swap( c.names );
+    for( int l : c.badLines ) {
+      printf("Skipping malformed line %d in %s\n", lineBase + l, filename );
+      numBad++;
+    }
+    lineBase += c.numLines;
+  }
+  names.numLines = lineBase - 1;
+  printf("Finished reading CSV file: %lu rows, %d features, %d malformed lines\n", numRows, numFeatures, numBad );
+
+  return( (long)numRows );
+}
+
+/*
+  Reads the line of a feature file starting at byte offset, with
+  pread so that threads can share fd, and parses it as one row.
+  The line is read in growing pieces until its end is found.
+
+  name is set to the image file name of the row and its numFeatures
+  floats are written to row.
+
+  The function returns a non-zero value if the line cannot be read or
+  is malformed.
+ */
+int read_image_data_csv_row( int fd, off_t offset, int numFeatures, std::string &name, float *row ) {
+  std::vector<char> line( (size_t)numFeatures * 16 + 256 );
+  size_t length = 0;
+  const char *eol = NULL;
+  for(;;) {
+    ssize_t n = pread( fd, line.data() + length, line.size() - length, offset + length );
+    if( n < 0 ) {
+      return(-1);
+    }
+    eol = (const char *)memchr( line.data() + length, '\n', n );
+    length += n;
+    if( eol || n == 0 ) {
+      break;
+    }
+    line.resize( line.size() * 2 );
+  }
+  if( !eol ) {
+    eol = line.data() + length;
+  }
+
+  CsvChunk chunk;
+  parse_csv_chunk( line.data(), eol, numFeatures, chunk, row, 0 );
+  if( chunk.nameEnds.size() != 1 ) {
+    return(-1);
+  }
+  name.swap( chunk.names );
+  return(0);
+}
+
+/*
+  Opens a feature file for reading block by block with
+  read_image_data_csv_stream. The first block is read in the
+  background right away.
+
+  block_bytes is the number of bytes read from the file per block.
+
+  The function returns a non-zero value if the file cannot be opened.
+ */
+int open_image_data_csv_stream( char *filename, size_t block_bytes, CsvStream &stream ) {
+  close_image_data_csv_stream( stream );
+
+  stream.fd = open( filename, O_RDONLY );
+  if( stream.fd < 0 ) {
+    printf("Unable to open feature file %s\n", filename );
+    return(-1);
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise( stream.fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+
+  stream.filename = filename;
+  stream.blockBytes = std::max( block_bytes, (size_t)4096 );
+  stream.offset = 0;
+  stream.numFeatures = -1;
+  stream.lineBase = 1;
+  stream.eof = 0;
+  stream.text.clear();
+  stream.block.resize( stream.blockBytes );
+  stream.next.resize( stream.blockBytes );
+
+  // start reading the first block
+  int fd = stream.fd;
+  char *buf = stream.next.data();
+  size_t len = stream.blockBytes;
+  stream.pending = std::async( std::launch::async, [fd, buf, len]() { return pread( fd, buf, len, 0 ); } );
+
+  return(0);
+}
+
+/*
+  Reads the rows of the next block of a feature file opened with
+  open_image_data_csv_stream into chunk, replacing its contents. While
+  the rows are parsed, the following block is already being read in
+  the background, so the caller's work on chunk overlaps with the
+  read of the next block.
+
+  stream.numFeatures is set from the first line of the file. Lines
+  with a different number of columns are reported and skipped.
+
+  The function returns the number of rows read, 0 at the end of the
+  file and -1 if the file cannot be read.
+ */
+int read_image_data_csv_stream( CsvStream &stream, CsvChunk &chunk ) {
+  chunk.data.clear();
+  chunk.names.clear();
+  chunk.nameEnds.clear();
+  chunk.rowOffsets.clear();
+  chunk.badLines.clear();
+  chunk.numLines = 0;
+
+  while( chunk.nameEnds.empty() ) {
+    if( stream.eof && stream.text.empty() ) {
+      return(0);
+    }
+
+    if( !stream.eof ) {
+      // take the block read in the background and start reading the one after it
+      ssize_t n = stream.pending.get();
+      if( n < 0 ) {
+        printf("Unable to read feature file %s\n", stream.filename.c_str() );
+        return(-1);
+      }
+      stream.block.swap( stream.next );
+      stream.offset += n;
+      if( n == 0 ) {
+        stream.eof = 1;
+      }
+      else {
+        int fd = stream.fd;
+        char *buf = stream.next.data();
+        size_t len = stream.blockBytes;
+        off_t off = stream.offset;
+        stream.pending = std::async( std::launch::async, [fd, buf, len, off]() { return pread( fd, buf, len, off ); } );
+        stream.text.insert( stream.text.end(), stream.block.begin(), stream.block.begin() + n );
+      }
+    }
+
+    // parse the complete lines, keep a trailing partial line for the next block
+    const char *begin = stream.text.data();
+    const char *end = begin + stream.text.size();
+    if( !stream.eof ) {
+      while( end > begin && end[-1] != '\n' ) {
+	end--;
+      }
+      if( end == begin ) {
+	continue; // no complete line yet
+      }
+    }
+
+    if( stream.numFeatures < 0 ) {
+      // the column count is taken from the first line of the file
+      stream.numFeatures = 0;
+      for( const char *q = begin; q < end && *q != '\n'; q++ ) {
+	if( *q == ',' ) {
+	  stream.numFeatures++;
+	}
+      }
+    }
+
+    parse_csv_chunk( begin, end, stream.numFeatures, chunk );
+    for( int l : chunk.badLines ) {
+      printf("Skipping malformed line %d in %s\n", stream.lineBase + l, stream.filename.c_str() );
+    }
+    chunk.badLines.clear();
+    stream.lineBase += chunk.numLines;
+    stream.text.erase( stream.text.begin(), stream.text.begin() + (end - begin) );
+  }
+
+  return( (int)chunk.nameEnds.size() );
+}
+
+/*
+  Closes a feature file opened with open_image_data_csv_stream, after
+  waiting for the read in progress, and releases its buffers.
+ */
+void close_image_data_csv_stream( CsvStream &stream ) {
+  if( stream.pending.valid() ) {
+    stream.pending.wait();
+  }
+  if( stream.fd >= 0 ) {
+    close( stream.fd );
+  }
+  stream.fd = -1;
+  std::vector<char>().swap( stream.text );
+  std::vector<char>().swap( stream.block );
+  std::vector<char>().swap( stream.next );
+}
+
+/*
+  Given a filename, an image filename and a 64-bit image hash, append
+  a line "image_filename,hash" to the file, with the hash written as 16
+  hexadecimal digits. If reset_file is true, the existing contents are
+  cleared first.
+
+  The function returns a non-zero value in case of an error.
+ */
+int append_image_hash_csv( char *filename, char *image_filename, uint64_t hash, int reset_file ) {
+  FILE *fp = fopen( filename, reset_file ? "w" : "a" );
+  if(!fp) {
+    printf("Unable to open output file %s\n", filename );
+    exit(-1);
+  }
+  fprintf( fp, "%s,%016llx\n", image_filename, (unsigned long long)hash );
+  fclose(fp);
+
+  return(0);
+}
+
+/*
+  Reads a file written by append_image_hash_csv. filenames will
+  contain all of the image file names and hashes the matching hashes.
+  Malformed lines are reported and skipped.
+
+  The function returns a non-zero value if the file cannot be read.
+ */
+int read_image_hash_csv( char *filename, std::vector<std::string> &filenames, std::vector<uint64_t> &hashes ) {
+  FILE *fp = fopen( filename, "r" );
+  if( !fp ) {
+    printf("Unable to open hash file %s\n", filename );
+    return(-1);
+  }
+
+  filenames.clear();
+  hashes.clear();
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  int lineNum = 0;
+  while( (len = getline( &line, &cap, fp )) != -1 ) {
+    lineNum++;
+    while( len > 0 && (line[len-1] == '\n' || line[len-1] == '\r') ) {
+      len--;
+    }
+    if( len == 0 ) {
+      continue;
+    }
+    // the hash is after the last comma, the filename may contain commas
+    const char *comma = line + len - 1;
+    while( comma > line && *comma != ',' ) {
+      comma--;
+    }
+    uint64_t hash = 0;
+    std::from_chars_result r = std::from_chars( comma + 1, line + len, hash, 16 );
+    if( comma == line || r.ec != std::errc() || r.ptr != line + len ) {
+      printf("Skipping malformed line %d in %s\n", lineNum, filename );
+      continue;
+    }
+    filenames.emplace_back( line, comma - line );
+    hashes.push_back( hash );
+  }
+  free( line );
+  fclose( fp );
+
+  return(0);
+}
@@ -10,6 +10,48 @@
 #ifndef cvs_util_hpp
 #define cvs_util_hpp
 
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <future>
+#include <functional>
+#include <sys/types.h>
+
+/*
+  Rows parsed from a feature file. The filenames are packed into one
+  string, nameEnds holds the end offset of each. data holds
+  nameEnds.size() x numFeatures floats, row-major. rowOffsets holds
+  the byte offset of the line of each row, from the start of the
+  parsed text.
+ */
+struct CsvChunk {
+  std::vector<float> data;
+  std::string names;
+  std::vector<size_t> nameEnds;
+  std::vector<size_t> rowOffsets;
+  std::vector<int> badLines;
+  int numLines = 0;
+};
+
+/*
+  A feature file read block by block, see open_image_data_csv_stream.
+  Two blocks are held at a time: the one being parsed and the one
+  being read in the background.
+ */
+struct CsvStream {
+  int fd = -1;
+  std::string filename;
+  size_t blockBytes = 0;
+  off_t offset = 0;
+  int numFeatures = -1;
+  int lineBase = 1;
+  int eof = 0;
+  std::vector<char> text;
+  std::vector<char> block;
+  std::vector<char> next;
+  std::future<ssize_t> pending;
+};
+
 /*
   Given a filename, and image filename, and the image features, by
   default the function will append a line of data to the CSV format
@@ -41,4 +83,86 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
  */
 int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file = 0 );
 
+/*
+  Destination of the rows of read_image_data_csv_into. Called with the
+  number of features and an upper bound on the number of rows; returns
+  room for that many rows and sets stride to the distance in floats
+  between consecutive rows, at least the number of features.
+ */
+typedef std::function<float *( int numFeatures, size_t maxRows, size_t &stride )> CsvRowAllocator;
+
+/*
+  Reads the same file format as read_image_data_csv, but maps the file
+  into memory and parses line-aligned chunks of it in parallel straight
+  into the rows returned by allocate, with no intermediate copy.
+  Row i of the file is written at
+  rows + i*stride; the floats between numFeatures and stride are left
+  untouched, as are the rows after the last one read.
+
+  names receives the image file names of the rows, packed as in a
+  CsvChunk, and their byte offsets in the file; its data is left empty.
+  numFeatures is the number of feature columns on the first line.
+  numThreads is the number of parser threads, 0 uses one per core.
+
+  Malformed lines are reported with their line number and skipped.
+
+  The function returns the number of rows read, or -1 if the file
+  cannot be read.
+ */
+long read_image_data_csv_into( char *filename, int &numFeatures, const CsvRowAllocator &allocate, CsvChunk &names, int numThreads = 0 );
+
+/*
+  Reads one row of a feature file opened as fd: the line starting at
+  byte offset, as recorded in CsvChunk::rowOffsets. name is set to its
+  image file name and its numFeatures floats are written to row.
+
+  The function returns a non-zero value if the line cannot be read or
+  is malformed.
+ */
+int read_image_data_csv_row( int fd, off_t offset, int numFeatures, std::string &name, float *row );
+
+/*
+  Opens a feature file with the format of read_image_data_csv for
+  reading it block_bytes at a time with read_image_data_csv_stream.
+  Memory use stays at a few blocks no matter how large the file is.
+
+  The function returns a non-zero value if the file cannot be opened.
+ */
+int open_image_data_csv_stream( char *filename, size_t block_bytes, CsvStream &stream );
+
+/*
+  Reads the rows of the next block of the file into chunk while the
+  block after it is read in the background. stream.numFeatures is set
+  from the first line of the file. Malformed lines are reported and
+  skipped.
+
+  The function returns the number of rows read, 0 at the end of the
+  file and -1 if the file cannot be read.
+ */
+int read_image_data_csv_stream( CsvStream &stream, CsvChunk &chunk );
+
+/*
+  Closes a feature file opened with open_image_data_csv_stream.
+ */
+void close_image_data_csv_stream( CsvStream &stream );
+
+/*
+  Given a filename, an image filename and a 64-bit image hash, append
+  a line "image_filename,hash" to the file, with the hash written as 16
+  hexadecimal digits. If reset_file is true, the existing contents are
+  cleared first.
+
+  The function returns a non-zero value in case of an error.
+ */
+int append_image_hash_csv( char *filename, char *image_filename, uint64_t hash, int reset_file = 0 );
+
+/*
+  Reads a file written by append_image_hash_csv. filenames will
+  contain all of the image file names and hashes the matching hashes.
+  Malformed lines are reported and skipped.
+
+  The function returns a non-zero value if the file cannot be read.
+ */
+int read_image_hash_csv( char *filename, std::vector<std::string> &filenames, std::vector<uint64_t> &hashes );
+
 #endif
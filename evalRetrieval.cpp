@@ -0,0 +1,292 @@
+//
+//  evalRetrieval.cpp
+//  Project2
+//
+//  Retrieval quality and latency evaluation.
+//  Runs every query of a ground-truth file for each combination of featureType,
+//  matchingMethod and search mode, and reports precision@K, recall@K, mAP@K,
+//  the overlap with the exact search and per-query latency percentiles.
+//
+#include <stdio.h>
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "search_index.hpp"
+
+// A query image with the images relevant to it
+struct GroundTruth {
+    std::string query;
+    std::vector<std::string> relevant;
+    cv::Mat img;
+};
+
+// Quality and latency of one featureType / matchingMethod / search mode combination
+struct EvalResult {
+    int featureType;
+    int matchingMethod;
+    int mode;
+    double precision;
+    double recall;
+    double map;
+    double exactOverlap;
+    double coverage;
+    double latencyMean;
+    double latencyP50;
+    double latencyP95;
+    double latencyP99;
+};
+
+// Read a ground-truth file. Each line is a query image path followed by the
+// paths of the images relevant to it, comma separated, written the same way
+// as the image paths in the feature files.
+// filename - Ground-truth file
+// truth - One entry per line
+int readGroundTruth(const char *filename, std::vector<GroundTruth> &truth){
+    FILE *fp = fopen(filename, "r");
+    if (!fp){
+        printf("Unable to open ground-truth file %s\n", filename);
+        return -1;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, fp)) != -1){
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+        if (len == 0) continue;
+        GroundTruth gt;
+        char *save = NULL;
+        for (char *tok = strtok_r(line, ",", &save); tok; tok = strtok_r(NULL, ",", &save)){
+            if (gt.query.empty()) gt.query = tok;
+            else gt.relevant.push_back(tok);
+        }
+        truth.push_back(gt);
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+// Parse a comma separated list of integers
+// value - list, e.g. "2,3,4"
+// list - parsed integers
+void parseIntList(const char *value, std::vector<int> &list){
+    list.clear();
+    for (const char *p = value; *p; ){
+        list.push_back(atoi(p));
+        p = strchr(p, ',');
+        if (!p) break;
+        p++;
+    }
+}
+
+// Latency percentile of sorted latencies
+// sorted - latencies in ascending order
+// q - percentile in [0, 1]
+double percentile(std::vector<double> &sorted, double q){
+    if (sorted.empty()) return 0;
+    size_t idx = (size_t)(q*(sorted.size()-1) + 0.5);
+    return sorted[std::min(idx, sorted.size()-1)];
+}
+
+// Name of a search mode
+const char *modeName(int mode){
+    switch (mode) {
+        case SEARCH_PCA: return "pca";
+        case SEARCH_IVFPQ: return "ivfpq";
+        case SEARCH_STREAM: return "stream";
+        case SEARCH_ANYTIME: return "anytime";
+        case SEARCH_VPTREE: return "vptree";
+        case SEARCH_TWO_STAGE: return "twostage";
+        default: return "exact";
+    }
+}
+
+// Run every query of the ground truth with one search mode, and score the top K results
+// truth - Ground truth, with the query images loaded
+// index - Search index opened for the mode
+// options - Search options, with the mode set
+// k - Number of results per query
+// exact - Paths of the exact results per query, filled in by the exact mode and compared against by the others.
+//         Paths rather than rows, since the two-stage search returns rows of its coarse feature files.
+// result - Scores of the mode
+int evaluateMode(std::vector<GroundTruth> &truth,
+                 SearchIndex &index,
+                 SearchOptions &options,
+                 int k,
+                 std::vector<std::vector<std::string>> &exact,
+                 EvalResult &result
+                 ){
+    std::vector<double> latencies;
+    double precision = 0, recall = 0, map = 0, overlap = 0, coverage = 0;
+    int numScored = 0;
+    if (options.mode == SEARCH_EXACT) exact.assign(truth.size(), std::vector<std::string>());
+    
+    for (int q = 0; q<truth.size(); q++){
+        GroundTruth &gt = truth[q];
+        std::vector<std::pair<float, int>> topK;
+        auto start = std::chrono::steady_clock::now();
+        searchIndex(index, gt.img, k+1, options, topK);
+        latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        coverage += index.coverage;
+        
+        // Drop the query image itself and keep the top K
+        std::vector<int> rows;
+        for (std::pair<float, int> &t : topK){
+            if ((int)rows.size() < k && gt.query != searchResultPath(index, t.second)) rows.push_back(t.second);
+        }
+        if (options.mode == SEARCH_EXACT){
+            for (int r : rows) exact[q].push_back(searchResultPath(index, r));
+        }
+        else {
+            int same = 0;
+            for (int r : rows) same += std::count(exact[q].begin(), exact[q].end(), searchResultPath(index, r));
+            overlap += exact[q].empty() ? 1.0 : (double)same/exact[q].size();
+        }
+        
+        if (gt.relevant.empty()) continue;
+        int hits = 0;
+        double ap = 0;
+        for (int i = 0; i<rows.size(); i++){
+            const char *path = searchResultPath(index, rows[i]);
+            if (std::find(gt.relevant.begin(), gt.relevant.end(), path) != gt.relevant.end()){
+                hits++;
+                ap += (double)hits/(i+1);
+            }
+        }
+        precision += (double)hits/k;
+        recall += (double)hits/gt.relevant.size();
+        map += ap/std::min((int)gt.relevant.size(), k);
+        numScored++;
+    }
+    
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (double l : latencies) total += l;
+    result.mode = options.mode;
+    result.precision = numScored ? precision/numScored : 0;
+    result.recall = numScored ? recall/numScored : 0;
+    result.map = numScored ? map/numScored : 0;
+    result.exactOverlap = options.mode == SEARCH_EXACT ? 1.0 : overlap/std::max((size_t)1, truth.size());
+    result.coverage = truth.empty() ? 1.0 : coverage/truth.size();
+    result.latencyMean = latencies.empty() ? 0 : total/latencies.size();
+    result.latencyP50 = percentile(latencies, 0.50);
+    result.latencyP95 = percentile(latencies, 0.95);
+    result.latencyP99 = percentile(latencies, 0.99);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    /*
+     argv[1] - ground-truth file: one line per query, the query image path followed by the relevant image paths
+     argv[2] - K, the number of results scored per query
+     optional arguments
+     --features=LIST - comma separated featureTypes to evaluate, default 2
+     --methods=LIST - comma separated matchingMethods to evaluate, default 1,2
+     --modes=LIST - comma separated search modes to evaluate (exact,pca,ivfpq,stream,anytime,vptree,twostage), default exact.
+                    The exact search is always run first, as the baseline of the exactOverlap column.
+     --report=FILE - also write the results as CSV
+     search options, see parseSearchOption
+     The feature files must have been computed with imgRetrieval beforehand.
+     */
+    if (argc < 3) {
+        printf("usage: %s <groundTruth> <K> [--features=2,3] [--methods=1,2] [--modes=exact,pca,ivfpq,stream,anytime,vptree,twostage] [--report=FILE] [search options]\n", argv[0]);
+        return -1;
+    }
+    
+    std::vector<GroundTruth> truth;
+    if (readGroundTruth(argv[1], truth) != 0) return -1;
+    int k = atoi(argv[2]);
+    
+    std::vector<int> features = {2};
+    std::vector<int> methods = {1, 2};
+    std::vector<int> modes = {SEARCH_EXACT};
+    const char *reportFile = NULL;
+    SearchOptions options;
+    for (int i = 3; i < argc; i++) {
+        const char *value;
+        int parsed = parseSearchOption(argv[i], options);
+        if (parsed < 0) return -1;
+        if (parsed) continue;
+        if ((value = optionValue(argv[i], "--features"))) parseIntList(value, features);
+        else if ((value = optionValue(argv[i], "--methods"))) parseIntList(value, methods);
+        else if ((value = optionValue(argv[i], "--report"))) reportFile = value;
+        else if ((value = optionValue(argv[i], "--modes"))) {
+            modes = {SEARCH_EXACT};
+            for (const char *p = value; *p; ){
+                if (strncmp(p, "pca", 3) == 0) modes.push_back(SEARCH_PCA);
+                else if (strncmp(p, "ivfpq", 5) == 0) modes.push_back(SEARCH_IVFPQ);
+                else if (strncmp(p, "stream", 6) == 0) modes.push_back(SEARCH_STREAM);
+                else if (strncmp(p, "anytime", 7) == 0) modes.push_back(SEARCH_ANYTIME);
+                else if (strncmp(p, "vptree", 6) == 0) modes.push_back(SEARCH_VPTREE);
+                else if (strncmp(p, "twostage", 8) == 0) modes.push_back(SEARCH_TWO_STAGE);
+                else if (strncmp(p, "exact", 5) != 0) {
+                    printf("Unknown search mode %s\n", p);
+                    return -1;
+                }
+                p = strchr(p, ',');
+                if (!p) break;
+                p++;
+            }
+        }
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+    
+    // Decode the query images once
+    for (GroundTruth &gt : truth){
+        gt.img = cv::imread(gt.query, cv::IMREAD_COLOR);
+        if (gt.img.empty()){
+            printf("Unable to read query image %s\n", gt.query.c_str());
+            return -1;
+        }
+    }
+    
+    std::vector<EvalResult> results;
+    for (int featureType : features){
+        for (int matchingMethod : methods){
+            SearchIndex index;
+            std::vector<std::vector<std::string>> exact;
+            for (int mode : modes){
+                EvalResult result;
+                result.featureType = featureType;
+                result.matchingMethod = matchingMethod;
+                options.mode = mode;
+                openSearchIndex(featureType, matchingMethod, options, index);
+                evaluateMode(truth, index, options, k, exact, result);
+                results.push_back(result);
+            }
+        }
+    }
+    
+    printf("\n%lu queries, K = %d, latency in ms per query (feature extraction and search)\n", truth.size(), k);
+    printf("feature method mode    P@K    R@K    mAP@K  exactOverlap  coverage  mean     p50      p95      p99\n");
+    for (EvalResult &r : results){
+        printf("%7d %6d %-7s %.4f %.4f %.4f %.4f        %.4f    %8.3f %8.3f %8.3f %8.3f\n",
+               r.featureType, r.matchingMethod, modeName(r.mode), r.precision, r.recall, r.map,
+               r.exactOverlap, r.coverage, r.latencyMean, r.latencyP50, r.latencyP95, r.latencyP99);
+    }
+    
+    if (reportFile){
+        FILE *fp = fopen(reportFile, "w");
+        if (!fp){
+            printf("Unable to open output file %s\n", reportFile);
+            return -1;
+        }
+        fprintf(fp, "featureType,matchingMethod,mode,precision,recall,map,exactOverlap,coverage,latencyMean,latencyP50,latencyP95,latencyP99\n");
+        for (EvalResult &r : results){
+            fprintf(fp, "%d,%d,%s,%.6f,%.6f,%.6f,%.6f,%.6f,%.4f,%.4f,%.4f,%.4f\n",
+                    r.featureType, r.matchingMethod, modeName(r.mode), r.precision, r.recall, r.map,
+                    r.exactOverlap, r.coverage, r.latencyMean, r.latencyP50, r.latencyP95, r.latencyP99);
+        }
+        fclose(fp);
+    }
+    return 0;
+}
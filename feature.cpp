@@ -5,17 +5,63 @@
 //  This files contains functions that can be used to extract features from an input image.
 //  Created by Thean Cheat Lim on 2/4/23.
 //
+#include <algorithm>
+#include <map>
+#include <mutex>
 #include <opencv2/opencv.hpp>
+#include <opencv2/features2d.hpp>
 #include "feature.hpp"
 #include "util.hpp"
+#include "kernels.hpp"
 
-// Extract the widthxheight pixels from the middle of input image and write those pixel values into outputVector
+FeatureContext::FeatureContext() : orbMaxKeypoints(0) {
+    cv::Mat L5 = (cv::Mat_<double>(1, 5) << 1, 4, 6, 4, 1);
+    lawsFilters[0] = L5 / 16.0;
+    lawsFilters[1] = (cv::Mat_<double>(1, 5) << 1, 2, 0, -2, -1);
+    lawsFilters[2] = (cv::Mat_<double>(1, 5) << -1, 0, 2, 0, -1);
+    lawsFilters[3] = (cv::Mat_<double>(1, 5) << 1, -2, 0, 2, -1);
+    lawsFilters[4] = (cv::Mat_<double>(1, 5) << 1, -4, 6, -4, 1);
+    
+    int kernel_size = 20;
+    double sigma = 2;
+    double lambda = 5;
+    double theta = 0;
+    double gamma = 2;
+    gaborKernel = cv::getGaborKernel(cv::Size(kernel_size, kernel_size), sigma, theta, lambda, gamma, 0, CV_32F);
+}
+
+// Context of the calling thread, used by the functions writing into a std::vector
+static FeatureContext &threadContext(){
+    static thread_local FeatureContext context;
+    return context;
+}
+
+// Grow a vector by n floats and return the first of them
+static float *appendStorage(std::vector<float> &outputVector, size_t n){
+    size_t base = outputVector.size();
+    outputVector.resize(base + n);
+    return outputVector.data() + base;
+}
+
+// Header of a rows x cols image of the given type over a scratch buffer. The buffer is only grown,
+// so once it has held an image, images of that size or smaller take no allocation.
+// buffer - Scratch buffer
+// rows - rows of the image
+// cols - cols of the image
+// type - OpenCV type of the image
+static cv::Mat scratchImage(std::vector<uchar> &buffer, int rows, int cols, int type){
+    size_t bytes = (size_t)rows*cols*CV_ELEM_SIZE(type);
+    if (buffer.size() < bytes) buffer.resize(bytes);
+    return cv::Mat(rows, cols, type, buffer.data());
+}
+
+// Extract the widthxheight pixels from the middle of input image and write those pixel values into output
 // For each pixel, write the values in the order of B, G and R
 // img - Input image
 // width - width
 // height - height
-// outputVector - vector containing features of the input image
-int extractMiddleVector(cv::Mat &img, int width, int height, std::vector<float> &outputVector){
+// output - width*height*3 floats
+int extractMiddleVector(cv::Mat &img, int width, int height, float *output){
     int midRow = (img.rows%2 == 0)? img.rows/2 : img.rows/2+1;
     int midCol = (img.cols%2 == 0)? img.cols/2 : img.cols/2+1;
     
@@ -24,24 +70,46 @@ int extractMiddleVector(cv::Mat &img, int width, int height, std::vector<float>
         cv::Vec3b *sptr = img.ptr<cv::Vec3b>(i);
         //loop over the columns
         for(int j=midCol-width/2; j<midCol-width/2+width; j++){
-            outputVector.push_back(sptr[j][0]);
-            outputVector.push_back(sptr[j][1]);
-            outputVector.push_back(sptr[j][2]);
+            *output++ = sptr[j][0];
+            *output++ = sptr[j][1];
+            *output++ = sptr[j][2];
         }
     }
     return 0;
 }
 
+int extractMiddleVector(cv::Mat &img, int width, int height, std::vector<float> &outputVector){
+    return extractMiddleVector(img, width, height, appendStorage(outputVector, (size_t)width*height*3));
+}
+
 // Given an input image, and number of histogram bins,
 // Create a 3D histogram with `bins` bins, and project each pixel from the input image to the histogram.
 // Normalize the histogram
-// Write the 3D histogram into the provided output vector.
+// Write the 3D histogram into the provided output.
+// Uses the kernel specialized on the bin count for 4, 8, 16 and 32 bins, and the generic code otherwise.
 // img - Input image
 // bins - number of histogram bins
-// outputVector - vector containing features of the input image
+// output - bins^3 floats
+int extract3DHistVector(cv::Mat &img, int bins, float *output){
+    switch (bins) {
+        case 4: hist3DKernel<4>(img, output); return 0;
+        case 8: hist3DKernel<8>(img, output); return 0;
+        case 16: hist3DKernel<16>(img, output); return 0;
+        case 32: hist3DKernel<32>(img, output); return 0;
+        default: return extract3DHistVectorGeneric(img, bins, output);
+    }
+}
+
 int extract3DHistVector(cv::Mat &img, int bins, std::vector<float> &outputVector){
-    int sizes [] = {bins, bins, bins};
-    cv::Mat histMat(3, sizes, CV_32FC1, cv::Scalar(0));
+    return extract3DHistVector(img, bins, appendStorage(outputVector, (size_t)bins*bins*bins));
+}
+
+// Generic version of extract3DHistVector for any number of bins
+// img - Input image
+// bins - number of histogram bins
+// output - bins^3 floats
+int extract3DHistVectorGeneric(cv::Mat &img, int bins, float *output){
+    std::fill(output, output + bins*bins*bins, 0.0f);
 
     // Loop through row and col of image
     for(int i=0; i<img.rows; i++){
@@ -52,33 +120,54 @@ int extract3DHistVector(cv::Mat &img, int bins, std::vector<float> &outputVector
             uchar bIdx = sptr[j][0]*bins/256;
             uchar gIdx = sptr[j][1]*bins/256;
             uchar rIdx = sptr[j][2]*bins/256;
-            histMat.at<float>(bIdx, gIdx, rIdx)+=1;
+            output[(bIdx*bins + gIdx)*bins + rIdx]+=1;
         }
     }
     
-    // loop through and flatten them into std::vector<float>, while normalizing
-    float N = img.rows*img.cols;;
-    for(int i = 0; i < bins; i++){
-        for(int j = 0; j < bins; j++){
-            for(int k = 0; k < bins; k++){
-                outputVector.push_back(histMat.at<float>(i,j,k)/N);
-            }
-        }
+    // Normalize
+    float N = img.rows*img.cols;
+    for(int n = 0; n < bins*bins*bins; n++){
+        output[n] = output[n]/N;
     }
     return 0;
 }
 
+int extract3DHistVectorGeneric(cv::Mat &img, int bins, std::vector<float> &outputVector){
+    return extract3DHistVectorGeneric(img, bins, appendStorage(outputVector, (size_t)bins*bins*bins));
+}
+
 // Given an input image, number of histogram bins, and softWidth (width to spread out a pixel value)
 // create a 3D soft histogram with `bins` bins, and project and spread each pixel into width of `softWidth`
 // from the input image to the histogram.
 // The 3D histogram is normalized.
-// Write the 3D soft histogram into the provided output vector.
+// Write the 3D soft histogram into the provided output.
+// Uses the kernel specialized on the bin count for 4, 8, 16 and 32 bins, and the generic code otherwise.
 // img - Input image
 // bins - number of histogram bins
-// outputVector - vector containing features of the input image
+// softWidth - width to spread out a pixel value
+// output - bins^3 floats
+int extract3DSoftHistVector(cv::Mat &img, int bins, int softWidth, float *output){
+    if (softWidth <= 0) return extract3DSoftHistVectorGeneric(img, bins, softWidth, output);
+    switch (bins) {
+        case 4: softHist3DKernel<4>(img, softWidth, output); return 0;
+        case 8: softHist3DKernel<8>(img, softWidth, output); return 0;
+        case 16: softHist3DKernel<16>(img, softWidth, output); return 0;
+        case 32: softHist3DKernel<32>(img, softWidth, output); return 0;
+        default: return extract3DSoftHistVectorGeneric(img, bins, softWidth, output);
+    }
+}
+
 int extract3DSoftHistVector(cv::Mat &img, int bins, int softWidth, std::vector<float> &outputVector){
-    int sizes [] = {bins, bins, bins};
-    cv::Mat histMat(3, sizes, CV_32FC1, cv::Scalar(0));
+    return extract3DSoftHistVector(img, bins, softWidth, appendStorage(outputVector, (size_t)bins*bins*bins));
+}
+
+// Generic version of extract3DSoftHistVector for any number of bins
+// img - Input image
+// bins - number of histogram bins
+// softWidth - width to spread out a pixel value
+// output - bins^3 floats
+int extract3DSoftHistVectorGeneric(cv::Mat &img, int bins, int softWidth, float *output){
+    std::fill(output, output + bins*bins*bins, 0.0f);
 
     // Loop through row and col of image
     for(int i=0; i<img.rows; i++){
@@ -90,95 +179,337 @@ int extract3DSoftHistVector(cv::Mat &img, int bins, int softWidth, std::vector<f
                 uchar bIdx = clamp(sptr[j][0]+w, 0, 255)/softWidth*bins/256;
                 uchar gIdx = clamp(sptr[j][1]+w, 0, 255)/softWidth*bins/256;
                 uchar rIdx = clamp(sptr[j][2]+w, 0, 255)/softWidth*bins/256;
-                histMat.at<float>(bIdx, gIdx, rIdx)+=1;
+                output[(bIdx*bins + gIdx)*bins + rIdx]+=1;
             }
         }
     }
     
-    // loop through and flatten them into std::vector<float>, while normalizing
+    // Normalize
     float N = img.rows*img.cols;
-    for(int i = 0; i < bins; i++){
-        for(int j = 0; j < bins; j++){
-            for(int k = 0; k < bins; k++){
-                outputVector.push_back(histMat.at<float>(i,j,k)/N);
-            }
-        }
+    for(int n = 0; n < bins*bins*bins; n++){
+        output[n] = output[n]/N;
     }
     return 0;
 }
 
+int extract3DSoftHistVectorGeneric(cv::Mat &img, int bins, int softWidth, std::vector<float> &outputVector){
+    return extract3DSoftHistVectorGeneric(img, bins, softWidth, appendStorage(outputVector, (size_t)bins*bins*bins));
+}
+
 // Given an input image, convert it into Grayscale, compute the Sobel Magnitude,
 // and use it to as the input image. to the extract3DHistVector function
-// img - Input image
+// The image is streamed through grayscale, Sobel filters, magnitude and histogram in bands of rows
+// sized to fit in the L2 cache, keeping only the rows the filters need from the band before.
+// Same output as extractSobelTextureVectorFullImage, without any full-size intermediate image.
+// context - Scratch buffers
+// img - Input image, left unchanged
 // bins - number of histogram bins
-// outputVector - vector containing features of the input image
+// output - bins^3 floats
+int extractSobelTextureVector(FeatureContext &context, cv::Mat &img, int bins, float *output){
+    int rows = img.rows;
+    int cols = img.cols;
+    // sobelX3x3 and sobelY3x3 read a grayscale row as cols 3-channel pixels, running into
+    // the next two rows, so a band holds two more grayscale rows than it filters
+    int bandRows = std::max(1, 256*1024 / (4*cols));
+    cv::Mat gray = scratchImage(context.gray, bandRows + 2, cols, CV_8UC1);
+    int bandStart = 0;
+    int bandEnd = 0;
+    
+    // Row passes of the last three rows, and the Sobel images and magnitude of one row
+    std::vector<cv::Vec3s> &rowX = context.rowX, &rowY = context.rowY, &sx = context.sobelX, &sy = context.sobelY;
+    std::vector<cv::Vec3b> &mag = context.magnitude;
+    rowX.resize(3*cols);
+    rowY.resize(3*cols);
+    sx.resize(cols);
+    sy.resize(cols);
+    mag.resize(cols);
+    // Same bins and accumulation order as extract3DHistVector
+    std::fill(output, output + bins*bins*bins, 0.0f);
+    
+    // Column passes, magnitude and histogram of row i, once the row passes of rows i-1 to i+1 are done
+    auto finishRow = [&](int i){
+        const cv::Vec3s *xptr = &rowX[(i%3)*cols];
+        const cv::Vec3s *yptr = &rowY[(i%3)*cols];
+        if (i > 0 && i < rows-1){
+            sobelXColumn(&rowX[((i-1)%3)*cols], xptr, &rowX[((i+1)%3)*cols], sx.data(), cols);
+            sobelYColumn(&rowY[((i-1)%3)*cols], &rowY[((i+1)%3)*cols], sy.data(), cols);
+            xptr = sx.data();
+            yptr = sy.data();
+        }
+        magnitudeRow(xptr, yptr, mag.data(), cols);
+        for(int j=0; j<cols; j++){
+            int bIdx = mag[j][0]*bins/256;
+            int gIdx = mag[j][1]*bins/256;
+            int rIdx = mag[j][2]*bins/256;
+            output[(bIdx*bins + gIdx)*bins + rIdx] += 1;
+        }
+    };
+    
+    for(int i=0; i<rows; i++){
+        if (i >= bandEnd){
+            // Convert the next band, with the two grayscale rows after it. Zeros past the last row.
+            bandStart = i;
+            bandEnd = std::min(rows, i + bandRows);
+            int last = std::min(rows, bandEnd + 2);
+            cv::Mat grayRows = gray.rowRange(0, last - i);
+            cv::cvtColor(img.rowRange(i, last), grayRows, cv::COLOR_BGR2GRAY);
+            if (last - i < bandRows + 2) gray.rowRange(last - i, bandRows + 2).setTo(cv::Scalar(0));
+        }
+        const cv::Vec3b *sptr = gray.ptr<cv::Vec3b>(i - bandStart);
+        sobelXRow(sptr, &rowX[(i%3)*cols], cols);
+        sobelYRow(sptr, &rowY[(i%3)*cols], cols);
+        if (i > 0) finishRow(i-1);
+    }
+    if (rows > 0) finishRow(rows-1);
+    
+    float N = rows*cols;
+    for(int n=0; n<bins*bins*bins; n++){
+        output[n] = output[n]/N;
+    }
+    return 0;
+}
+
 int extractSobelTextureVector(cv::Mat &img, int bins, std::vector<float> &outputVector){
-    cv::cvtColor(img, img, cv::COLOR_BGR2GRAY);
+    return extractSobelTextureVector(threadContext(), img, bins, appendStorage(outputVector, (size_t)bins*bins*bins));
+}
+
+// Whole-image version of extractSobelTextureVector: convert the image into Grayscale,
+// compute the Sobel Magnitude, and use it to as the input image. to the extract3DHistVector function
+// img - Input image, left unchanged
+// bins - number of histogram bins
+// outputVector - vector containing features of the input image
+int extractSobelTextureVectorFullImage(cv::Mat &img, int bins, std::vector<float> &outputVector){
+    // sobelX3x3 and sobelY3x3 read a grayscale row as cols 3-channel pixels, running into
+    // the next two rows; two rows of zeros after the image keep the last rows within the image
+    cv::Mat padded = cv::Mat::zeros(img.rows + 2, img.cols, CV_8UC1);
+    cv::Mat gray = padded.rowRange(0, img.rows);
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
     cv::Mat sobelX;
     cv::Mat sobelY;
     cv::Mat sobelGradMagnitude;
-    sobelX3x3(img, sobelX);
-    sobelY3x3(img, sobelY);
+    sobelX3x3(gray, sobelX);
+    sobelY3x3(gray, sobelY);
     magnitude(sobelX, sobelY, sobelGradMagnitude);
     return extract3DHistVector(sobelGradMagnitude, bins, outputVector);
 }
 
+// Grayscale filter response over the response buffer of a context, followed by two rows of zeros:
+// extract3DHistVector reads a grayscale row as cols 3-channel pixels, running into the next two rows.
+// context - Scratch buffers
+// rows - rows of the response
+// cols - cols of the response
+static cv::Mat paddedResponse(FeatureContext &context, int rows, int cols){
+    cv::Mat padded = scratchImage(context.response, rows + 2, cols, CV_8UC1);
+    padded.rowRange(rows, rows + 2).setTo(cv::Scalar(0));
+    return padded.rowRange(0, rows);
+}
+
 // Given an input image, convert it into Grayscale, compute and average the 14 Law's Filters output,
 // and use it to as the input image. to the extract3DHistVector function
-// img - Input image
+// context - Laws filters and scratch buffers
+// img - Input image, left unchanged
 // bins - number of histogram bins
-// outputVector - vector containing features of the input image
-int extractLawsTextureVector(cv::Mat &img, int bins, std::vector<float> &outputVector){
-    cv::cvtColor(img, img, cv::COLOR_BGR2GRAY);
-    cv::Mat L5 = (cv::Mat_<double>(1, 5) << 1, 4, 6, 4, 1);
-    L5 = L5 / 16.0;
-    cv::Mat E5 = (cv::Mat_<double>(1, 5) << 1, 2, 0, -2, -1);
-    cv::Mat S5 = (cv::Mat_<double>(1, 5) << -1, 0, 2, 0, -1);
-    cv::Mat W5 = (cv::Mat_<double>(1, 5) << 1, -2, 0, 2, -1);
-    cv::Mat R5 = (cv::Mat_<double>(1, 5) << 1, -4, 6, -4, 1);
-    
-    std::vector<cv::Mat> filters = {L5, E5, S5, W5, R5};
-    cv::Mat sum_mat, mean_mat;
-//    sum_mat = cv::Mat::zeros(img.rows, img.cols, CV_32FC3);
-    sum_mat = cv::Mat::zeros(img.rows, img.cols, CV_32FC1);
+// output - bins^3 floats
+int extractLawsTextureVector(FeatureContext &context, cv::Mat &img, int bins, float *output){
+    cv::Mat gray = scratchImage(context.gray, img.rows, img.cols, CV_8UC1);
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    cv::Mat sum_mat = scratchImage(context.sum, img.rows, img.cols, CV_32FC1);
+    cv::Mat filteredImg = scratchImage(context.filtered, img.rows, img.cols, CV_8UC1);
+    sum_mat.setTo(cv::Scalar(0));
     
+    // sepFilter2D takes its kernels as vectors of either orientation
     for (int i = 0; i<5; i++){
         for(int j = i; j<5; j++){
-            cv::Mat filteredImg;
-            cv::sepFilter2D(img, filteredImg, -1, filters[i], filters[j].t());
-            sum_mat+=filteredImg;
+            cv::sepFilter2D(gray, filteredImg, -1, context.lawsFilters[i], context.lawsFilters[j]);
+            cv::add(sum_mat, filteredImg, sum_mat, cv::noArray(), CV_32F);
         }
     }
-    mean_mat = sum_mat / 14; // 14 filters in total
-    cv::Mat output;
-    mean_mat.convertTo(output, CV_8UC3, 1.0);
+    sum_mat.convertTo(sum_mat, CV_32F, 1.0/14); // 14 filters in total
+    cv::Mat mean_mat = paddedResponse(context, img.rows, img.cols);
+    sum_mat.convertTo(mean_mat, CV_8U, 1.0);
     
-    return extract3DHistVector(output, 8, outputVector);
+    return extract3DHistVector(mean_mat, bins, output);
+}
+
+int extractLawsTextureVector(cv::Mat &img, int bins, std::vector<float> &outputVector){
+    return extractLawsTextureVector(threadContext(), img, bins, appendStorage(outputVector, (size_t)bins*bins*bins));
 }
 
 // Given an input image, convert it into Grayscale, apply the Gabor's Filters,
 // and use it to as the input image. to the extract3DHistVector function
-// img - Input image
+// context - Gabor kernel and scratch buffers
+// img - Input image, left unchanged
 // bins - number of histogram bins
-// outputVector - vector containing features of the input image
-int extractGaborTextureVector(cv::Mat &img, int bins,  std::vector<float> &outputVector){
-    cv::Mat dst;
-    cv::cvtColor(img, img, cv::COLOR_BGR2GRAY); 
-    // Create the filter
-    int kernel_size = 20;
-    double sigma = 2;
-    double lambda = 5;
-    double theta = 0;
-    double gamma = 2;
-    cv::Mat gabor_kernel = cv::getGaborKernel(cv::Size(kernel_size, kernel_size), sigma, theta, lambda, gamma, 0, CV_32F);
+// output - bins^3 floats
+int extractGaborTextureVector(FeatureContext &context, cv::Mat &img, int bins, float *output){
+    cv::Mat gray = scratchImage(context.gray, img.rows, img.cols, CV_8UC1);
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
     
     // Filter the input image
-    cv::Mat filtered_image;
-    cv::filter2D(img, dst, -1, gabor_kernel);
+    cv::Mat dst = paddedResponse(context, img.rows, img.cols);
+    cv::filter2D(gray, dst, -1, context.gaborKernel);
 
     // Normalize the filtered image
     cv::normalize(dst, dst, 0, 255, cv::NORM_MINMAX);
-    dst.convertTo(dst, CV_8UC3);
 
-    return extract3DHistVector(dst, 8, outputVector);
+    return extract3DHistVector(dst, bins, output);
+}
+
+int extractGaborTextureVector(cv::Mat &img, int bins, std::vector<float> &outputVector){
+    return extractGaborTextureVector(threadContext(), img, bins, appendStorage(outputVector, (size_t)bins*bins*bins));
+}
+
+// Lookup table from a BGR pixel, quantized to 5 bits per channel and packed as (B << 10) | (G << 5) | R,
+// to its 3D histogram bin in colorSpace. Each table is built once, from the centre color of every
+// quantization cell, and kept for later calls.
+// colorSpace - COLOR_SPACE_HSV, COLOR_SPACE_LAB or COLOR_SPACE_OPPONENT
+// bins - number of histogram bins, at most 32
+static const std::vector<uint16_t> &colorBinTable(int colorSpace, int bins){
+    static std::mutex mutex;
+    static std::map<int, std::vector<uint16_t>> tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<uint16_t> &table = tables[colorSpace*64 + bins];
+    if (!table.empty()) return table;
+    
+    const int size = 32*32*32;
+    cv::Mat bgr(1, size, CV_32FC3);
+    cv::Vec3f *bptr = bgr.ptr<cv::Vec3f>(0);
+    for(int q=0; q<size; q++){
+        bptr[q][0] = ((q >> 10)*8 + 4)/255.0f;
+        bptr[q][1] = (((q >> 5) & 31)*8 + 4)/255.0f;
+        bptr[q][2] = ((q & 31)*8 + 4)/255.0f;
+    }
+    
+    // Convert every cell color, and scale each channel to [0, 1]
+    cv::Mat converted;
+    float scale[3], offset[3];
+    switch (colorSpace) {
+        case COLOR_SPACE_HSV:{
+            // H in [0, 360), S and V in [0, 1]
+            cv::cvtColor(bgr, converted, cv::COLOR_BGR2HSV);
+            scale[0] = 1/360.0f; scale[1] = 1; scale[2] = 1;
+            offset[0] = 0; offset[1] = 0; offset[2] = 0;
+            break;
+        }
+        case COLOR_SPACE_LAB:{
+            // L in [0, 100], a and b in [-127, 127]
+            cv::cvtColor(bgr, converted, cv::COLOR_BGR2Lab);
+            scale[0] = 1/100.0f; scale[1] = 1/256.0f; scale[2] = 1/256.0f;
+            offset[0] = 0; offset[1] = 128; offset[2] = 128;
+            break;
+        }
+        default:{
+            // O1 = R-G in [-1, 1], O2 = R+G-2B in [-2, 2], O3 = R+G+B in [0, 3]
+            converted.create(1, size, CV_32FC3);
+            cv::Vec3f *cptr = converted.ptr<cv::Vec3f>(0);
+            for(int q=0; q<size; q++){
+                float b = bptr[q][0], g = bptr[q][1], r = bptr[q][2];
+                cptr[q][0] = r - g;
+                cptr[q][1] = r + g - 2*b;
+                cptr[q][2] = r + g + b;
+            }
+            scale[0] = 1/2.0f; scale[1] = 1/4.0f; scale[2] = 1/3.0f;
+            offset[0] = 1; offset[1] = 2; offset[2] = 0;
+            break;
+        }
+    }
+    
+    table.resize(size);
+    cv::Vec3f *cptr = converted.ptr<cv::Vec3f>(0);
+    for(int q=0; q<size; q++){
+        int idx = 0;
+        for(int c=0; c<3; c++){
+            int bin = (int)((cptr[q][c] + offset[c])*scale[c]*bins);
+            idx = idx*bins + std::min(std::max(bin, 0), bins-1);
+        }
+        table[q] = (uint16_t)idx;
+    }
+    return table;
+}
+
+// Given an input image, a color space and number of histogram bins,
+// create a 3D histogram of the pixel colors in that color space with `bins` bins per channel.
+// Normalize the histogram
+// Each pixel is binned with one lookup in the table of colorBinTable.
+// img - Input image, 3-channel 8-bit BGR
+// colorSpace - COLOR_SPACE_HSV, COLOR_SPACE_LAB or COLOR_SPACE_OPPONENT
+// bins - number of histogram bins, at most 32
+// output - bins^3 floats
+int extractColorHistVector(cv::Mat &img, int colorSpace, int bins, float *output){
+    if (img.type() != CV_8UC3 || bins < 1 || bins > 32) {
+        printf("extractColorHistVector needs a 3-channel 8-bit image and 1 to 32 bins\n");
+        return -1;
+    }
+    const uint16_t *table = colorBinTable(colorSpace, bins).data();
+    std::fill(output, output + bins*bins*bins, 0.0f);
+    
+    for(int i=0; i<img.rows; i++){
+        cv::Vec3b *sptr = img.ptr<cv::Vec3b>(i);
+        for(int j=0; j<img.cols; j++){
+            int q = ((sptr[j][0] >> 3) << 10) | ((sptr[j][1] >> 3) << 5) | (sptr[j][2] >> 3);
+            output[table[q]] += 1;
+        }
+    }
+    
+    float N = img.rows*img.cols;
+    for(int n=0; n<bins*bins*bins; n++){
+        output[n] = output[n]/N;
+    }
+    return 0;
+}
+
+int extractColorHistVector(cv::Mat &img, int colorSpace, int bins, std::vector<float> &outputVector){
+    size_t size = (bins >= 1 && bins <= 32) ? bins*bins*bins : 0;
+    int status = extractColorHistVector(img, colorSpace, bins, appendStorage(outputVector, size));
+    if (status != 0) outputVector.resize(outputVector.size() - size);
+    return status;
+}
+
+// Given an input image, compute its 64-bit difference hash (dHash):
+// shrink the grayscale image to 9x8 pixels and set one bit per pair of horizontally
+// adjacent pixels, 1 if the left pixel is darker than the right one.
+// context - Scratch buffers
+// img - Input image, left unchanged
+// hash - 64-bit perceptual hash of the input image
+int extractPerceptualHash(FeatureContext &context, cv::Mat &img, uint64_t &hash){
+    cv::Mat gray = scratchImage(context.gray, img.rows, img.cols, CV_8UC1);
+    cv::Mat &small = context.small;
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    cv::resize(gray, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+    
+    hash = 0;
+    for(int i=0; i<8; i++){
+        uchar *sptr = small.ptr<uchar>(i);
+        for(int j=0; j<8; j++){
+            hash = (hash << 1) | (sptr[j] < sptr[j+1] ? 1 : 0);
+        }
+    }
+    return 0;
+}
+
+int extractPerceptualHash(cv::Mat &img, uint64_t &hash){
+    return extractPerceptualHash(threadContext(), img, hash);
+}
+
+// Given an input image, detect up to maxKeypoints ORB keypoints in its grayscale version
+// and compute their 256-bit binary descriptors
+// context - ORB detector and scratch buffers
+// img - Input image, left unchanged
+// maxKeypoints - maximum number of keypoints
+// keypoints - keypoints found
+// descriptors - one 32-byte CV_8U row per keypoint
+int extractOrbFeatures(FeatureContext &context, cv::Mat &img, int maxKeypoints,
+                       std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors){
+    cv::Mat gray = scratchImage(context.gray, img.rows, img.cols, CV_8UC1);
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    if (context.orb.empty() || context.orbMaxKeypoints != maxKeypoints){
+        context.orb = cv::ORB::create(maxKeypoints);
+        context.orbMaxKeypoints = maxKeypoints;
+    }
+    context.orb->detectAndCompute(gray, cv::noArray(), keypoints, descriptors);
+    return 0;
+}
+
+int extractOrbFeatures(cv::Mat &img, int maxKeypoints, std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors){
+    return extractOrbFeatures(threadContext(), img, maxKeypoints, keypoints, descriptors);
 }
@@ -9,8 +9,33 @@
 #ifndef feature_hpp
 #define feature_hpp
 
+#include <cstdint>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
+// Kernels and scratch buffers of the feature extractors, kept from one image to the next.
+// The kernels are built once, and the buffers only grow, so once a context has seen an image,
+// extracting the features of an image of that size or smaller takes no heap allocation
+// (outside the internal buffers of the OpenCV filters and of ORB).
+// Each thread extracting features needs its own context. The functions without a context
+// argument use a context of the calling thread, and append to a std::vector.
+struct FeatureContext {
+    FeatureContext();
+    
+    cv::Mat lawsFilters[5];  // Laws 1D filters L5, E5, S5, W5, R5
+    cv::Mat gaborKernel;     // 20x20 Gabor kernel
+    cv::Ptr<cv::ORB> orb;    // ORB detector, created on first use
+    int orbMaxKeypoints;     // maximum number of keypoints of orb
+    
+    std::vector<uchar> gray;      // grayscale image or band of rows
+    std::vector<uchar> filtered;  // 8-bit output of one Laws filter
+    std::vector<uchar> sum;       // 32-bit float sum of the Laws filters
+    std::vector<uchar> response;  // 8-bit filter response, with two rows of zeros after it
+    std::vector<cv::Vec3s> rowX, rowY, sobelX, sobelY; // Sobel row passes and one row of the Sobel images
+    std::vector<cv::Vec3b> magnitude; // one row of the Sobel magnitude
+    cv::Mat small;                // 9x8 image of the perceptual hash
+};
+
 // Extract the widthxheight pixels from the middle of input image
 // and write those pixel values into outputVector
 // For each pixel, write the values in the order of B, G and R
@@ -19,6 +44,8 @@
 // height - height
 // outputVector - vector containing features of the input image
 int extractMiddleVector(cv::Mat &img, int width, int height, std::vector<float> &outputVector);
+// Same as above, writing the width*height*3 floats into output
+int extractMiddleVector(cv::Mat &img, int width, int height, float *output);
 
 // Given an input image, and number of histogram bins,
 // create a 3D histogram with `bins` bins, and project each pixel from the input image to the histogram.
@@ -28,13 +55,34 @@ int extractMiddleVector(cv::Mat &img, int width, int height, std::vector<float>
 // bins - number of histogram bins
 // outputVector - vector containing features of the input image
 int extract3DHistVector(cv::Mat &img, int bins, std::vector<float> &outputVector);
+// Same as above, writing the bins^3 floats into output
+int extract3DHistVector(cv::Mat &img, int bins, float *output);
+
+// Generic version of extract3DHistVector for any number of bins.
+// extract3DHistVector uses kernels specialized on the bin count for 4, 8, 16 and 32 bins.
+// img - Input image
+// bins - number of histogram bins
+// outputVector - vector containing features of the input image
+int extract3DHistVectorGeneric(cv::Mat &img, int bins, std::vector<float> &outputVector);
+int extract3DHistVectorGeneric(cv::Mat &img, int bins, float *output);
 
 // Given an input image, convert it into Grayscale, compute the Sobel Magnitude,
 // and use it to as the input image. to the extract3DHistVector function
-// img - Input image
+// The image is streamed through the whole pipeline in bands of rows that fit in the L2 cache,
+// so no full-size intermediate image is allocated.
+// img - Input image, left unchanged
 // bins - number of histogram bins
 // outputVector - vector containing features of the input image
 int extractSobelTextureVector(cv::Mat &img, int bins, std::vector<float> &outputVector);
+// Same as above, with the scratch buffers of context, writing the bins^3 floats into output
+int extractSobelTextureVector(FeatureContext &context, cv::Mat &img, int bins, float *output);
+
+// Whole-image version of extractSobelTextureVector, with full-size grayscale, Sobel and magnitude images.
+// extractSobelTextureVector produces exactly the same output.
+// img - Input image, left unchanged
+// bins - number of histogram bins
+// outputVector - vector containing features of the input image
+int extractSobelTextureVectorFullImage(cv::Mat &img, int bins, std::vector<float> &outputVector);
 
 // Given an input image, number of histogram bins, and softWidth (width to spread out a pixel value)
 // create a 3D soft histogram with `bins` bins, and project and spread each pixel into width of `softWidth`
@@ -45,19 +93,75 @@ int extractSobelTextureVector(cv::Mat &img, int bins, std::vector<float> &output
 // bins - number of histogram bins
 // outputVector - vector containing features of the input image
 int extract3DSoftHistVector(cv::Mat &img, int bins, int softWidth, std::vector<float> &outputVector);
+// Same as above, writing the bins^3 floats into output
+int extract3DSoftHistVector(cv::Mat &img, int bins, int softWidth, float *output);
+
+// Generic version of extract3DSoftHistVector for any number of bins.
+// extract3DSoftHistVector uses kernels specialized on the bin count for 4, 8, 16 and 32 bins.
+// img - Input image
+// bins - number of histogram bins
+// softWidth - width to spread out a pixel value
+// outputVector - vector containing features of the input image
+int extract3DSoftHistVectorGeneric(cv::Mat &img, int bins, int softWidth, std::vector<float> &outputVector);
+int extract3DSoftHistVectorGeneric(cv::Mat &img, int bins, int softWidth, float *output);
 
 // Given an input image, convert it into Grayscale, compute and average the 14 Law's Filters output,
 // and use it to as the input image. to the extract3DHistVector function
-// img - Input image
+// img - Input image, left unchanged
 // bins - number of histogram bins
 // outputVector - vector containing features of the input image
 int extractLawsTextureVector(cv::Mat &img, int bins, std::vector<float> &outputVector);
+// Same as above, with the filters and scratch buffers of context, writing the bins^3 floats into output
+int extractLawsTextureVector(FeatureContext &context, cv::Mat &img, int bins, float *output);
 
 // Given an input image, convert it into Grayscale, apply the Gabor's Filters,
 // and use it to as the input image. to the extract3DHistVector function
-// img - Input image
+// img - Input image, left unchanged
 // bins - number of histogram bins
 // outputVector - vector containing features of the input image
-int extractGaborTextureVector(cv::Mat &src, int bins, std::vector<float> &outputVector);
+int extractGaborTextureVector(cv::Mat &img, int bins, std::vector<float> &outputVector);
+// Same as above, with the kernel and scratch buffers of context, writing the bins^3 floats into output
+int extractGaborTextureVector(FeatureContext &context, cv::Mat &img, int bins, float *output);
+
+// Color spaces of extractColorHistVector
+enum {
+    COLOR_SPACE_HSV = 1,      // hue, saturation, value
+    COLOR_SPACE_LAB = 2,      // CIELab
+    COLOR_SPACE_OPPONENT = 3  // opponent colors (R-G, R+G-2B, R+G+B)
+};
+
+// Given an input image, a color space and number of histogram bins,
+// create a 3D histogram of the pixel colors in that color space with `bins` bins per channel.
+// The 3D histogram is normalized.
+// The color space conversion and bin assignment are one lookup in a table indexed by the
+// pixel's BGR value quantized to 5 bits per channel, so no per-pixel conversion is done.
+// img - Input image, 3-channel 8-bit BGR
+// colorSpace - COLOR_SPACE_HSV, COLOR_SPACE_LAB or COLOR_SPACE_OPPONENT
+// bins - number of histogram bins, at most 32
+// outputVector - vector containing features of the input image
+int extractColorHistVector(cv::Mat &img, int colorSpace, int bins, std::vector<float> &outputVector);
+// Same as above, writing the bins^3 floats into output
+int extractColorHistVector(cv::Mat &img, int colorSpace, int bins, float *output);
+
+// Given an input image, compute its 64-bit difference hash (dHash):
+// shrink the grayscale image to 9x8 pixels and set one bit per pair of horizontally
+// adjacent pixels, 1 if the left pixel is darker than the right one.
+// Similar images have hashes with a small Hamming distance.
+// img - Input image, left unchanged
+// hash - 64-bit perceptual hash of the input image
+int extractPerceptualHash(cv::Mat &img, uint64_t &hash);
+// Same as above, with the scratch buffers of context
+int extractPerceptualHash(FeatureContext &context, cv::Mat &img, uint64_t &hash);
+
+// Given an input image, detect up to maxKeypoints ORB keypoints in its grayscale version
+// and compute their 256-bit binary descriptors
+// img - Input image, left unchanged
+// maxKeypoints - maximum number of keypoints
+// keypoints - keypoints found
+// descriptors - one 32-byte CV_8U row per keypoint
+int extractOrbFeatures(cv::Mat &img, int maxKeypoints, std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors);
+// Same as above, with the ORB detector and scratch buffers of context
+int extractOrbFeatures(FeatureContext &context, cv::Mat &img, int maxKeypoints,
+                       std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors);
 
 #endif /* feature_hpp */
@@ -0,0 +1,176 @@
+//
+//  feature_cache.cpp
+//  Project2
+//
+//  Persistent cache of feature vectors extracted on demand, keyed by image path.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include "feature_cache.hpp"
+
+static const char CACHE_MAGIC[8] = "FCACHE1";
+
+// Append a record to a buffer: the length-prefixed key, the file stamp and the features
+// buffer - Records to write
+// key - Image key
+// mtime - Modification time of the image file
+// fileSize - Size of the image file
+// x - Features, n floats
+static void appendRecord(std::vector<char> &buffer, const std::string &key, int64_t mtime, int64_t fileSize,
+                         const float *x, int n){
+    int len = (int)key.size();
+    size_t at = buffer.size();
+    buffer.resize(at + sizeof(int) + key.size() + 2*sizeof(int64_t) + n*sizeof(float));
+    char *p = &buffer[at];
+    memcpy(p, &len, sizeof(int));
+    p += sizeof(int);
+    memcpy(p, key.data(), key.size());
+    p += key.size();
+    memcpy(p, &mtime, sizeof(int64_t));
+    p += sizeof(int64_t);
+    memcpy(p, &fileSize, sizeof(int64_t));
+    p += sizeof(int64_t);
+    memcpy(p, x, n*sizeof(float));
+}
+
+// Read a length-prefixed string. Returns false at the end of the file or on a bad length
+static bool readString(FILE *fp, std::string &s){
+    int len;
+    if (fread(&len, sizeof(int), 1, fp) != 1 || len < 0 || len > (1 << 20)) return false;
+    s.resize(len);
+    return fread(&s[0], 1, len, fp) == (size_t)len;
+}
+
+FeatureCache::FeatureCache() : numFloats(0) {
+}
+
+int FeatureCache::open(const char *filename, const std::vector<int> &dims){
+    this->filename = filename;
+    this->dims = dims;
+    numFloats = 0;
+    for (int d : dims) numFloats += d;
+    entries.clear();
+    rows.clear();
+    pending.clear();
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return rewrite();
+    char magic[sizeof(CACHE_MAGIC)];
+    int numDims = 0;
+    bool valid = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0 &&
+                 fread(&numDims, sizeof(int), 1, fp) == 1 && numDims == (int)dims.size();
+    std::vector<int> fileDims(valid ? numDims : 0);
+    valid = valid && fread(fileDims.data(), sizeof(int), numDims, fp) == (size_t)numDims && fileDims == dims;
+
+    // Later records of a key replace the earlier ones, written before its image file changed
+    long goodBytes = ftell(fp);
+    int numRecords = 0;
+    std::string key;
+    Entry entry;
+    std::vector<float> x(numFloats);
+    while (valid && readString(fp, key) &&
+           fread(&entry.mtime, sizeof(int64_t), 1, fp) == 1 &&
+           fread(&entry.fileSize, sizeof(int64_t), 1, fp) == 1 &&
+           fread(x.data(), sizeof(float), numFloats, fp) == (size_t)numFloats){
+        auto it = entries.find(key);
+        entry.row = it != entries.end() ? it->second.row : (int)entries.size();
+        if (it == entries.end()) rows.resize(rows.size() + numFloats);
+        std::copy(x.begin(), x.end(), rows.begin() + (size_t)entry.row*numFloats);
+        entries[key] = entry;
+        numRecords++;
+        goodBytes = ftell(fp);
+    }
+    fclose(fp);
+
+    // Start afresh a file of other features, and compact a file mostly made of replaced records
+    if (!valid || numRecords > 2*(int)entries.size() + 64) return rewrite();
+    // Cut off a damaged end, so new records follow the last good one
+    if (truncate(filename, goodBytes) != 0){
+        printf("Unable to truncate feature cache %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+int FeatureCache::find(const std::string &key, int64_t mtime, int64_t fileSize) const {
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second.mtime != mtime || it->second.fileSize != fileSize) return -1;
+    return it->second.row;
+}
+
+int FeatureCache::insert(const std::string &key, int64_t mtime, int64_t fileSize,
+                         const std::vector<std::vector<float>> &vectors){
+    if (vectors.size() != dims.size()) return -1;
+    for (int i = 0; i < (int)dims.size(); i++){
+        if ((int)vectors[i].size() != dims[i]) return -1;
+    }
+    auto it = entries.find(key);
+    int r = it != entries.end() ? it->second.row : (int)entries.size();
+    if (it == entries.end()) rows.resize(rows.size() + numFloats);
+    float *x = &rows[(size_t)r*numFloats];
+    for (const std::vector<float> &v : vectors) x = std::copy(v.begin(), v.end(), x);
+    entries[key] = Entry{mtime, fileSize, r};
+    pending.push_back(key);
+    return r;
+}
+
+int FeatureCache::flush(){
+    if (pending.empty()) return 0;
+    std::vector<char> buffer;
+    for (const std::string &key : pending){
+        const Entry &entry = entries[key];
+        appendRecord(buffer, key, entry.mtime, entry.fileSize, row(entry.row), numFloats);
+    }
+    pending.clear();
+
+    // One unbuffered write, so the records of processes sharing the file do not interleave
+    FILE *fp = fopen(filename.c_str(), "ab");
+    if (!fp){
+        printf("Unable to open feature cache %s\n", filename.c_str());
+        return -1;
+    }
+    setvbuf(fp, NULL, _IONBF, 0);
+    fwrite(buffer.data(), 1, buffer.size(), fp);
+    int err = ferror(fp);
+    fclose(fp);
+    if (err){
+        printf("Unable to write feature cache %s\n", filename.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int FeatureCache::rewrite(){
+    std::string staged = filename + ".tmp";
+    FILE *fp = fopen(staged.c_str(), "wb");
+    if (!fp){
+        printf("Unable to open feature cache %s\n", staged.c_str());
+        return -1;
+    }
+    int numDims = (int)dims.size();
+    fwrite(CACHE_MAGIC, 1, sizeof(CACHE_MAGIC), fp);
+    fwrite(&numDims, sizeof(int), 1, fp);
+    fwrite(dims.data(), sizeof(int), dims.size(), fp);
+
+    // Records in row order
+    std::vector<const std::pair<const std::string, Entry> *> byRow(entries.size());
+    for (const std::pair<const std::string, Entry> &e : entries) byRow[e.second.row] = &e;
+    std::vector<char> buffer;
+    for (const std::pair<const std::string, Entry> *e : byRow){
+        buffer.clear();
+        appendRecord(buffer, e->first, e->second.mtime, e->second.fileSize, row(e->second.row), numFloats);
+        fwrite(buffer.data(), 1, buffer.size(), fp);
+    }
+    pending.clear();
+
+    int err = ferror(fp);
+    fclose(fp);
+    if (err || rename(staged.c_str(), filename.c_str()) != 0){
+        printf("Unable to write feature cache %s\n", filename.c_str());
+        return -1;
+    }
+    return 0;
+}
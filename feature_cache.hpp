@@ -0,0 +1,79 @@
+//
+//  feature_cache.hpp
+//  Project2
+//
+//  Persistent cache of feature vectors extracted on demand, keyed by image path.
+//  Every entry carries the modification time and size of its image file, and is
+//  ignored once the file changes. New entries are appended to the cache file,
+//  so features extracted for one query are kept for the later ones.
+//
+
+#ifndef feature_cache_hpp
+#define feature_cache_hpp
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class FeatureCache {
+public:
+    FeatureCache();
+
+    // Open a cache file of images with one vector of each of dims, and read its entries.
+    // A missing file, or a file of other dims, is started afresh; a damaged end is cut off.
+    // filename - Cache file
+    // dims - dims of the vectors of an image
+    // Returns non-zero if the file cannot be written
+    int open(const char *filename, const std::vector<int> &dims);
+
+    // True once open has been called
+    bool isOpen() const { return !filename.empty(); }
+
+    // Row of the features of an image, or -1 if they are not cached or the file has changed since
+    // key - Image key
+    // mtime - Modification time of the image file, in nanoseconds
+    // fileSize - Size of the image file
+    int find(const std::string &key, int64_t mtime, int64_t fileSize) const;
+
+    // Features of a row: the vectors of its image one after the other, rowFloats() floats in all
+    const float *row(int r) const { return &rows[(size_t)r*numFloats]; }
+
+    // Add the features of an image, replacing those of an older version of its file.
+    // They are appended to the cache file by the next flush.
+    // key - Image key
+    // mtime - Modification time of the image file, in nanoseconds
+    // fileSize - Size of the image file
+    // vectors - One vector of each of the dims of the cache
+    // Returns the row of the features
+    int insert(const std::string &key, int64_t mtime, int64_t fileSize, const std::vector<std::vector<float>> &vectors);
+
+    // Append the features added since the last flush to the cache file. Returns non-zero on error
+    int flush();
+
+    // Number of images cached
+    int size() const { return (int)entries.size(); }
+    // Floats per row
+    int rowFloats() const { return numFloats; }
+    // dims of the vectors of an image
+    const std::vector<int> &vectorDims() const { return dims; }
+
+private:
+    struct Entry {
+        int64_t mtime;
+        int64_t fileSize;
+        int row;
+    };
+
+    // Rewrite the cache file with the header and every entry, under a temporary name renamed into place
+    int rewrite();
+
+    std::string filename;
+    std::vector<int> dims;
+    int numFloats;
+    std::unordered_map<std::string, Entry> entries;
+    std::vector<float> rows;
+    std::vector<std::string> pending; // keys added since the last flush
+};
+
+#endif /* feature_cache_hpp */
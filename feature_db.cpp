@@ -0,0 +1,174 @@
+//
+//  feature_db.cpp
+//  Project2
+//
+//  In-memory feature database. All feature vectors live in one aligned
+//  arena with a fixed, SIMD padded row stride, and all image paths live
+//  in a single string pool referenced by offsets.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <sys/stat.h>
+#include "feature_db.hpp"
+#include "csv_util.hpp"
+#include "crawler.hpp"
+
+// Stamp of a file
+// filename - Feature file
+// stamp - Set to the size and modification time of the file
+int featureFileStamp(const char *filename, FeatureFileStamp &stamp){
+    struct stat st;
+    if (stat(filename, &st) != 0) return -1;
+    stamp.fileSize = st.st_size;
+    stamp.mtime = modificationTime(st);
+    return 0;
+}
+
+// Sum of squares of n floats
+static float squaredNorm(const float *x, int n){
+    float result = 0.0f;
+    for (int d = 0; d < n; d++) result += x[d]*x[d];
+    return result;
+}
+
+FeatureDatabase::FeatureDatabase()
+    : arena(NULL), numRows(0), capacity(0), numDims(0), rowStride(0) {
+}
+
+FeatureDatabase::~FeatureDatabase(){
+    free(arena);
+}
+
+FeatureDatabase::FeatureDatabase(FeatureDatabase &&other)
+    : arena(other.arena), numRows(other.numRows), capacity(other.capacity),
+      numDims(other.numDims), rowStride(other.rowStride),
+      pathPool(std::move(other.pathPool)), pathOffsets(std::move(other.pathOffsets)),
+      rowNorms(std::move(other.rowNorms)), stamp(other.stamp) {
+    other.arena = NULL;
+    other.numRows = other.capacity = 0;
+}
+
+FeatureDatabase &FeatureDatabase::operator=(FeatureDatabase &&other){
+    if (this != &other) {
+        free(arena);
+        arena = other.arena;
+        numRows = other.numRows;
+        capacity = other.capacity;
+        numDims = other.numDims;
+        rowStride = other.rowStride;
+        pathPool = std::move(other.pathPool);
+        pathOffsets = std::move(other.pathOffsets);
+        rowNorms = std::move(other.rowNorms);
+        stamp = other.stamp;
+        other.arena = NULL;
+        other.numRows = other.capacity = 0;
+    }
+    return *this;
+}
+
+// Remove all rows and set the number of features per row
+// dims - number of features per row
+void FeatureDatabase::reset(int dims){
+    free(arena);
+    arena = NULL;
+    numRows = 0;
+    capacity = 0;
+    numDims = dims;
+    int floatsPerLine = ALIGNMENT / sizeof(float);
+    rowStride = (dims + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+    pathPool.clear();
+    pathOffsets.clear();
+    rowNorms.clear();
+    stamp = FeatureFileStamp();
+}
+
+// Reserve space for rows without reallocating the arena
+// rows - total number of rows to reserve
+void FeatureDatabase::reserve(int rows){
+    if (rows <= capacity) return;
+    size_t bytes = std::max((size_t)rows * rowStride * sizeof(float), (size_t)ALIGNMENT);
+    void *mem = NULL;
+    if (posix_memalign(&mem, ALIGNMENT, bytes) != 0) {
+        printf("Unable to allocate feature database of %d rows\n", rows);
+        exit(-1);
+    }
+    if (arena) memcpy(mem, arena, (size_t)numRows * rowStride * sizeof(float));
+    free(arena);
+    arena = (float *)mem;
+    capacity = rows;
+}
+
+// Append one row and return its index
+// path - image path of the row
+// features - dims() floats
+int FeatureDatabase::addRow(const char *path, const float *features){
+    if (numRows == capacity) reserve(capacity < 16 ? 16 : capacity * 2);
+    float *dst = arena + (size_t)numRows*rowStride;
+    memcpy(dst, features, numDims * sizeof(float));
+    memset(dst + numDims, 0, (rowStride - numDims) * sizeof(float));
+    rowNorms.push_back(squaredNorm(dst, numDims));
+
+    pathOffsets.push_back(pathPool.size());
+    pathPool.insert(pathPool.end(), path, path + strlen(path) + 1);
+    return numRows++;
+}
+
+// Replace every feature of every row by its square root. Negative features become zero.
+void FeatureDatabase::sqrtRows(){
+    for (int i = 0; i < numRows; i++){
+        float *r = arena + (size_t)i*rowStride;
+        for (int d = 0; d < numDims; d++) r[d] = std::sqrt(std::max(r[d], 0.0f));
+        rowNorms[i] = squaredNorm(r, numDims);
+    }
+}
+
+// Load all rows of a feature CSV file, replacing the current contents.
+// The parser writes the features straight into the arena.
+// csvFilename - feature file written by append_image_data_csv
+// numThreads - number of parser threads, 0 uses one per core
+// rowOffsets - if not NULL, set to the byte offset in the file of the line of every row
+int FeatureDatabase::load(char *csvFilename, int numThreads, std::vector<size_t> *rowOffsets){
+    // Stamped before reading, so a file rewritten meanwhile leaves a stale stamp rather than a stale index
+    FeatureFileStamp loadStamp;
+    if (featureFileStamp(csvFilename, loadStamp) != 0) {
+        printf("Unable to open feature file %s\n", csvFilename);
+        return -1;
+    }
+    CsvChunk names;
+    int dims;
+    CsvRowAllocator allocate = [this](int features, size_t maxRows, size_t &stride){
+        reset(features);
+        reserve((int)maxRows);
+        stride = rowStride;
+        return arena;
+    };
+    long rows = read_image_data_csv_into(csvFilename, dims, allocate, names, numThreads);
+    if (rows < 0) return -1;
+
+    numRows = (int)rows;
+    stamp = loadStamp;
+    // One terminated copy of each packed name
+    pathPool.resize(names.names.size() + rows);
+    pathOffsets.resize(rows);
+    rowNorms.resize(rows);
+    size_t start = 0;
+    for (long i = 0; i < rows; i++) {
+        size_t length = names.nameEnds[i] - start;
+        memcpy(&pathPool[start + i], &names.names[start], length);
+        pathPool[start + i + length] = '\0';
+        pathOffsets[i] = start + i;
+        start = names.nameEnds[i];
+    }
+    for (int i = 0; i < numRows; i++) {
+        float *r = arena + (size_t)i*rowStride;
+        memset(r + numDims, 0, (rowStride - numDims) * sizeof(float));
+        rowNorms[i] = squaredNorm(r, numDims);
+    }
+    if (rowOffsets) rowOffsets->swap(names.rowOffsets);
+    return 0;
+}
@@ -0,0 +1,100 @@
+//
+//  feature_db.hpp
+//  Project2
+//
+//  In-memory feature database. All feature vectors live in one aligned
+//  arena with a fixed, SIMD padded row stride, and all image paths live
+//  in a single string pool referenced by offsets. The squared norm of every
+//  row is stored with it for distance computations by dot products.
+//
+
+#ifndef feature_db_hpp
+#define feature_db_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Size and modification time of a feature file. The indexes saved next to a feature file
+// record the stamp of the file they were built from, and are rebuilt once it changes.
+struct FeatureFileStamp {
+    int64_t fileSize = 0;
+    int64_t mtime = 0; // in nanoseconds
+
+    bool operator==(const FeatureFileStamp &other) const { return fileSize == other.fileSize && mtime == other.mtime; }
+    bool operator!=(const FeatureFileStamp &other) const { return !(*this == other); }
+};
+
+// Stamp of a file
+// filename - Feature file
+// stamp - Set to the size and modification time of the file
+// Returns non-zero if the file cannot be found
+int featureFileStamp(const char *filename, FeatureFileStamp &stamp);
+
+class FeatureDatabase {
+public:
+    // Alignment of the arena and of every row, in bytes
+    static const int ALIGNMENT = 64;
+
+    FeatureDatabase();
+    ~FeatureDatabase();
+    FeatureDatabase(FeatureDatabase &&other);
+    FeatureDatabase &operator=(FeatureDatabase &&other);
+    FeatureDatabase(const FeatureDatabase &) = delete;
+    FeatureDatabase &operator=(const FeatureDatabase &) = delete;
+
+    // Load all rows of a feature CSV file, replacing the current contents
+    // csvFilename - feature file written by append_image_data_csv
+    // numThreads - number of parser threads, 0 uses one per core
+    // rowOffsets - if not NULL, set to the byte offset in the file of the line of every row
+    // Returns non-zero if the file cannot be read
+    int load(char *csvFilename, int numThreads = 0, std::vector<size_t> *rowOffsets = NULL);
+
+    // Stamp of the feature file, taken before load read it; zero for rows added by addRow
+    const FeatureFileStamp &fileStamp() const { return stamp; }
+
+    // Remove all rows and set the number of features per row
+    // dims - number of features per row
+    void reset(int dims);
+
+    // Reserve space for rows without reallocating the arena
+    // rows - total number of rows to reserve
+    void reserve(int rows);
+
+    // Append one row and return its index
+    // path - image path of the row
+    // features - dims() floats
+    int addRow(const char *path, const float *features);
+
+    // Replace every feature of every row by its square root, for metrics
+    // that compare square-rooted histograms. The padding stays zero.
+    void sqrtRows();
+
+    // Number of rows
+    int size() const { return numRows; }
+    // Number of features per row
+    int dims() const { return numDims; }
+    // Distance in floats between consecutive rows, a multiple of ALIGNMENT
+    // The padding after dims() is always zero.
+    int stride() const { return rowStride; }
+
+    // Features of row i, aligned to ALIGNMENT bytes
+    const float *row(int i) const { return arena + (size_t)i*rowStride; }
+    // Image path of row i
+    const char *path(int i) const { return &pathPool[pathOffsets[i]]; }
+    // Squared L2 norm of row i, kept up to date with the row
+    float norm(int i) const { return rowNorms[i]; }
+
+private:
+    float *arena;
+    int numRows;
+    int capacity;
+    int numDims;
+    int rowStride;
+    std::vector<char> pathPool;
+    std::vector<size_t> pathOffsets;
+    std::vector<float> rowNorms;
+    FeatureFileStamp stamp;
+};
+
+#endif /* feature_db_hpp */
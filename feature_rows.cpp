@@ -0,0 +1,165 @@
+//
+//  feature_rows.cpp
+//  Project2
+//
+//  Row table of a feature file: the image path and the byte offset of the line of every row,
+//  saved next to the file as <feature file>.rows.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "feature_rows.hpp"
+#include "csv_util.hpp"
+#include "crawler.hpp"
+
+static const char ROWS_MAGIC[8] = "FROWS01";
+
+FeatureRows::FeatureRows() : fd(-1), numDims(0) {
+}
+
+FeatureRows::~FeatureRows(){
+    close();
+}
+
+FeatureRows::FeatureRows(FeatureRows &&other)
+    : fd(other.fd), filename(std::move(other.filename)), stamp(other.stamp), tableStamp(other.tableStamp),
+      numDims(other.numDims), offsets(std::move(other.offsets)), pathPool(std::move(other.pathPool)),
+      pathOffsets(std::move(other.pathOffsets)) {
+    other.fd = -1;
+}
+
+FeatureRows &FeatureRows::operator=(FeatureRows &&other){
+    if (this != &other) {
+        close();
+        fd = other.fd;
+        filename = std::move(other.filename);
+        stamp = other.stamp;
+        tableStamp = other.tableStamp;
+        numDims = other.numDims;
+        offsets = std::move(other.offsets);
+        pathPool = std::move(other.pathPool);
+        pathOffsets = std::move(other.pathOffsets);
+        other.fd = -1;
+    }
+    return *this;
+}
+
+// Discard the row table and close the feature file
+void FeatureRows::close(){
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    stamp = tableStamp = FeatureFileStamp();
+    numDims = 0;
+    offsets.clear();
+    pathPool.clear();
+    pathOffsets.clear();
+}
+
+// Open a feature file for reading rows, and read its row table from <csvFilename>.rows
+// csvFilename - Feature file
+int FeatureRows::open(const char *csvFilename){
+    close();
+    filename = csvFilename;
+    fd = ::open(csvFilename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Unable to open feature file %s\n", csvFilename);
+        close();
+        return -1;
+    }
+    stamp.fileSize = st.st_size;
+    stamp.mtime = modificationTime(st);
+
+    std::string tableFile = filename + ".rows";
+    FILE *fp = fopen(tableFile.c_str(), "rb");
+    if (!fp) return 0;
+    char magic[sizeof(ROWS_MAGIC)];
+    int header[2];
+    int64_t poolBytes = 0;
+    bool ok = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, ROWS_MAGIC, sizeof(magic)) == 0 &&
+              fread(header, sizeof(int), 2, fp) == 2 && header[0] > 0 && header[1] >= 0 &&
+              fread(&tableStamp.fileSize, sizeof(int64_t), 1, fp) == 1 &&
+              fread(&tableStamp.mtime, sizeof(int64_t), 1, fp) == 1;
+    if (ok) {
+        numDims = header[0];
+        offsets.resize(header[1]);
+        ok = fread(offsets.data(), sizeof(int64_t), offsets.size(), fp) == offsets.size() &&
+             fread(&poolBytes, sizeof(int64_t), 1, fp) == 1 && poolBytes >= 0 && poolBytes <= stamp.fileSize;
+    }
+    if (ok) {
+        pathPool.resize(poolBytes);
+        ok = fread(pathPool.data(), 1, pathPool.size(), fp) == pathPool.size();
+    }
+    fclose(fp);
+
+    // The paths are packed one after the other, each terminated
+    for (size_t p = 0; ok && p < pathPool.size(); p += strlen(&pathPool[p]) + 1) {
+        pathOffsets.push_back(p);
+        ok = memchr(&pathPool[p], '\0', pathPool.size() - p) != NULL;
+    }
+    if (!ok || pathOffsets.size() != offsets.size()) {
+        printf("Invalid row table %s\n", tableFile.c_str());
+        tableStamp = FeatureFileStamp();
+        numDims = 0;
+        offsets.clear();
+        pathPool.clear();
+        pathOffsets.clear();
+    }
+    return 0;
+}
+
+// Set the row table from the rows of a database loaded from the open feature file, and save it
+// db - Feature database loaded from the file
+// rowOffsets - Byte offset of the line of every row of db
+int FeatureRows::build(const FeatureDatabase &db, const std::vector<size_t> &rowOffsets){
+    if (fd < 0 || db.fileStamp() != stamp || (int)rowOffsets.size() != db.size()) return -1;
+    tableStamp = stamp;
+    numDims = db.dims();
+    offsets.assign(rowOffsets.begin(), rowOffsets.end());
+    pathPool.clear();
+    pathOffsets.clear();
+    for (int i = 0; i < db.size(); i++) {
+        pathOffsets.push_back(pathPool.size());
+        pathPool.insert(pathPool.end(), db.path(i), db.path(i) + strlen(db.path(i)) + 1);
+    }
+
+    // Written under a temporary name and renamed into place, for processes opening the table meanwhile
+    std::string tableFile = filename + ".rows";
+    std::string staged = tableFile + ".tmp";
+    FILE *fp = fopen(staged.c_str(), "wb");
+    if (!fp) {
+        printf("Unable to open row table %s\n", staged.c_str());
+        return -1;
+    }
+    int header[2] = {numDims, (int)offsets.size()};
+    int64_t poolBytes = pathPool.size();
+    fwrite(ROWS_MAGIC, 1, sizeof(ROWS_MAGIC), fp);
+    fwrite(header, sizeof(int), 2, fp);
+    fwrite(&tableStamp.fileSize, sizeof(int64_t), 1, fp);
+    fwrite(&tableStamp.mtime, sizeof(int64_t), 1, fp);
+    fwrite(offsets.data(), sizeof(int64_t), offsets.size(), fp);
+    fwrite(&poolBytes, sizeof(int64_t), 1, fp);
+    fwrite(pathPool.data(), 1, pathPool.size(), fp);
+    int err = ferror(fp);
+    fclose(fp);
+    if (err || rename(staged.c_str(), tableFile.c_str()) != 0) {
+        printf("Unable to write row table %s\n", tableFile.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// Read the features of a row from the feature file
+// i - Row index
+// x - dims() floats
+int FeatureRows::read(int i, float *x) const {
+    std::string name;
+    if (read_image_data_csv_row(fd, (off_t)offsets[i], numDims, name, x) != 0 || name != path(i)) {
+        printf("Unable to read row %d of feature file %s\n", i, filename.c_str());
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+//
+//  feature_rows.hpp
+//  Project2
+//
+//  Row table of a feature file: the image path and the byte offset of the line of every row,
+//  saved next to the file as <feature file>.rows. Single rows are read from the file on demand,
+//  so a search that only needs a shortlist of rows does not load the feature vectors.
+//
+
+#ifndef feature_rows_hpp
+#define feature_rows_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "feature_db.hpp"
+
+class FeatureRows {
+public:
+    FeatureRows();
+    ~FeatureRows();
+    FeatureRows(FeatureRows &&other);
+    FeatureRows &operator=(FeatureRows &&other);
+    FeatureRows(const FeatureRows &) = delete;
+    FeatureRows &operator=(const FeatureRows &) = delete;
+
+    // Open a feature file for reading rows, and read its row table from <csvFilename>.rows.
+    // The file stays open, so rows keep being read from this version of it if it is replaced.
+    // csvFilename - Feature file
+    // Returns non-zero if the feature file cannot be opened. A missing or stale table leaves isCurrent() false.
+    int open(const char *csvFilename);
+
+    // True if the row table was saved for the version of the feature file that is open
+    bool isCurrent() const { return fd >= 0 && tableStamp == stamp && numDims > 0; }
+
+    // Set the row table from the rows of a database loaded from the open feature file, and save it
+    // db - Feature database loaded from the file
+    // rowOffsets - Byte offset of the line of every row of db, as returned by FeatureDatabase::load
+    // Returns non-zero if db was loaded from another version of the file, or the table cannot be written
+    int build(const FeatureDatabase &db, const std::vector<size_t> &rowOffsets);
+
+    // Read the features of a row from the feature file. Safe to call from several threads.
+    // i - Row index
+    // x - dims() floats
+    // Returns non-zero if the row cannot be read
+    int read(int i, float *x) const;
+
+    // Stamp of the open feature file
+    const FeatureFileStamp &fileStamp() const { return stamp; }
+    // Number of rows
+    int size() const { return (int)offsets.size(); }
+    // Number of features per row
+    int dims() const { return numDims; }
+    // Image path of row i
+    const char *path(int i) const { return &pathPool[pathOffsets[i]]; }
+
+private:
+    // Discard the row table and close the feature file
+    void close();
+
+    int fd;
+    std::string filename;
+    FeatureFileStamp stamp;       // stamp of the open feature file
+    FeatureFileStamp tableStamp;  // stamp of the file the table was saved for
+    int numDims;
+    std::vector<int64_t> offsets; // byte offset of the line of every row
+    std::vector<char> pathPool;
+    std::vector<size_t> pathOffsets;
+};
+
+#endif /* feature_rows_hpp */
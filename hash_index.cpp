@@ -0,0 +1,155 @@
+//
+//  hash_index.cpp
+//  Project2
+//
+//  Database of 64-bit perceptual hashes, one per image, matched by Hamming
+//  distance (XOR plus popcount), with a multi-index hash table for radius queries.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include "hash_index.hpp"
+#include "csv_util.hpp"
+
+// Largest per-block radius searched through the multi-index,
+// beyond it enumerating nearby block values costs more than a linear scan
+static const int MAX_BLOCK_RADIUS = 2;
+
+// Value of 16-bit block b of a hash
+static inline int blockValue(uint64_t hash, int b){
+    return (int)((hash >> (16*b)) & 0xFFFF);
+}
+
+// Masks of the block values within Hamming distance blockRadius of a block value, for every
+// blockRadius up to MAX_BLOCK_RADIUS: the 16-bit values with at most blockRadius bits set.
+// Enumerated once, on first use.
+static const std::vector<int> &blockMasks(int blockRadius){
+    static const std::vector<std::vector<int>> masks = [](){
+        std::vector<std::vector<int>> m(MAX_BLOCK_RADIUS + 1);
+        for (int r = 0; r <= MAX_BLOCK_RADIUS; r++){
+            for (int v = 0; v < 65536; v++){
+                if (__builtin_popcount(v) <= r) m[r].push_back(v);
+            }
+        }
+        return m;
+    }();
+    return masks[blockRadius];
+}
+
+HashIndex::HashIndex() : indexedRows(0) {
+}
+
+// Load a hash file written by append_image_hash_csv
+int HashIndex::load(char *filename){
+    std::vector<std::string> filenames;
+    std::vector<uint64_t> fileHashes;
+    if (read_image_hash_csv(filename, filenames, fileHashes) != 0) return -1;
+
+    hashes.clear();
+    pathPool.clear();
+    pathOffsets.clear();
+    for (size_t i = 0; i < filenames.size(); i++){
+        add(filenames[i].c_str(), fileHashes[i]);
+    }
+    buildMultiIndex();
+    return 0;
+}
+
+// Append one image and return its index
+int HashIndex::add(const char *path, uint64_t hash){
+    hashes.push_back(hash);
+    pathOffsets.push_back(pathPool.size());
+    pathPool.insert(pathPool.end(), path, path + strlen(path) + 1);
+    return (int)hashes.size() - 1;
+}
+
+// Build the multi-index tables over all rows, as one counting sort per block
+void HashIndex::buildMultiIndex(){
+    int numRows = size();
+    for (int b = 0; b < NUM_BLOCKS; b++){
+        std::vector<int> &start = blockStart[b];
+        std::vector<int> &rows = blockRows[b];
+        start.assign(65536 + 1, 0);
+        for (int i = 0; i < numRows; i++) start[blockValue(hashes[i], b) + 1]++;
+        for (int v = 0; v < 65536; v++) start[v+1] += start[v];
+        rows.resize(numRows);
+        std::vector<int> fill(start.begin(), start.end() - 1);
+        for (int i = 0; i < numRows; i++) rows[fill[blockValue(hashes[i], b)]++] = i;
+    }
+    indexedRows = numRows;
+}
+
+// Find all rows within Hamming distance radius of a query hash
+int HashIndex::radiusSearch(uint64_t query, int radius, std::vector<std::pair<int, int>> &results) const {
+    results.clear();
+    int numRows = size();
+    int blockRadius = radius / NUM_BLOCKS;
+
+    if (indexedRows != numRows || blockRadius > MAX_BLOCK_RADIUS){
+        for (int i = 0; i < numRows; i++){
+            int d = hammingDistance(query, hashes[i]);
+            if (d <= radius) results.push_back(std::pair<int, int>(d, i));
+        }
+    } else {
+        // Flip up to blockRadius bits of each query block and collect the rows sharing that block value
+        const std::vector<int> &masks = blockMasks(blockRadius);
+        std::vector<int> candidates;
+        for (int b = 0; b < NUM_BLOCKS; b++){
+            int qv = blockValue(query, b);
+            for (int m : masks){
+                int v = qv ^ m;
+                for (int r = blockStart[b][v]; r < blockStart[b][v+1]; r++){
+                    int i = blockRows[b][r];
+                    int d = hammingDistance(query, hashes[i]);
+                    if (d <= radius) candidates.push_back(i);
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        for (int i : candidates) results.push_back(std::pair<int, int>(hammingDistance(query, hashes[i]), i));
+    }
+    std::sort(results.begin(), results.end());
+    return 0;
+}
+
+// Find the K rows nearest to a query hash by scanning every row
+int HashIndex::nearest(uint64_t query, int k, std::vector<std::pair<int, int>> &results) const {
+    int numRows = size();
+    results.resize(numRows);
+    for (int i = 0; i < numRows; i++){
+        results[i] = std::pair<int, int>(hammingDistance(query, hashes[i]), i);
+    }
+    k = std::min(k, numRows);
+    std::partial_sort(results.begin(), results.begin() + k, results.end());
+    results.resize(k);
+    return 0;
+}
+
+// Find all pairs of rows within Hamming distance radius
+int HashIndex::selfJoin(int radius, int numThreads, std::vector<JoinPair> &pairs) const {
+    int numRows = size();
+    if (numThreads <= 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::vector<JoinPair>> found(numThreads);
+    auto work = [&](int t){
+        std::vector<std::pair<int, int>> results;
+        for (int i = t; i < numRows; i += numThreads){
+            radiusSearch(hashes[i], radius, results);
+            for (std::pair<int, int> &r : results){
+                if (r.second > i) found[t].push_back(JoinPair{i, r.second, (float)r.first});
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < numThreads; t++) workers.emplace_back(work, t);
+    work(0);
+    for (std::thread &w : workers) w.join();
+
+    pairs.clear();
+    for (std::vector<JoinPair> &f : found) pairs.insert(pairs.end(), f.begin(), f.end());
+    std::sort(pairs.begin(), pairs.end(), [](const JoinPair &x, const JoinPair &y){ return x.a != y.a ? x.a < y.a : x.b < y.b; });
+    return 0;
+}
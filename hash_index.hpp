@@ -0,0 +1,81 @@
+//
+//  hash_index.hpp
+//  Project2
+//
+//  Database of 64-bit perceptual hashes, one per image, matched by Hamming
+//  distance (XOR plus popcount). Radius queries can go through a multi-index
+//  hash table: the hashes are split into four 16-bit blocks, and by the pigeonhole
+//  principle any hash within radius r agrees with the query to within r/4 bits
+//  on at least one block, so only rows sharing a nearby block value are checked.
+//
+
+#ifndef hash_index_hpp
+#define hash_index_hpp
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "selfjoin.hpp"
+
+// Return the number of bits that differ between a and b
+inline int hammingDistance(uint64_t a, uint64_t b){
+    return __builtin_popcountll(a ^ b);
+}
+
+class HashIndex {
+public:
+    // Number of 16-bit blocks of the multi-index
+    static const int NUM_BLOCKS = 4;
+
+    HashIndex();
+
+    // Load a hash file written by append_image_hash_csv, replacing the current contents
+    // and building the multi-index. Returns non-zero if the file cannot be read
+    int load(char *filename);
+
+    // Append one image and return its index. Call buildMultiIndex afterwards
+    // path - image path
+    // hash - 64-bit perceptual hash of the image
+    int add(const char *path, uint64_t hash);
+
+    // Build the multi-index tables over all rows
+    void buildMultiIndex();
+
+    // Number of rows
+    int size() const { return (int)hashes.size(); }
+    // Hash of row i
+    uint64_t hash(int i) const { return hashes[i]; }
+    // Image path of row i
+    const char *path(int i) const { return &pathPool[pathOffsets[i]]; }
+
+    // Find all rows within Hamming distance radius of a query hash.
+    // Uses the multi-index when it is built and the radius is small, otherwise scans every row.
+    // query - 64-bit query hash
+    // radius - maximum Hamming distance
+    // results - (Hamming distance, row) pairs, nearest first
+    int radiusSearch(uint64_t query, int radius, std::vector<std::pair<int, int>> &results) const;
+
+    // Find the K rows nearest to a query hash by scanning every row
+    // query - 64-bit query hash
+    // k - number of results
+    // results - (Hamming distance, row) pairs, nearest first
+    int nearest(uint64_t query, int k, std::vector<std::pair<int, int>> &results) const;
+
+    // Find all pairs of rows within Hamming distance radius
+    // radius - maximum Hamming distance
+    // numThreads - number of worker threads, 0 uses one per core
+    // pairs - all pairs within radius, sorted by (a, b)
+    int selfJoin(int radius, int numThreads, std::vector<JoinPair> &pairs) const;
+
+private:
+    std::vector<uint64_t> hashes;
+    std::vector<char> pathPool;
+    std::vector<size_t> pathOffsets;
+    // Rows grouped by the value of each 16-bit block: the rows whose block b equals v
+    // are blockRows[b][blockStart[b][v] .. blockStart[b][v+1])
+    std::vector<int> blockStart[NUM_BLOCKS];
+    std::vector<int> blockRows[NUM_BLOCKS];
+    int indexedRows;
+};
+
+#endif /* hash_index_hpp */
@@ -0,0 +1,341 @@
+//
+//  ivfpq.cpp
+//  Project2
+//
+//  Inverted-file index with product quantization (IVF-PQ).
+//  Rows are assigned to the nearest of numLists coarse k-means centroids,
+//  and the residual to that centroid is compressed to one byte per subspace.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <queue>
+#include <random>
+#include <thread>
+#include "ivfpq.hpp"
+#include "util.hpp"
+
+static const char IVFPQ_MAGIC[8] = "IVFPQ02";
+
+// Definition of the constant, which std::min binds by reference
+const int IvfPqIndex::CODEBOOK_SIZE;
+
+// Label each of the n rows (dims floats, contiguous) with its nearest centroid, in parallel
+// data - n x dims floats
+// centroids - k x dims floats
+// labels - n labels
+static void assignRows(const float *data, int n, int dims, const float *centroids, int k, std::vector<int> &labels){
+    labels.resize(n);
+    int numThreads = std::max(1, std::min((int)std::thread::hardware_concurrency(), n / 1024 + 1));
+    auto work = [&](int begin, int end){
+        for (int i = begin; i < end; i++){
+            const float *x = data + (size_t)i*dims;
+            float best = sumSquared(x, centroids, dims);
+            int bestIdx = 0;
+            for (int c = 1; c < k; c++){
+                float d = sumSquared(x, centroids + (size_t)c*dims, dims);
+                if (d < best){
+                    best = d;
+                    bestIdx = c;
+                }
+            }
+            labels[i] = bestIdx;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < numThreads; t++){
+        workers.emplace_back(work, (int)((long long)n*t/numThreads), (int)((long long)n*(t+1)/numThreads));
+    }
+    work(0, n/numThreads);
+    for (std::thread &w : workers) w.join();
+}
+
+// Lloyd's k-means on n rows of dims floats, initialized with k distinct random rows.
+// Empty clusters are re-seeded with a random row.
+// data - n x dims floats
+// centroids - k x dims output
+static void kmeans(const float *data, int n, int dims, int k, int iterations, unsigned seed, std::vector<float> &centroids){
+    std::mt19937 rng(seed);
+    std::vector<int> perm(n);
+    for (int i = 0; i < n; i++) perm[i] = i;
+    std::shuffle(perm.begin(), perm.end(), rng);
+    centroids.resize((size_t)k*dims);
+    for (int c = 0; c < k; c++){
+        std::copy(data + (size_t)perm[c]*dims, data + (size_t)(perm[c]+1)*dims, centroids.begin() + (size_t)c*dims);
+    }
+
+    std::vector<int> labels;
+    std::vector<int> counts(k);
+    for (int it = 0; it < iterations; it++){
+        assignRows(data, n, dims, centroids.data(), k, labels);
+        std::fill(centroids.begin(), centroids.end(), 0.0f);
+        std::fill(counts.begin(), counts.end(), 0);
+        for (int i = 0; i < n; i++){
+            float *c = &centroids[(size_t)labels[i]*dims];
+            const float *x = data + (size_t)i*dims;
+            for (int d = 0; d < dims; d++) c[d] += x[d];
+            counts[labels[i]]++;
+        }
+        for (int c = 0; c < k; c++){
+            float *cptr = &centroids[(size_t)c*dims];
+            if (counts[c] == 0){
+                const float *x = data + (size_t)(rng() % n)*dims;
+                std::copy(x, x + dims, cptr);
+            } else {
+                for (int d = 0; d < dims; d++) cptr[d] /= counts[c];
+            }
+        }
+    }
+}
+
+IvfPqIndex::IvfPqIndex()
+    : numDims(0), numLists(0), numSubspaces(0), subDims(0), numCentroids(0), numRows(0), requestedLists(0) {
+}
+
+// Train the coarse centroids and the residual codebooks, removing all rows
+int IvfPqIndex::train(const float *data, int n, int dims, int stride, int lists, int subspaces,
+                      int iterations, unsigned seed){
+    if (n <= 0 || dims <= 0 || lists <= 0 || subspaces <= 0 || subspaces > dims) return -1;
+    numDims = dims;
+    requestedLists = lists;
+    source = FeatureFileStamp();
+    numLists = std::min(lists, n);
+    numSubspaces = subspaces;
+    subDims = (dims + subspaces - 1) / subspaces;
+    numCentroids = std::min(CODEBOOK_SIZE, n);
+    numRows = 0;
+    listIds.assign(numLists, std::vector<int>());
+    listCodes.assign(numLists, std::vector<uint8_t>());
+
+    // Contiguous copy of the training rows
+    std::vector<float> train((size_t)n*dims);
+    for (int i = 0; i < n; i++){
+        std::copy(data + (size_t)i*stride, data + (size_t)i*stride + dims, train.begin() + (size_t)i*dims);
+    }
+    kmeans(train.data(), n, dims, numLists, iterations, seed, coarse);
+
+    // Residuals to the nearest coarse centroid, one zero padded subspace at a time
+    std::vector<int> labels;
+    assignRows(train.data(), n, dims, coarse.data(), numLists, labels);
+    codebooks.assign((size_t)numSubspaces*numCentroids*subDims, 0.0f);
+    std::vector<float> sub((size_t)n*subDims);
+    std::vector<float> subCentroids;
+    for (int m = 0; m < numSubspaces; m++){
+        std::fill(sub.begin(), sub.end(), 0.0f);
+        for (int i = 0; i < n; i++){
+            const float *x = &train[(size_t)i*dims];
+            const float *c = &coarse[(size_t)labels[i]*dims];
+            for (int d = 0; d < subDims && m*subDims + d < dims; d++){
+                sub[(size_t)i*subDims + d] = x[m*subDims + d] - c[m*subDims + d];
+            }
+        }
+        kmeans(sub.data(), n, subDims, numCentroids, iterations, seed + m + 1, subCentroids);
+        std::copy(subCentroids.begin(), subCentroids.end(), codebooks.begin() + (size_t)m*numCentroids*subDims);
+    }
+    return 0;
+}
+
+// Index of the coarse centroid nearest to x
+int IvfPqIndex::nearestList(const float *x) const {
+    float best = sumSquared(x, &coarse[0], numDims);
+    int bestIdx = 0;
+    for (int l = 1; l < numLists; l++){
+        float d = sumSquared(x, &coarse[(size_t)l*numDims], numDims);
+        if (d < best){
+            best = d;
+            bestIdx = l;
+        }
+    }
+    return bestIdx;
+}
+
+// Encode the residual of x to the centroid of list into numSubspaces bytes
+void IvfPqIndex::encode(const float *x, int list, uint8_t *code) const {
+    const float *c = &coarse[(size_t)list*numDims];
+    std::vector<float> residual((size_t)numSubspaces*subDims, 0.0f);
+    for (int d = 0; d < numDims; d++) residual[d] = x[d] - c[d];
+    for (int m = 0; m < numSubspaces; m++){
+        const float *r = &residual[(size_t)m*subDims];
+        const float *cb = &codebooks[(size_t)m*numCentroids*subDims];
+        float best = sumSquared(r, cb, subDims);
+        int bestIdx = 0;
+        for (int j = 1; j < numCentroids; j++){
+            float d = sumSquared(r, cb + (size_t)j*subDims, subDims);
+            if (d < best){
+                best = d;
+                bestIdx = j;
+            }
+        }
+        code[m] = (uint8_t)bestIdx;
+    }
+}
+
+// Encode rows and append them to their inverted lists
+int IvfPqIndex::add(const float *data, int n, int stride, int firstId){
+    if (numLists == 0) return -1;
+    std::vector<uint8_t> code(numSubspaces);
+    for (int i = 0; i < n; i++){
+        const float *x = data + (size_t)i*stride;
+        int list = nearestList(x);
+        encode(x, list, code.data());
+        listIds[list].push_back(firstId + i);
+        listCodes[list].insert(listCodes[list].end(), code.begin(), code.end());
+        numRows++;
+    }
+    return 0;
+}
+
+// Train on an evenly spaced sample of a database and add all of its rows
+int IvfPqIndex::build(const FeatureDatabase &db, int lists, int subspaces, int maxTrainRows){
+    int numTrain = std::min(db.size(), maxTrainRows);
+    std::vector<float> sample((size_t)numTrain*db.dims());
+    for (int i = 0; i < numTrain; i++){
+        const float *src = db.row((int)((long long)i*db.size()/numTrain));
+        std::copy(src, src + db.dims(), sample.begin() + (size_t)i*db.dims());
+    }
+    if (train(sample.data(), numTrain, db.dims(), db.dims(), lists, subspaces) != 0) return -1;
+    source = db.fileStamp();
+    return add(db.row(0), db.size(), db.stride(), 0);
+}
+
+// Approximate top K search
+void IvfPqIndex::listOrder(const float *query, std::vector<int> &order) const {
+    std::vector<std::pair<float, int>> lists(numLists);
+    for (int l = 0; l < numLists; l++){
+        lists[l] = std::pair<float, int>(sumSquared(query, &coarse[(size_t)l*numDims], numDims), l);
+    }
+    std::sort(lists.begin(), lists.end());
+    order.resize(numLists);
+    for (int l = 0; l < numLists; l++) order[l] = lists[l].second;
+}
+
+int IvfPqIndex::search(const float *query, int k, int numProbes, std::vector<std::pair<float, int>> &results) const {
+    results.clear();
+    if (numRows == 0 || k <= 0) return 0;
+
+    // Nearest coarse centroids first
+    std::vector<std::pair<float, int>> probes(numLists);
+    for (int l = 0; l < numLists; l++){
+        probes[l] = std::pair<float, int>(sumSquared(query, &coarse[(size_t)l*numDims], numDims), l);
+    }
+    numProbes = std::max(1, std::min(numProbes, numLists));
+    std::partial_sort(probes.begin(), probes.begin() + numProbes, probes.end());
+
+    std::vector<float> residual((size_t)numSubspaces*subDims, 0.0f);
+    std::vector<float> table((size_t)numSubspaces*numCentroids);
+    std::priority_queue<std::pair<float, int>> best; // max-heap of the k nearest so far
+    for (int p = 0; p < numProbes; p++){
+        int list = probes[p].second;
+        const std::vector<int> &ids = listIds[list];
+        if (ids.empty()) continue;
+
+        // Lookup table of squared distances from the query residual to every subspace centroid
+        const float *c = &coarse[(size_t)list*numDims];
+        for (int d = 0; d < numDims; d++) residual[d] = query[d] - c[d];
+        for (int m = 0; m < numSubspaces; m++){
+            const float *r = &residual[(size_t)m*subDims];
+            const float *cb = &codebooks[(size_t)m*numCentroids*subDims];
+            for (int j = 0; j < numCentroids; j++){
+                table[(size_t)m*numCentroids + j] = sumSquared(r, cb + (size_t)j*subDims, subDims);
+            }
+        }
+
+        const uint8_t *code = listCodes[list].data();
+        for (size_t i = 0; i < ids.size(); i++, code += numSubspaces){
+            float d = 0.0f;
+            const float *t = table.data();
+            for (int m = 0; m < numSubspaces; m++, t += numCentroids){
+                d += t[code[m]];
+            }
+            if ((int)best.size() < k){
+                best.push(std::pair<float, int>(d, ids[i]));
+            } else if (d < best.top().first){
+                best.pop();
+                best.push(std::pair<float, int>(d, ids[i]));
+            }
+        }
+    }
+
+    results.resize(best.size());
+    for (int i = (int)best.size() - 1; i >= 0; i--){
+        results[i] = best.top();
+        best.pop();
+    }
+    return 0;
+}
+
+// Write the index to a binary file
+int IvfPqIndex::save(const char *filename) const {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp){
+        printf("Unable to open index file %s\n", filename);
+        return -1;
+    }
+    int header[7] = {numDims, numLists, numSubspaces, subDims, numCentroids, numRows, requestedLists};
+    fwrite(IVFPQ_MAGIC, 1, sizeof(IVFPQ_MAGIC), fp);
+    fwrite(header, sizeof(int), 7, fp);
+    fwrite(&source.fileSize, sizeof(int64_t), 1, fp);
+    fwrite(&source.mtime, sizeof(int64_t), 1, fp);
+    fwrite(coarse.data(), sizeof(float), coarse.size(), fp);
+    fwrite(codebooks.data(), sizeof(float), codebooks.size(), fp);
+    for (int l = 0; l < numLists; l++){
+        int count = (int)listIds[l].size();
+        fwrite(&count, sizeof(int), 1, fp);
+        fwrite(listIds[l].data(), sizeof(int), count, fp);
+        fwrite(listCodes[l].data(), 1, listCodes[l].size(), fp);
+    }
+    int err = ferror(fp);
+    fclose(fp);
+    return err ? -1 : 0;
+}
+
+// Read an index written by save
+int IvfPqIndex::load(const char *filename){
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return -1;
+    char magic[sizeof(IVFPQ_MAGIC)];
+    int header[7];
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, IVFPQ_MAGIC, sizeof(magic)) != 0 ||
+        fread(header, sizeof(int), 7, fp) != 7 || fread(&source.fileSize, sizeof(int64_t), 1, fp) != 1 ||
+        fread(&source.mtime, sizeof(int64_t), 1, fp) != 1){
+        printf("Invalid index file %s\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    numDims = header[0];
+    numLists = header[1];
+    numSubspaces = header[2];
+    subDims = header[3];
+    numCentroids = header[4];
+    numRows = header[5];
+    requestedLists = header[6];
+    coarse.resize((size_t)numLists*numDims);
+    codebooks.resize((size_t)numSubspaces*numCentroids*subDims);
+    listIds.assign(numLists, std::vector<int>());
+    listCodes.assign(numLists, std::vector<uint8_t>());
+    bool ok = fread(coarse.data(), sizeof(float), coarse.size(), fp) == coarse.size() &&
+              fread(codebooks.data(), sizeof(float), codebooks.size(), fp) == codebooks.size();
+    for (int l = 0; ok && l < numLists; l++){
+        int count;
+        ok = fread(&count, sizeof(int), 1, fp) == 1 && count >= 0;
+        if (!ok) break;
+        listIds[l].resize(count);
+        listCodes[l].resize((size_t)count*numSubspaces);
+        ok = fread(listIds[l].data(), sizeof(int), count, fp) == (size_t)count &&
+             fread(listCodes[l].data(), 1, listCodes[l].size(), fp) == listCodes[l].size();
+    }
+    fclose(fp);
+    if (!ok){
+        printf("Truncated index file %s\n", filename);
+        *this = IvfPqIndex();
+        return -1;
+    }
+    return 0;
+}
+
+// True if the index was built from the rows of a feature file with this stamp,
+// asking for these numbers of inverted lists and code bytes
+bool IvfPqIndex::matches(const FeatureFileStamp &stamp, int dims, int lists, int subspaces) const {
+    return source == stamp && numDims == dims && requestedLists == lists && numSubspaces == subspaces;
+}
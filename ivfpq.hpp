@@ -0,0 +1,114 @@
+//
+//  ivfpq.hpp
+//  Project2
+//
+//  Inverted-file index with product quantization (IVF-PQ).
+//  Rows are assigned to the nearest of numLists coarse k-means centroids,
+//  and the residual to that centroid is compressed to one byte per subspace.
+//  Queries probe the nearest lists and evaluate distances through per-subspace
+//  lookup tables, so only the codes (not the float vectors) need to be in memory.
+//  Distances are approximate squared Euclidean distances.
+//
+
+#ifndef ivfpq_hpp
+#define ivfpq_hpp
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "feature_db.hpp"
+
+class IvfPqIndex {
+public:
+    // Number of centroids per subspace, so each code fits in one byte
+    static const int CODEBOOK_SIZE = 256;
+
+    IvfPqIndex();
+
+    // Train the coarse centroids and the residual codebooks, removing all rows
+    // data - n rows of dims floats, row i starts at data + i*stride
+    // n - number of training rows
+    // dims - number of features per row
+    // stride - distance in floats between consecutive rows
+    // numLists - number of coarse centroids / inverted lists
+    // numSubspaces - number of PQ subspaces, i.e. code bytes per row
+    // iterations - k-means iterations
+    // seed - random seed for the k-means initialization
+    // Returns non-zero if the parameters are invalid
+    int train(const float *data, int n, int dims, int stride, int numLists, int numSubspaces,
+              int iterations = 20, unsigned seed = 1);
+
+    // Encode rows and append them to their inverted lists
+    // data - n rows of dims() floats, row i starts at data + i*stride
+    // n - number of rows
+    // stride - distance in floats between consecutive rows
+    // firstId - id of the first row, the others are numbered consecutively
+    int add(const float *data, int n, int stride, int firstId);
+
+    // Train on an evenly spaced sample of a database and add all of its rows,
+    // with the row index as id
+    // db - Feature database
+    // numLists - number of coarse centroids / inverted lists
+    // numSubspaces - number of PQ subspaces, i.e. code bytes per row
+    // maxTrainRows - maximum number of training rows
+    int build(const FeatureDatabase &db, int numLists, int numSubspaces, int maxTrainRows = 20000);
+
+    // Approximate top K search
+    // query - dims() floats
+    // k - number of results
+    // numProbes - number of inverted lists visited, nearest coarse centroids first
+    // results - (approximate squared distance, id) pairs, nearest first
+    int search(const float *query, int k, int numProbes, std::vector<std::pair<float, int>> &results) const;
+
+    // Order the inverted lists by the distance of their coarse centroid to a query, nearest first
+    // query - dims() floats
+    // order - list indexes, nearest first
+    void listOrder(const float *query, std::vector<int> &order) const;
+
+    // Ids of the rows of an inverted list
+    // list - list index
+    const std::vector<int> &listMembers(int list) const { return listIds[list]; }
+
+    // Write the index to a binary file. Returns non-zero on error
+    int save(const char *filename) const;
+    // Read an index written by save. Returns non-zero on error
+    int load(const char *filename);
+
+    // True if the index was built from the rows of a feature file with this stamp,
+    // asking for these numbers of inverted lists and code bytes
+    // stamp - Stamp of the feature file
+    // dims - number of features per row
+    // numLists - number of inverted lists asked for
+    // numSubspaces - number of code bytes per row asked for
+    bool matches(const FeatureFileStamp &stamp, int dims, int numLists, int numSubspaces) const;
+
+    // Number of features per row
+    int dims() const { return numDims; }
+    // Number of inverted lists
+    int lists() const { return numLists; }
+    // Code bytes per row
+    int codeSize() const { return numSubspaces; }
+    // Number of indexed rows
+    int size() const { return numRows; }
+
+private:
+    // Index of the coarse centroid nearest to x
+    int nearestList(const float *x) const;
+    // Encode the residual of x to the centroid of list into numSubspaces bytes
+    void encode(const float *x, int list, uint8_t *code) const;
+
+    int numDims;
+    int numLists;
+    int numSubspaces;
+    int subDims;      // dimensions per subspace; the last subspace is zero padded
+    int numCentroids; // centroids per subspace, at most CODEBOOK_SIZE
+    int numRows;
+    int requestedLists; // lists asked for, numLists can be fewer
+    FeatureFileStamp source; // stamp of the feature file of the rows, set by build
+    std::vector<float> coarse;    // numLists x numDims
+    std::vector<float> codebooks; // numSubspaces x numCentroids x subDims
+    std::vector<std::vector<int>> listIds;
+    std::vector<std::vector<uint8_t>> listCodes; // numSubspaces bytes per id
+};
+
+#endif /* ivfpq_hpp */
@@ -0,0 +1,178 @@
+//
+//  kernels.hpp
+//  Project2
+//
+//  Histogram and distance kernels specialized at compile time on the number of
+//  histogram bins (4, 8, 16 or 32 per channel). With the bin count fixed, bin
+//  indices are shifts instead of divides, the histogram has a static size, and
+//  the distance loops have a constant trip count the compiler can unroll.
+//  Every kernel produces exactly the same output as its generic counterpart.
+//  chiSquare and bhattacharyyaSqrt sum in 8 interleaved partial sums so that
+//  both their generic loops and their kernels vectorize.
+//  extract3DHistVector, extract3DSoftHistVector and specializeDistanceMetric
+//  dispatch to these kernels and fall back to the generic code for other sizes.
+//
+
+#ifndef kernels_hpp
+#define kernels_hpp
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// log2 of a power of two
+constexpr int log2Bins(int bins){
+    return bins <= 1 ? 0 : 1 + log2Bins(bins / 2);
+}
+
+// 3D histogram with BINS bins per channel of a 3-channel 8-bit image, normalized by the number of pixels.
+// Same bin layout (B, G, R) and accumulation as the generic extract3DHistVector.
+// img - Input image
+// out - BINS^3 floats
+template <int BINS>
+void hist3DKernel(cv::Mat &img, float *out){
+    constexpr int SHIFT = 8 - log2Bins(BINS);
+    constexpr int SIZE = BINS*BINS*BINS;
+    static_assert((1 << (8 - SHIFT)) == BINS, "BINS must be a power of two");
+    static thread_local std::array<float, SIZE> hist;
+    hist.fill(0.0f);
+
+    for(int i=0; i<img.rows; i++){
+        cv::Vec3b *sptr = img.ptr<cv::Vec3b>(i);
+        for(int j=0; j<img.cols; j++){
+            int idx = ((sptr[j][0] >> SHIFT)*BINS + (sptr[j][1] >> SHIFT))*BINS + (sptr[j][2] >> SHIFT);
+            hist[idx] += 1;
+        }
+    }
+
+    float N = img.rows*img.cols;
+    for(int n=0; n<SIZE; n++){
+        out[n] = hist[n]/N;
+    }
+}
+
+// 3D soft histogram with BINS bins per channel, spreading each pixel over softWidth
+// neighbouring values. Same binning and accumulation as the generic extract3DSoftHistVector.
+// img - Input image
+// softWidth - width to spread out a pixel value
+// out - BINS^3 floats
+template <int BINS>
+void softHist3DKernel(cv::Mat &img, int softWidth, float *out){
+    constexpr int SHIFT = 8 - log2Bins(BINS);
+    constexpr int SIZE = BINS*BINS*BINS;
+    static thread_local std::array<float, SIZE> hist;
+    static thread_local std::vector<unsigned char> binOf;
+    hist.fill(0.0f);
+
+    // binOf[v*softWidth + s] = bin of channel value v spread by offset s - softWidth/2
+    int lo = -softWidth/2;
+    binOf.resize(256*softWidth);
+    for(int v=0; v<256; v++){
+        for(int s=0; s<softWidth; s++){
+            int c = std::min(std::max(v + lo + s, 0), 255);
+            binOf[v*softWidth + s] = (c/softWidth) >> SHIFT;
+        }
+    }
+
+    for(int i=0; i<img.rows; i++){
+        cv::Vec3b *sptr = img.ptr<cv::Vec3b>(i);
+        for(int j=0; j<img.cols; j++){
+            const unsigned char *bBin = &binOf[sptr[j][0]*softWidth];
+            const unsigned char *gBin = &binOf[sptr[j][1]*softWidth];
+            const unsigned char *rBin = &binOf[sptr[j][2]*softWidth];
+            for(int s=0; s<softWidth; s++){
+                hist[(bBin[s]*BINS + gBin[s])*BINS + rBin[s]] += 1;
+            }
+        }
+    }
+
+    float N = img.rows*img.cols;
+    for(int n=0; n<SIZE; n++){
+        out[n] = hist[n]/N;
+    }
+}
+
+// Sum of squared differences of N floats, with the same summation order as sumSquared.
+// The loop runs in fixed blocks of 8 that the compiler fully unrolls.
+// x - N floats
+// y - N floats
+template <int N>
+float sumSquaredKernel(const float *x, const float *y, int){
+    static_assert(N % 8 == 0, "N must be a multiple of 8");
+    float result = 0.0f;
+    for (int i = 0; i < N; i += 8){
+        for (int u = 0; u < 8; u++){
+            result += (x[i+u] - y[i+u])*(x[i+u] - y[i+u]);
+        }
+    }
+    return result;
+}
+
+// 1 - histogram intersection of N floats, with the same summation order as histIntersectionNormalized.
+// The loop runs in fixed blocks of 8 that the compiler fully unrolls.
+// x - N floats
+// y - N floats
+template <int N>
+float histIntersectionKernel(const float *x, const float *y, int){
+    static_assert(N % 8 == 0, "N must be a multiple of 8");
+    float result = 0.0f;
+    for (int i = 0; i < N; i += 8){
+        for (int u = 0; u < 8; u++){
+            result += std::min(x[i+u], y[i+u]);
+        }
+    }
+    return 1-result;
+}
+
+// Sum of 8 partial sums, in the fixed order shared by the generic metrics and the kernels
+// lanes - 8 partial sums
+inline float sumLanes(const float *lanes){
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+// One bin of the chi-square distance, 0 if the bin is zero in both histograms.
+// Branch free, so the loops calling it vectorize.
+inline float chiSquareTerm(float x, float y){
+    float d = x - y;
+    float s = x + y;
+    return d*d/(s + (s == 0.0f));
+}
+
+// Bhattacharyya distance of a Bhattacharyya coefficient, never negative
+inline float bhattacharyyaFromCoefficient(float coefficient){
+    return std::max(0.0f, -std::log(std::max(coefficient, 1e-30f)));
+}
+
+// Chi-square distance of N floats, with the same 8 partial sums as chiSquare.
+// x - N floats
+// y - N floats
+template <int N>
+float chiSquareKernel(const float *x, const float *y, int){
+    static_assert(N % 8 == 0, "N must be a multiple of 8");
+    float lanes[8] = {0};
+    for (int i = 0; i < N; i += 8){
+        for (int u = 0; u < 8; u++){
+            lanes[u] += chiSquareTerm(x[i+u], y[i+u]);
+        }
+    }
+    return sumLanes(lanes);
+}
+
+// Bhattacharyya distance of N square-rooted histogram bins, with the same 8 partial sums as bhattacharyyaSqrt.
+// x - N floats
+// y - N floats
+template <int N>
+float bhattacharyyaKernel(const float *x, const float *y, int){
+    static_assert(N % 8 == 0, "N must be a multiple of 8");
+    float lanes[8] = {0};
+    for (int i = 0; i < N; i += 8){
+        for (int u = 0; u < 8; u++){
+            lanes[u] += x[i+u]*y[i+u];
+        }
+    }
+    return bhattacharyyaFromCoefficient(sumLanes(lanes));
+}
+
+#endif /* kernels_hpp */
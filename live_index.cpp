@@ -0,0 +1,256 @@
+//
+//  live_index.cpp
+//  Project2
+//
+//  Feature index that accepts inserts and deletes while queries run.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <queue>
+#include "live_index.hpp"
+
+int LiveIndex::Snapshot::size() const {
+    int n = 0;
+    for (const SegmentView &v : segments) n += v.numLive;
+    return n;
+}
+
+LiveIndex::LiveIndex() : current(std::make_shared<Snapshot>()), stopping(false) {
+}
+
+LiveIndex::~LiveIndex(){
+    stopMerger();
+}
+
+// Empty databases with the dims of other databases
+// databases - Databases to reset
+// dims - Databases providing the dims
+static void resetLike(std::vector<FeatureDatabase> &databases, const std::vector<FeatureDatabase> &dims){
+    databases.clear();
+    databases.resize(dims.size());
+    for (int i = 0; i < dims.size(); i++) databases[i].reset(dims[i].dims());
+}
+
+void LiveIndex::reset(std::vector<FeatureDatabase> &&base){
+    std::lock_guard<std::mutex> mergeLock(mergeMutex);
+    std::lock_guard<std::mutex> lock(writeMutex);
+    std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+    segment->databases = std::move(base);
+    resetLike(pending.databases, segment->databases);
+    pendingDeletes.clear();
+
+    std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>();
+    next->version = std::atomic_load(&current)->version + 1;
+    SegmentView view;
+    view.numLive = segment->databases.empty() ? 0 : segment->databases[0].size();
+    view.segment = segment;
+    next->segments.push_back(view);
+    std::atomic_store(&current, std::shared_ptr<const Snapshot>(next));
+}
+
+std::shared_ptr<const LiveIndex::Snapshot> LiveIndex::snapshot() const {
+    return std::atomic_load(&current);
+}
+
+int LiveIndex::insert(const char *path, const std::vector<std::vector<float>> &vectors){
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (vectors.size() != pending.databases.size()) {
+        printf("Live index insert of %s has %lu feature vectors instead of %lu\n", path, vectors.size(), pending.databases.size());
+        return -1;
+    }
+    for (int i = 0; i < vectors.size(); i++){
+        if ((int)vectors[i].size() != pending.databases[i].dims()) {
+            printf("Live index insert of %s does not match the feature files\n", path);
+            return -1;
+        }
+    }
+    for (int i = 0; i < vectors.size(); i++) pending.databases[i].addRow(path, vectors[i].data());
+    return 0;
+}
+
+void LiveIndex::remove(const char *path){
+    std::lock_guard<std::mutex> lock(writeMutex);
+    pendingDeletes.insert(path);
+    // Drop the staged inserts of the path, so inserts and deletes take effect in the order they were staged
+    if (pending.databases.empty()) return;
+    const FeatureDatabase &staged = pending.databases[0];
+    int row = 0;
+    while (row < staged.size() && strcmp(staged.path(row), path) != 0) row++;
+    if (row == staged.size()) return;
+    std::vector<FeatureDatabase> kept;
+    resetLike(kept, pending.databases);
+    for (row = 0; row < staged.size(); row++){
+        if (strcmp(staged.path(row), path) == 0) continue;
+        for (int i = 0; i < kept.size(); i++) kept[i].addRow(pending.databases[i].path(row), pending.databases[i].row(row));
+    }
+    pending.databases = std::move(kept);
+}
+
+void LiveIndex::commit(){
+    std::lock_guard<std::mutex> lock(writeMutex);
+    std::shared_ptr<const Snapshot> cur = std::atomic_load(&current);
+    std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(*cur);
+    next->version = cur->version + 1;
+
+    // Deletes: copy the deleted rows of a segment the first time one of its rows is deleted
+    if (!pendingDeletes.empty()){
+        for (SegmentView &view : next->segments){
+            const FeatureDatabase &db = view.segment->databases[0];
+            std::shared_ptr<std::vector<uint8_t>> deleted;
+            for (int row = 0; row < db.size(); row++){
+                if ((view.deleted && (*view.deleted)[row]) || !pendingDeletes.count(db.path(row))) continue;
+                if (!deleted) {
+                    deleted = view.deleted ? std::make_shared<std::vector<uint8_t>>(*view.deleted)
+                                           : std::make_shared<std::vector<uint8_t>>(db.size(), 0);
+                }
+                (*deleted)[row] = 1;
+                view.numLive--;
+            }
+            if (deleted) view.deleted = deleted;
+        }
+        pendingDeletes.clear();
+    }
+
+    // Inserts: the staged rows become a new segment
+    if (!pending.databases.empty() && pending.databases[0].size() > 0){
+        std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+        segment->databases = std::move(pending.databases);
+        resetLike(pending.databases, segment->databases);
+        SegmentView view;
+        view.numLive = segment->databases[0].size();
+        view.segment = segment;
+        next->segments.push_back(view);
+    }
+    std::atomic_store(&current, std::shared_ptr<const Snapshot>(next));
+}
+
+int LiveIndex::mergeOnce(int maxSegments){
+    std::lock_guard<std::mutex> mergeLock(mergeMutex);
+    std::shared_ptr<const Snapshot> snap = snapshot();
+    const std::vector<SegmentView> &views = snap->segments;
+
+    // Pick a segment to compact, or the two smallest adjacent segments
+    int first = -1, count = 0;
+    for (int v = 0; v < views.size(); v++){
+        int rows = views[v].segment->databases[0].size();
+        if (rows > 0 && views[v].numLive*2 < rows) {
+            first = v;
+            count = 1;
+            break;
+        }
+    }
+    if (first < 0 && (int)views.size() > std::max(1, maxSegments)){
+        for (int v = 0; v + 1 < views.size(); v++){
+            if (first < 0 || views[v].numLive + views[v+1].numLive < views[first].numLive + views[first+1].numLive) first = v;
+        }
+        count = 2;
+    }
+    if (first < 0) return 0;
+
+    // Copy the live rows into the merged segment, without holding the write lock
+    std::shared_ptr<Segment> merged = std::make_shared<Segment>();
+    resetLike(merged->databases, views[first].segment->databases);
+    std::vector<std::pair<int, int>> origin;
+    for (int v = first; v < first + count; v++){
+        const SegmentView &view = views[v];
+        for (int i = 0; i < merged->databases.size(); i++) merged->databases[i].reserve(merged->databases[i].size() + view.numLive);
+        for (int row = 0; row < view.segment->databases[0].size(); row++){
+            if (view.deleted && (*view.deleted)[row]) continue;
+            for (int i = 0; i < merged->databases.size(); i++){
+                const FeatureDatabase &db = view.segment->databases[i];
+                merged->databases[i].addRow(db.path(row), db.row(row));
+            }
+            origin.push_back(std::pair<int, int>(v, row));
+        }
+    }
+
+    // Publish. Only merges move segments, so the merged ones are still at [first, first + count),
+    // but rows may have been deleted from them since the merge started.
+    std::lock_guard<std::mutex> lock(writeMutex);
+    std::shared_ptr<const Snapshot> cur = std::atomic_load(&current);
+    std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>();
+    next->version = cur->version + 1;
+    SegmentView view;
+    view.segment = merged;
+    view.numLive = (int)origin.size();
+    std::shared_ptr<std::vector<uint8_t>> deleted;
+    for (int m = 0; m < origin.size(); m++){
+        const SegmentView &was = cur->segments[origin[m].first];
+        if (!was.deleted || !(*was.deleted)[origin[m].second]) continue;
+        if (!deleted) deleted = std::make_shared<std::vector<uint8_t>>(origin.size(), 0);
+        (*deleted)[m] = 1;
+        view.numLive--;
+    }
+    view.deleted = deleted;
+    next->segments.assign(cur->segments.begin(), cur->segments.begin() + first);
+    // A segment whose rows were all deleted is dropped
+    if (!origin.empty()) next->segments.push_back(view);
+    next->segments.insert(next->segments.end(), cur->segments.begin() + first + count, cur->segments.end());
+    std::atomic_store(&current, std::shared_ptr<const Snapshot>(next));
+    return 1;
+}
+
+void LiveIndex::startMerger(int maxSegments, int intervalMs){
+    stopMerger();
+    stopping = false;
+    merger = std::thread([this, maxSegments, intervalMs]{
+        std::unique_lock<std::mutex> lock(mergerMutex);
+        while (!mergerWake.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]{ return stopping; })){
+            lock.unlock();
+            while (mergeOnce(maxSegments)) {}
+            lock.lock();
+        }
+    });
+}
+
+void LiveIndex::stopMerger(){
+    {
+        std::lock_guard<std::mutex> lock(mergerMutex);
+        stopping = true;
+    }
+    mergerWake.notify_all();
+    if (merger.joinable()) merger.join();
+}
+
+int LiveIndex::search(const Snapshot &snap,
+                      const std::vector<std::vector<float>> &vectors,
+                      const std::vector<double> &weights,
+                      DistanceMetric metric,
+                      int k,
+                      std::vector<std::pair<float, std::string>> &topK){
+    topK.clear();
+    if (k <= 0) return 0;
+    // Max-heap of (distance, (ordinal, image path)) of the top K so far. The ordinal numbers the rows
+    // by segment, then row, so ties are broken as in exactTopK, by row.
+    std::priority_queue<std::pair<float, std::pair<long, const char *>>> best;
+    long ordinal = 0;
+    for (const SegmentView &view : snap.segments){
+        const std::vector<FeatureDatabase> &databases = view.segment->databases;
+        std::vector<DistanceMetric> metrics(databases.size());
+        for (int i = 0; i < databases.size(); i++) metrics[i] = specializeDistanceMetric(metric, databases[i].dims());
+        for (int row = 0; row < databases[0].size(); row++, ordinal++){
+            if (view.deleted && (*view.deleted)[row]) continue;
+            // Summed like queryDistance, so a snapshot of one segment without deletes
+            // gives the distances and ties of exactTopK
+            float total = 0;
+            for (int i = 0; i < databases.size(); i++){
+                float distance = weights[i] * metrics[i](vectors[i].data(), databases[i].row(row), databases[i].dims());
+                total = i == 0 ? distance : total + distance;
+            }
+            std::pair<float, std::pair<long, const char *>> candidate(total, std::pair<long, const char *>(ordinal, databases[0].path(row)));
+            if ((int)best.size() < k) best.push(candidate);
+            else if (candidate < best.top()) {
+                best.pop();
+                best.push(candidate);
+            }
+        }
+    }
+    topK.resize(best.size());
+    for (size_t i = topK.size(); i > 0; i--){
+        topK[i-1] = std::pair<float, std::string>(best.top().first, best.top().second.second);
+        best.pop();
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+//
+//  live_index.hpp
+//  Project2
+//
+//  Feature index that accepts inserts and deletes while queries run.
+//  Rows live in immutable segments. Queries read an immutable snapshot, the list of
+//  segments with the rows deleted from each, taken with one atomic load and kept alive
+//  by reference counting until the last query using it is done (RCU-style reclamation).
+//  Writers stage inserts in a private delta, and commit() publishes the delta as a new
+//  segment together with the deletes in a new snapshot. A background merger folds small
+//  segments together and drops deleted rows, publishing the result the same way.
+//  Queries never wait for writers and never see a partly written row.
+//
+
+#ifndef live_index_hpp
+#define live_index_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "feature_db.hpp"
+#include "util.hpp"
+
+class LiveIndex {
+public:
+    // Rows of a segment, one FeatureDatabase per feature file, all with the same rows
+    struct Segment {
+        std::vector<FeatureDatabase> databases;
+    };
+    // A segment in a snapshot, with the rows deleted from it
+    struct SegmentView {
+        std::shared_ptr<const Segment> segment;
+        std::shared_ptr<const std::vector<uint8_t>> deleted; // 1 per deleted row, NULL if none is deleted
+        int numLive = 0;
+    };
+    // Immutable view of the index
+    struct Snapshot {
+        std::vector<SegmentView> segments;
+        long version = 0;
+        // Number of rows that are not deleted
+        int size() const;
+    };
+
+    LiveIndex();
+    ~LiveIndex();
+    LiveIndex(const LiveIndex &) = delete;
+    LiveIndex &operator=(const LiveIndex &) = delete;
+
+    // Replace the contents of the index by one segment
+    // base - Feature databases, one per feature file, all with the same rows. Sets the dims of every feature file.
+    void reset(std::vector<FeatureDatabase> &&base);
+
+    // The current snapshot. It stays valid, and unchanged, for as long as it is held.
+    std::shared_ptr<const Snapshot> snapshot() const;
+
+    // Stage a row for insertion. It becomes visible to queries at the next commit().
+    // Returns non-zero if the vectors do not match the feature files.
+    // path - Image path of the row
+    // vectors - Features of the row, one vector per feature file
+    int insert(const char *path, const std::vector<std::vector<float>> &vectors);
+
+    // Stage the deletion of every row with an image path, committed or staged. Takes effect at the next commit(),
+    // so remove() followed by insert() replaces a row, and insert() followed by remove() leaves none.
+    // path - Image path of the rows
+    void remove(const char *path);
+
+    // Publish the staged deletes and inserts in a new snapshot
+    void commit();
+
+    // Merge once: compact a segment with more deleted than live rows, dropping it if none is live,
+    // or if there are more than maxSegments segments, merge the two adjacent segments with the fewest live rows.
+    // Returns 1 if segments were merged, 0 if there was nothing to do.
+    // maxSegments - Most segments kept without merging
+    int mergeOnce(int maxSegments);
+
+    // Run mergeOnce on a background thread every intervalMs milliseconds, until stopMerger()
+    // maxSegments - Most segments kept without merging
+    // intervalMs - Time between merge checks
+    void startMerger(int maxSegments = 8, int intervalMs = 100);
+
+    // Stop the background merger and wait for it
+    void stopMerger();
+
+    // Exact top K search over a snapshot, by weighted distance summed over the feature files
+    // in the order of queryDistance. Ties are broken by segment, then row, so a snapshot
+    // of one segment without deletes gives the results of exactTopK.
+    // snap - Snapshot to search
+    // vectors - Query features, one vector per feature file
+    // weights - Weight of each feature file
+    // metric - Distance metric
+    // k - Number of top matching rows
+    // topK - (distance, image path) of the top K matching rows, nearest first
+    static int search(const Snapshot &snap,
+                      const std::vector<std::vector<float>> &vectors,
+                      const std::vector<double> &weights,
+                      DistanceMetric metric,
+                      int k,
+                      std::vector<std::pair<float, std::string>> &topK);
+
+private:
+    std::shared_ptr<const Snapshot> current; // read and replaced with std::atomic_load / std::atomic_store
+    std::mutex writeMutex;                   // serializes staging and publishing
+    std::mutex mergeMutex;                   // serializes merges
+    Segment pending;
+    std::unordered_set<std::string> pendingDeletes;
+    std::thread merger;
+    std::mutex mergerMutex;
+    std::condition_variable mergerWake;
+    bool stopping;
+};
+
+#endif /* live_index_hpp */
@@ -0,0 +1,130 @@
+//
+//  pca_index.cpp
+//  Project2
+//
+//  PCA projection of a feature database. Stores a low dimensional
+//  projection next to every row so queries can shortlist candidates
+//  cheaply before re-ranking them with the exact distance.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <opencv2/opencv.hpp>
+#include "pca_index.hpp"
+
+static const char PCA_MAGIC[8] = "PCAIDX1";
+
+PcaIndex::PcaIndex() : numDims(0), numComponents(0), numRows(0), requested(0) {
+}
+
+// Train the projection on the rows of a database and project every row
+// db - Feature database
+// components - number of principal components to keep
+// maxTrainRows - train on an evenly spaced sample of at most this many rows
+int PcaIndex::build(const FeatureDatabase &db, int components, int maxTrainRows){
+    if (db.size() == 0 || db.dims() == 0) return -1;
+    numDims = db.dims();
+    numRows = db.size();
+    requested = components;
+    source = db.fileStamp();
+    numComponents = std::min(components, std::min(numDims, numRows));
+
+    // Training sample, evenly spaced over the database
+    int numTrain = std::min(numRows, maxTrainRows);
+    cv::Mat samples(numTrain, numDims, CV_32F);
+    for (int i = 0; i<numTrain; i++){
+        const float *src = db.row((int)((long long)i*numRows/numTrain));
+        std::copy(src, src+numDims, samples.ptr<float>(i));
+    }
+    cv::PCA pca(samples, cv::Mat(), cv::PCA::DATA_AS_ROW, numComponents);
+    numComponents = pca.eigenvectors.rows;
+
+    mean.assign(numDims, 0.0f);
+    basis.assign((size_t)numComponents*numDims, 0.0f);
+    cv::Mat meanF, basisF;
+    pca.mean.convertTo(meanF, CV_32F);
+    pca.eigenvectors.convertTo(basisF, CV_32F);
+    std::copy(meanF.ptr<float>(0), meanF.ptr<float>(0)+numDims, mean.begin());
+    for (int c = 0; c<numComponents; c++){
+        std::copy(basisF.ptr<float>(c), basisF.ptr<float>(c)+numDims, basis.begin()+(size_t)c*numDims);
+    }
+
+    // Project every row
+    projections.assign((size_t)numRows*numComponents, 0.0f);
+    for (int i = 0; i<numRows; i++){
+        project(db.row(i), &projections[(size_t)i*numComponents]);
+    }
+    return 0;
+}
+
+// Project a full length feature vector
+// x - numDims floats
+// out - numComponents floats
+void PcaIndex::project(const float *x, float *out) const {
+    for (int c = 0; c<numComponents; c++){
+        const float *b = &basis[(size_t)c*numDims];
+        float sum = 0.0f;
+        for (int d = 0; d<numDims; d++){
+            sum += (x[d] - mean[d]) * b[d];
+        }
+        out[c] = sum;
+    }
+}
+
+// Write the projection and the projected rows to a binary file
+int PcaIndex::save(const char *filename) const {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp){
+        printf("Unable to open index file %s\n", filename);
+        return -1;
+    }
+    int header[4] = {numDims, numComponents, numRows, requested};
+    fwrite(PCA_MAGIC, 1, sizeof(PCA_MAGIC), fp);
+    fwrite(header, sizeof(int), 4, fp);
+    fwrite(&source.fileSize, sizeof(int64_t), 1, fp);
+    fwrite(&source.mtime, sizeof(int64_t), 1, fp);
+    fwrite(mean.data(), sizeof(float), mean.size(), fp);
+    fwrite(basis.data(), sizeof(float), basis.size(), fp);
+    fwrite(projections.data(), sizeof(float), projections.size(), fp);
+    int err = ferror(fp);
+    fclose(fp);
+    return err ? -1 : 0;
+}
+
+// Read an index written by save
+int PcaIndex::load(const char *filename){
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return -1;
+    char magic[sizeof(PCA_MAGIC)];
+    int header[4];
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, PCA_MAGIC, sizeof(magic)) != 0 ||
+        fread(header, sizeof(int), 4, fp) != 4 || header[0] < 0 || header[1] < 0 || header[2] < 0){
+        printf("Invalid index file %s\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    numDims = header[0];
+    numComponents = header[1];
+    numRows = header[2];
+    requested = header[3];
+    mean.resize(numDims);
+    basis.resize((size_t)numComponents*numDims);
+    projections.resize((size_t)numRows*numComponents);
+    bool ok = fread(&source.fileSize, sizeof(int64_t), 1, fp) == 1 &&
+              fread(&source.mtime, sizeof(int64_t), 1, fp) == 1 &&
+              fread(mean.data(), sizeof(float), mean.size(), fp) == mean.size() &&
+              fread(basis.data(), sizeof(float), basis.size(), fp) == basis.size() &&
+              fread(projections.data(), sizeof(float), projections.size(), fp) == projections.size();
+    fclose(fp);
+    if (!ok){
+        printf("Truncated index file %s\n", filename);
+        *this = PcaIndex();
+        return -1;
+    }
+    return 0;
+}
+
+// True if the index was built over db, asking for components principal components
+bool PcaIndex::matches(const FeatureDatabase &db, int components) const {
+    return source == db.fileStamp() && numDims == db.dims() && numRows == db.size() && requested == components;
+}
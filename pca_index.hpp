@@ -0,0 +1,59 @@
+//
+//  pca_index.hpp
+//  Project2
+//
+//  PCA projection of a feature database. Stores a low dimensional
+//  projection next to every row so queries can shortlist candidates
+//  cheaply before re-ranking them with the exact distance. The index is
+//  saved next to the feature file, so the projection is trained once.
+//
+
+#ifndef pca_index_hpp
+#define pca_index_hpp
+
+#include <vector>
+#include "feature_db.hpp"
+
+class PcaIndex {
+public:
+    PcaIndex();
+
+    // Train the projection on the rows of a database and project every row
+    // db - Feature database
+    // components - number of principal components to keep, typically 32 - 64
+    // maxTrainRows - train on an evenly spaced sample of at most this many rows
+    // Returns non-zero if the database is empty
+    int build(const FeatureDatabase &db, int components, int maxTrainRows = 20000);
+
+    // Project a full length feature vector
+    // x - db.dims() floats
+    // out - components() floats
+    void project(const float *x, float *out) const;
+
+    // Write the projection and the projected rows to a binary file. Returns non-zero on error
+    int save(const char *filename) const;
+    // Read an index written by save. Returns non-zero on error
+    int load(const char *filename);
+
+    // True if the index was built over db, asking for components principal components
+    bool matches(const FeatureDatabase &db, int components) const;
+
+    // Number of principal components
+    int components() const { return numComponents; }
+    // Number of projected rows
+    int size() const { return numRows; }
+    // Projection of row i, components() floats
+    const float *projected(int i) const { return &projections[(size_t)i*numComponents]; }
+
+private:
+    int numDims;
+    int numComponents;
+    int numRows;
+    int requested;                  // components asked for, numComponents can be fewer
+    FeatureFileStamp source;        // stamp of the feature file of the rows
+    std::vector<float> mean;        // numDims
+    std::vector<float> basis;       // numComponents x numDims, row-major
+    std::vector<float> projections; // numRows x numComponents, row-major
+};
+
+#endif /* pca_index_hpp */
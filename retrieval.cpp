@@ -0,0 +1,973 @@
+//
+//  retrieval.cpp
+//  Project2
+//
+//  Content-Based Image Retrieval
+//  Computing the feature files of an image directory with createFeatureVector(),
+//  building queries and loading the feature databases they are matched with, and knn().
+//  The search modes are in search_*.cpp.
+//
+#include <stdio.h>
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+#include <map>
+#include <mutex>
+
+#include "feature.hpp"
+#include "csv_util.hpp"
+#include "util.hpp"
+#include "retrieval.hpp"
+#include "bounded_queue.hpp"
+#include "crawler.hpp"
+#include "bow_index.hpp"
+#include "selfjoin.hpp"
+#include "hash_index.hpp"
+
+// Filenames
+char MIDDLE_FEATURE [] = "NineByNine.csv";
+char HIST_FEATURE [] = "Hist.csv";
+char HIST_UPPERHALF_FEATURE [] = "HistUpperHalf.csv";
+char HIST_LOWERHALF_FEATURE [] = "HistLowerHalf.csv";
+char HIST_SOBEL_TEXTURE_FEATURE [] = "HistSobelTexture.csv";
+char HIST_SOFT_FEATURE [] = "HistSoft.csv";
+char HIST_LAWS_FEATURE [] = "HistLaws.csv";
+char HIST_GABOR_FEATURE [] = "HistGabor.csv";
+char HIST_MIDDLE_MED_FEATURE [] = "HistMiddleMed.csv";
+char HIST_MIDDLE_SMALL_FEATURE [] = "HistMiddleSmall.csv";
+char HIST_MIDDLE_SMALL_GABOR_FEATURE [] = "HistSmallGabor.csv";
+char HIST_MIDDLE_MED_GABOR_FEATURE [] = "HistMiddleGabor.csv";
+char PHASH_FEATURE [] = "PerceptualHash.csv";
+char HIST_HSV_FEATURE [] = "HistHSV.csv";
+char HIST_LAB_FEATURE [] = "HistLab.csv";
+char HIST_OPPONENT_FEATURE [] = "HistOpponent.csv";
+char ORB_FEATURE [] = "OrbKeypoints.bin";
+char BOW_INDEX [] = "BagOfWords.bow";
+char CRAWL_CACHE [] = "CrawlCache.bin";
+
+// Feature files being rewritten, with the staging files their rows are written to
+static std::map<std::string, std::string> stagedFiles;
+static std::mutex stagedFilesMutex;
+
+// Staging file of a feature file, `<csv>.tmp`. createFeatureVector writes the rows there
+// and renames it over the feature file when done, so a query running during a re-index
+// reads either the old or the new feature file, never a partly written one.
+// csvFile - Feature file
+static char *stagedFile(char *csvFile){
+    std::lock_guard<std::mutex> lock(stagedFilesMutex);
+    std::string &staged = stagedFiles[csvFile];
+    if (staged.empty()) staged = std::string(csvFile) + ".tmp";
+    return &staged[0];
+}
+
+// Atomically replace the feature files by their staging files
+static int publishStagedFiles(){
+    std::lock_guard<std::mutex> lock(stagedFilesMutex);
+    int failed = 0;
+    for (std::pair<const std::string, std::string> &f : stagedFiles){
+        if (rename(f.second.c_str(), f.first.c_str()) != 0) {
+            printf("Unable to replace %s by %s\n", f.first.c_str(), f.second.c_str());
+            failed = -1;
+        }
+    }
+    stagedFiles.clear();
+    return failed;
+}
+
+// Extractor context and feature storage of the indexing thread, reused from one image to the next
+struct IngestContext {
+    FeatureContext features;
+    std::vector<float> vectors[4];       // feature vectors of one image
+    std::vector<cv::KeyPoint> keypoints; // ORB keypoints and descriptors of one image
+    cv::Mat descriptors;
+};
+
+// Size a feature vector of the ingest context to n floats and return its storage.
+// Feature vectors of a featureType have fixed sizes, so only the first image allocates.
+static float *featureStorage(std::vector<float> &vector, size_t n){
+    vector.resize(n);
+    return vector.data();
+}
+
+// Compute the feature vectors (according to featureType) of one image
+// and append them to the csv files.
+// context - Extractor context and feature storage of the calling thread
+// img - Image
+// imgPath - Key of the image in the csv files, its path
+// featureType - Feature type, ranging from 1 to 15
+// ingest - Ingestion options
+// reset - Erase the csv files first
+static int appendImageFeatures(IngestContext &context, cv::Mat &img, char *imgPath, int featureType,
+                               const IngestOptions &ingest, int reset){
+    FeatureContext &features = context.features;
+    std::vector<float> &imageData = context.vectors[0];
+    std::vector<float> &imageDataTwo = context.vectors[1];
+    std::vector<float> &imageDataThree = context.vectors[2];
+    std::vector<float> &imageDataFour = context.vectors[3];
+    switch (featureType) {
+        case 1:{
+            // Feature = the middle 9x9 pixels
+            extractMiddleVector(img, 9, 9, featureStorage(imageData, 9*9*3));
+            append_image_data_csv(stagedFile(MIDDLE_FEATURE), imgPath, imageData, reset);
+            break;
+        }
+        case 2:{
+            // Feature = 3D Histogram with bins of 8 each
+            int bins = 8;
+            extract3DHistVector(img, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_FEATURE), imgPath, imageData, reset);
+            break;
+        }
+        case 3:{
+            // Split image to top and bottom
+            // 3D Histogram with bins of 8 each
+            cv::Rect upperHalf(0, 0, img.cols-1, (img.rows-1)/2);
+            cv::Rect lowerHalf(0, img.rows/2+1, img.cols-1, (img.rows-1)/2);
+            
+            cv::Mat upperImg = img(upperHalf);
+            cv::Mat lowerImg = img(lowerHalf);
+            
+            // Feature = 3D Histogram with bins of 8 each
+            int bins = 8;
+            extract3DHistVector(upperImg, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_UPPERHALF_FEATURE), imgPath, imageData, reset);
+            
+            extract3DHistVector(lowerImg, bins, featureStorage(imageDataTwo, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_LOWERHALF_FEATURE), imgPath, imageDataTwo, reset);
+            break;
+        }
+        case 4: {
+            // 3D Histogram with bins of 8 each +
+            // 3D Histogram of Sobel Magnitude with bins of 8 each
+            // 3D Histogram of Gobar Filter with bins of 8 each
+            int bins = 8;
+            extract3DHistVector(img, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_FEATURE), imgPath, imageData, reset);
+            
+            extractSobelTextureVector(features, img, bins, featureStorage(imageDataTwo, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_SOBEL_TEXTURE_FEATURE), imgPath, imageDataTwo, reset);
+            break;
+        }
+        case 5:{
+            // Only use the middle 100x100 and 50x50 pixels
+            // 3D Histogram with bins of 8 each
+            // 3D Histogram of Gobar Filter with bins of 8 each
+            int bins = 8;
+            
+            int midRow = (img.rows%2 == 0)? img.rows/2 : img.rows/2+1;
+            int midCol = (img.cols%2 == 0)? img.cols/2 : img.cols/2+1;
+            int sizeMid = 100;
+            int sizeSmall = 50;
+            
+            cv::Rect middle(midCol-sizeMid/2, midRow-sizeMid/2, sizeMid, sizeMid);
+            cv::Rect smaller(midCol-sizeSmall/2, midRow-sizeSmall/2, sizeSmall, sizeSmall);
+            
+            cv::Mat middleImg = img(middle);
+            cv::Mat smallerImg = img(smaller);
+          
+            extract3DHistVector(middleImg, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_MIDDLE_MED_FEATURE), imgPath, imageData, reset);
+            
+            extractGaborTextureVector(features, middleImg, bins, featureStorage(imageDataTwo, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_MIDDLE_MED_GABOR_FEATURE), imgPath, imageDataTwo, reset);
+            
+            extract3DHistVector(smallerImg, bins, featureStorage(imageDataThree, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_MIDDLE_SMALL_FEATURE), imgPath, imageDataThree, reset);
+            
+            extractGaborTextureVector(features, smallerImg, bins, featureStorage(imageDataFour, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_MIDDLE_SMALL_GABOR_FEATURE), imgPath, imageDataFour, reset);
+            break;
+        }
+        case 6:{
+            // 3D SOFT Histogram with bins of 8 each, and softWidth of 5
+            int bins = 8;
+            int softWidth = 5;
+            
+            extract3DSoftHistVector(img, bins, softWidth, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_SOFT_FEATURE), imgPath, imageData, reset);
+            break;
+        }
+        case 7:{
+            // 3D Histogram with bins of 8 each +
+            // 3D Histogram on Law's Filter Averaged, with bins of 8 each
+            
+            int bins = 8;
+            extract3DHistVector(img, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_FEATURE), imgPath, imageData, reset);
+            
+            extractLawsTextureVector(features, img, bins, featureStorage(imageDataTwo, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_LAWS_FEATURE), imgPath, imageDataTwo, reset);
+            break;
+        }
+        case 8: {
+            // 3D Histogram on Sobel Magnitude, with bins of 8 each
+            int bins = 8;
+            extractSobelTextureVector(features, img, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_SOBEL_TEXTURE_FEATURE), imgPath, imageData, reset);
+            break;
+        }
+        case 9:{
+            //3D Histogram on Law's Filter Averaged, with bins of 8 each
+            int bins = 8;
+            extractLawsTextureVector(features, img, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_LAWS_FEATURE), imgPath, imageData, reset);
+            break;
+        }
+        case 10:{
+            // 3D Histogram on Gabor's Filter, with bins of 8 each
+            int bins = 8;
+            extractGaborTextureVector(features, img, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_GABOR_FEATURE), imgPath, imageData, reset);
+            break;
+        }
+        case 11:{
+            // 64-bit perceptual hash, stored as packed bits
+            uint64_t hash;
+            extractPerceptualHash(features, img, hash);
+            append_image_hash_csv(stagedFile(PHASH_FEATURE), imgPath, hash, reset);
+            break;
+        }
+        case 12:{
+            // HSV 3D Histogram with bins of 8 each
+            int bins = 8;
+            extractColorHistVector(img, COLOR_SPACE_HSV, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_HSV_FEATURE), imgPath, imageData, reset);
+            break;
+        }
+        case 13:{
+            // CIELab 3D Histogram with bins of 8 each
+            int bins = 8;
+            extractColorHistVector(img, COLOR_SPACE_LAB, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_LAB_FEATURE), imgPath, imageData, reset);
+            break;
+        }
+        case 14:{
+            // Opponent color 3D Histogram with bins of 8 each
+            int bins = 8;
+            extractColorHistVector(img, COLOR_SPACE_OPPONENT, bins, featureStorage(imageData, bins*bins*bins));
+            append_image_data_csv(stagedFile(HIST_OPPONENT_FEATURE), imgPath, imageData, reset);
+            break;
+        }
+        case 15:{
+            // ORB keypoints and descriptors, quantized into visual words once all images are read
+            extractOrbFeatures(features, img, ingest.orbKeypoints, context.keypoints, context.descriptors);
+            appendOrbFeatures(stagedFile(ORB_FEATURE), imgPath, context.keypoints, context.descriptors, reset);
+            break;
+        }
+        default:{
+            printf("Incorrect featureType input number");
+            exit(-1);
+            break;
+        }
+    }
+    return 0;
+}
+
+// A video frame kept for indexing, with its time in seconds
+struct Keyframe {
+    cv::Mat img;
+    double seconds;
+};
+
+// Decode a video, and push the frames where the scene changes to the queue.
+// Every ingest.frameStep-th frame is decoded and compared with the previous decoded one by
+// the histogram intersection distance of their 8-bin 3D histograms. The first frame is always kept.
+// cap - Opened video
+// ingest - Ingestion options
+// queue - Queue of kept frames, closed at the end of the video
+// numSampled - Number of frames compared
+static void decodeKeyframes(cv::VideoCapture &cap, const IngestOptions &ingest,
+                            BoundedQueue<Keyframe> &queue, int &numSampled){
+    int step = std::max(1, ingest.frameStep);
+    double fps = cap.get(cv::CAP_PROP_FPS);
+    cv::Mat frame;
+    std::vector<float> prevHist, hist;
+    numSampled = 0;
+    for (long index = 0; cap.grab(); index++){
+        if (index % step != 0) continue;
+        if (!cap.retrieve(frame) || frame.empty()) break;
+        numSampled++;
+        
+        hist.clear();
+        extract3DHistVector(frame, 8, hist);
+        bool changed = prevHist.empty() || histIntersectionNormalized(prevHist, hist) >= ingest.sceneThreshold;
+        prevHist.swap(hist);
+        if (!changed) continue;
+        
+        double ms = cap.get(cv::CAP_PROP_POS_MSEC);
+        double seconds = (ms > 0 || fps <= 0) ? ms/1000.0 : index/fps;
+        queue.push(Keyframe{frame.clone(), seconds});
+    }
+    queue.close();
+}
+
+// Index the keyframes of a video. Decoding and scene-change detection run on their own thread,
+// while the calling thread extracts the features of the frames kept.
+// Each frame is keyed as `videoPath#seconds`.
+// context - Extractor context and feature storage of the calling thread
+// videoPath - Path of the video
+// featureType - Feature type, ranging from 1 to 15
+// ingest - Ingestion options
+// iter - Number of rows written so far, the csv files are erased when it is 0
+static int appendVideoFeatures(IngestContext &context, char *videoPath, int featureType,
+                               const IngestOptions &ingest, int &iter){
+    cv::VideoCapture cap(videoPath);
+    if (!cap.isOpened()){
+        printf("Unable to open video file %s\n", videoPath);
+        return -1;
+    }
+    
+    BoundedQueue<Keyframe> queue(8);
+    int numSampled = 0;
+    std::thread decoder(decodeKeyframes, std::ref(cap), std::cref(ingest), std::ref(queue), std::ref(numSampled));
+    
+    int numKept = 0;
+    char seconds[32];
+    for (Keyframe kf; queue.pop(kf); ){
+        snprintf(seconds, sizeof(seconds), "#%.3f", kf.seconds);
+        std::string key = std::string(videoPath) + seconds;
+        int reset = (iter == 0) ? 1 : 0;
+        appendImageFeatures(context, kf.img, &key[0], featureType, ingest, reset);
+        iter+=1;
+        numKept++;
+    }
+    decoder.join();
+    printf("indexed %d keyframes of %d sampled frames\n", numKept, numSampled);
+    return 0;
+}
+
+// Load the image of a feature file key: an image path,
+// or `path#seconds` for the frame of a video at that time
+// key - Image path or video keyframe key
+cv::Mat loadKeyImage(const char *key){
+    const char *hash = strrchr(key, '#');
+    std::string path(key, hash ? hash - key : strlen(key));
+    if (!hash || !isVideoFile(path.c_str())) return cv::imread(key);
+    
+    cv::Mat frame;
+    cv::VideoCapture cap(path);
+    if (cap.isOpened()){
+        cap.set(cv::CAP_PROP_POS_MSEC, atof(hash + 1)*1000.0);
+        cap.read(frame);
+    }
+    return frame;
+}
+
+// Crawls imgDir recursively, or the files of ingest.manifest,
+// compute feature vectors (according to featureType) of every image found
+// and store them in csv files. Images are processed as the crawl finds them.
+// The csv files are written under a temporary name and renamed into place at the end,
+// so they can be rewritten while queries read them.
+// With ingest.video, the keyframes of every video are indexed too, keyed as `path#seconds`.
+// For featureType 15, the bag-of-words index is built from the keypoints of all images at the end.
+// imgDir - image Directory, ignored with ingest.manifest
+// featureType - Feature type, ranging from 1 to 15
+// ingest - Ingestion options
+int createFeatureVector(char *imgDir, int featureType, const IngestOptions &ingest){
+    std::vector<std::string> roots;
+    if (ingest.manifest) printf("Processing manifest %s\n", ingest.manifest);
+    else {
+        printf("Processing directory %s\n", imgDir);
+        struct stat st;
+        if (stat(imgDir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            printf("Cannot open directory %s\n", imgDir);
+            exit(-1);
+        }
+        roots.push_back(imgDir);
+    }
+    
+    // The crawl runs on its own threads, while this thread extracts the features of the files found
+    CrawlOptions crawl;
+    crawl.videos = ingest.video;
+    crawl.numThreads = ingest.crawlThreads;
+    crawl.cacheFile = CRAWL_CACHE;
+    CrawlStats stats;
+    BoundedQueue<CrawlItem> queue(1024);
+    std::thread crawler(crawlImages, std::cref(roots), ingest.manifest, std::cref(crawl), std::ref(queue), std::ref(stats));
+    
+    IngestContext context;
+    int iter = 0;
+    for (CrawlItem item; queue.pop(item); ){
+        if (item.video){
+            printf("processing video file: %s\n", item.path.c_str());
+            appendVideoFeatures(context, &item.path[0], featureType, ingest, iter);
+            continue;
+        }
+        printf("processing image file: %s\n", item.path.c_str());
+        cv::Mat img = imread(item.path, cv::IMREAD_COLOR);
+        if (img.empty()){
+            printf("Unable to read image file %s\n", item.path.c_str());
+            continue;
+        }
+        
+        // Reset/Erase a file if it was the first iteration
+        int reset = (iter == 0) ? 1 : 0;
+        appendImageFeatures(context, img, &item.path[0], featureType, ingest, reset);
+        iter+=1;
+    }
+    crawler.join();
+    printf("crawled %ld directories (%ld unchanged since the last crawl), found %ld files\n",
+           stats.directories, stats.unchanged, stats.files);
+    
+    if (featureType == 15 && iter > 0){
+        BowIndex bowIndex;
+        if (bowIndex.build(stagedFile(ORB_FEATURE), ingest.vocabularySize, ingest.orbKeypoints) != 0 ||
+            bowIndex.save(stagedFile(BOW_INDEX)) != 0) {
+            printf("Unable to build the bag-of-words index\n");
+            exit(-1);
+        }
+        printf("bag-of-words index: %d images, %d visual words\n", bowIndex.size(), bowIndex.words());
+    }
+    return publishStagedFiles();
+}
+
+// Set up the feature files, weights and distance metric of a featureType,
+// without extracting any features
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// query - Query with one (empty) vector per feature file
+int featurePlan(int featureType,
+                int matchingMethod,
+                Query &query
+                ){
+    std::vector<char *> &csvVec = query.csvFiles;
+    std::vector<double> &weightVec = query.weights;
+    float(*&distanceMetric)(const float *, const float *, int) = query.distanceMetric;
+    csvVec.clear();
+    weightVec.clear();
+    query.sqrtTransform = 0;
+    
+    switch(matchingMethod) {
+        case 1:{
+            distanceMetric = &sumSquared;
+            break;
+        }
+        case 2: {
+            distanceMetric = &histIntersectionNormalized;
+            break;
+        }
+        case 3: {
+            // Hellinger: sum of squared differences of the square-rooted features
+            distanceMetric = &sumSquared;
+            query.sqrtTransform = 1;
+            break;
+        }
+        case 4: {
+            // Bhattacharyya: dot product of the square-rooted features
+            distanceMetric = &bhattacharyyaSqrt;
+            query.sqrtTransform = 1;
+            break;
+        }
+        case 5: {
+            distanceMetric = &chiSquare;
+            break;
+        }
+        default:{
+            printf("Incorrect matchingMethod input number");
+            exit(-1);
+        }
+    }
+    
+    switch (featureType) {
+        case 1:{
+            // The middle 9x9 pixels
+            csvVec.push_back(MIDDLE_FEATURE);
+            weightVec.push_back(1.0);
+            break;
+        }
+        case 2:{
+            // 3D Histogram with bins of 8 each
+            csvVec.push_back(HIST_FEATURE);
+            weightVec.push_back(1.0);
+            break;
+        }
+        case 3:{
+            // Split image to top and bottom
+            // 3D Histogram with bins of 8 each
+            csvVec.push_back(HIST_UPPERHALF_FEATURE);
+            csvVec.push_back(HIST_LOWERHALF_FEATURE);
+            weightVec.push_back(0.5);
+            weightVec.push_back(0.5);
+            break;
+        }
+        case 4:{
+            // 3D Histogram with bins of 8 each +
+            // 3D Histogram of Sobel Magnitude with bins of 8 each
+            csvVec.push_back(HIST_FEATURE);
+            csvVec.push_back(HIST_SOBEL_TEXTURE_FEATURE);
+            weightVec.push_back(0.5);
+            weightVec.push_back(0.5);
+            break;
+        }
+        case 5:{
+            // Only use the middle 100x100 and 50x50 pixels
+            // 3D Histogram with bins of 8 each
+            // 3D Histogram of Gobar Filter with bins of 8 each
+            csvVec.push_back(HIST_MIDDLE_MED_FEATURE);
+            csvVec.push_back(HIST_MIDDLE_MED_GABOR_FEATURE);
+            csvVec.push_back(HIST_MIDDLE_SMALL_FEATURE);
+            csvVec.push_back(HIST_MIDDLE_SMALL_GABOR_FEATURE);
+            weightVec.push_back(0.1);
+            weightVec.push_back(0.05);
+            weightVec.push_back(0.65);
+            weightVec.push_back(0.2);
+            break;
+        }
+        case 6: {
+            // 3D SOFT Histogram with bins of 8 each, and softWidth of 5
+            csvVec.push_back(HIST_SOFT_FEATURE);
+            weightVec.push_back(1.0);
+            break;
+        }
+        case 7:{
+            // 3D Histogram with bins of 8 each +
+            // 3D Histogram on Law's Filter Averaged, with bins of 8 each
+            csvVec.push_back(HIST_FEATURE);
+            csvVec.push_back(HIST_LAWS_FEATURE);
+            weightVec.push_back(0.5);
+            weightVec.push_back(0.5);
+            break;
+        }
+        case 8:{
+            // 3D Histogram of Sobel Magnitude with bins of 8 each
+            csvVec.push_back(HIST_SOBEL_TEXTURE_FEATURE);
+            weightVec.push_back(1.0);
+            break;
+        }
+        case 9:{
+            // 3D Histogram on Law's Filter Averaged, with bins of 8 each
+            csvVec.push_back(HIST_LAWS_FEATURE);
+            weightVec.push_back(1.0);
+            break;
+        }
+        case 10:{
+            // 3D Histogram of Gabor's Filter with bins of 8 each
+            csvVec.push_back(HIST_GABOR_FEATURE);
+            weightVec.push_back(1.0);
+            break;
+        }
+        case 12:{
+            // HSV 3D Histogram with bins of 8 each
+            csvVec.push_back(HIST_HSV_FEATURE);
+            weightVec.push_back(1.0);
+            break;
+        }
+        case 13:{
+            // CIELab 3D Histogram with bins of 8 each
+            csvVec.push_back(HIST_LAB_FEATURE);
+            weightVec.push_back(1.0);
+            break;
+        }
+        case 14:{
+            // Opponent color 3D Histogram with bins of 8 each
+            csvVec.push_back(HIST_OPPONENT_FEATURE);
+            weightVec.push_back(1.0);
+            break;
+        }
+        default:{
+            printf("Incorrect featureType input number");
+            exit(-1);
+        }
+    }
+    
+    query.vectors.assign(csvVec.size(), std::vector<float>());
+    return 0;
+}
+
+// Extract the query features of a target image, one vector per feature file of featureType
+// targetImg - Target Image to be matched to
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// imageDataVec - Query features, one vector per feature file
+int extractQueryFeatures(cv::Mat &targetImg,
+                         int featureType,
+                         std::vector<std::vector<float>> &imageDataVec
+                         ){
+    for (std::vector<float> &v : imageDataVec) v.clear();
+    
+    switch (featureType) {
+        case 1:{
+            // The middle 9x9 pixels
+            extractMiddleVector(targetImg, 9, 9, imageDataVec[0]);
+            break;
+        }
+        case 2:{
+            // 3D Histogram with bins of 8 each
+            int bins = 8;
+            extract3DHistVector(targetImg, bins, imageDataVec[0]);
+            break;
+        }
+        case 3:{
+            // Split image to top and bottom
+            // 3D Histogram with bins of 8 each
+            int bins = 8;
+            cv::Rect upperHalf(0, 0, targetImg.cols-1, (targetImg.rows-1)/2);
+            cv::Rect lowerHalf(0, targetImg.rows/2+1, targetImg.cols-1, (targetImg.rows-1)/2);
+            cv::Mat upperImg = targetImg(upperHalf);
+            cv::Mat lowerImg = targetImg(lowerHalf);
+            
+            extract3DHistVector(upperImg, bins, imageDataVec[0]);
+            extract3DHistVector(lowerImg, bins, imageDataVec[1]);
+            break;
+        }
+        case 4:{
+            // 3D Histogram with bins of 8 each +
+            // 3D Histogram of Sobel Magnitude with bins of 8 each
+            int bins = 8;
+            extract3DHistVector(targetImg, bins, imageDataVec[0]);
+            extractSobelTextureVector(targetImg, bins, imageDataVec[1]);
+            break;
+        }
+        case 5:{
+            // Only use the middle 100x100 and 50x50 pixels
+            // 3D Histogram with bins of 8 each
+            // 3D Histogram of Gobar Filter with bins of 8 each
+            int bins = 8;
+            int midRow = (targetImg.rows%2 == 0)? targetImg.rows/2 : targetImg.rows/2+1;
+            int midCol = (targetImg.cols%2 == 0)? targetImg.cols/2 : targetImg.cols/2+1;
+            int sizeMid = 100;
+            int sizeSmall = 50;
+            
+            cv::Rect middle(midCol-sizeMid/2, midRow-sizeMid/2, sizeMid, sizeMid);
+            cv::Rect smaller(midCol-sizeSmall/2, midRow-sizeSmall/2, sizeSmall, sizeSmall);
+            
+            cv::Mat middleImg = targetImg(middle);
+            cv::Mat smallerImg = targetImg(smaller);
+            
+            extract3DHistVector(middleImg, bins, imageDataVec[0]);
+            extractGaborTextureVector(middleImg, bins, imageDataVec[1]);
+            extract3DHistVector(smallerImg, bins, imageDataVec[2]);
+            extractGaborTextureVector(smallerImg, bins, imageDataVec[3]);
+            break;
+        }
+        case 6: {
+            // 3D SOFT Histogram with bins of 8 each, and softWidth of 5
+            int bins = 8;
+            int softWidth = 5;
+            extract3DSoftHistVector(targetImg, bins, softWidth, imageDataVec[0]);
+            break;
+        }
+        case 7:{
+            // 3D Histogram with bins of 8 each +
+            // 3D Histogram on Law's Filter Averaged, with bins of 8 each
+            int bins = 8;
+            extract3DHistVector(targetImg, bins, imageDataVec[0]);
+            extractLawsTextureVector(targetImg, bins, imageDataVec[1]);
+            break;
+        }
+        case 8:{
+            // 3D Histogram of Sobel Magnitude with bins of 8 each
+            int bins = 8;
+            extractSobelTextureVector(targetImg, bins, imageDataVec[0]);
+            break;
+        }
+        case 9:{
+            // 3D Histogram on Law's Filter Averaged, with bins of 8 each
+            int bins = 8;
+            extractLawsTextureVector(targetImg, bins, imageDataVec[0]);
+            break;
+        }
+        case 10:{
+            // 3D Histogram of Gabor's Filter with bins of 8 each
+            int bins = 8;
+            extractGaborTextureVector(targetImg, bins, imageDataVec[0]);
+            break;
+        }
+        case 12:{
+            // HSV 3D Histogram with bins of 8 each
+            int bins = 8;
+            extractColorHistVector(targetImg, COLOR_SPACE_HSV, bins, imageDataVec[0]);
+            break;
+        }
+        case 13:{
+            // CIELab 3D Histogram with bins of 8 each
+            int bins = 8;
+            extractColorHistVector(targetImg, COLOR_SPACE_LAB, bins, imageDataVec[0]);
+            break;
+        }
+        case 14:{
+            // Opponent color 3D Histogram with bins of 8 each
+            int bins = 8;
+            extractColorHistVector(targetImg, COLOR_SPACE_OPPONENT, bins, imageDataVec[0]);
+            break;
+        }
+        default:{
+            printf("Incorrect featureType input number");
+            exit(-1);
+        }
+    }
+    return 0;
+}
+
+// Extract the query features of a target image, and set up the feature files,
+// weights and distance metric they are matched with
+// targetImg - Target Image to be matched to
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// query - Query features, one vector per feature file
+int buildQuery(cv::Mat &targetImg,
+               int featureType,
+               int matchingMethod,
+               Query &query
+               ){
+    featurePlan(featureType, matchingMethod, query);
+    extractQueryFeatures(targetImg, featureType, query.vectors);
+    return transformQueryVectors(query);
+}
+
+// Apply the transform of the matching method to extracted query features,
+// the same transform loadDatabases applies to the feature databases
+// query - Query whose vectors were filled by extractQueryFeatures
+int transformQueryVectors(Query &query){
+    if (query.sqrtTransform){
+        for (std::vector<float> &v : query.vectors) sqrtFeatures(v.data(), (int)v.size());
+    }
+    return 0;
+}
+
+// Load the feature databases of a query
+// All feature files of a query list the images in the same order.
+// query - Query built by buildQuery
+// databases - Feature databases, one per feature file. Loaded from the feature files if empty.
+int loadDatabases(Query &query, std::vector<FeatureDatabase> &databases){
+    if (databases.empty()){
+        databases.resize(query.csvFiles.size());
+        for (int i = 0; i<query.csvFiles.size(); i++){
+            if (databases[i].load(query.csvFiles[i]) != 0) exit(-1);
+            if (query.sqrtTransform) databases[i].sqrtRows();
+        }
+    }
+    for (int i = 0; i<query.csvFiles.size(); i++){
+        if ((!query.vectors[i].empty() && databases[i].dims() != (int)query.vectors[i].size()) ||
+            databases[i].size() != databases[0].size()) {
+            printf("Feature file %s does not match the target image features\n", query.csvFiles[i]);
+            exit(-1);
+        }
+    }
+    return 0;
+}
+
+// Weighted distance between a query and one row of the databases.
+// Each weighted term is rounded to float and the terms are summed in float, as in exactTopK,
+// so re-ranked distances and their ties are identical to those of the exact search.
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// row - Row index
+float queryDistance(Query &query, std::vector<FeatureDatabase> &databases, int row){
+    float total = 0;
+    for (int i = 0; i<databases.size(); i++){
+        DistanceMetric metric = specializeDistanceMetric(query.distanceMetric, databases[i].dims());
+        float distance = query.weights[i] * metric(query.vectors[i].data(), databases[i].row(row), databases[i].dims());
+        total = i == 0 ? distance : total + distance;
+    }
+    return total;
+}
+
+// Find the K most similar images given a target image.
+// targetImg - Target Image to be matched to
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// k - Number of top matching images to be returned
+// databases - Feature databases of featureType, one per feature file.
+//             Loaded from the feature files if empty, so they can be reused across queries.
+// topKIndices - Row indices (into any of the databases) of the top K matching images
+// pool - Threads of the scan, or NULL to scan on the calling thread
+int knn(cv::Mat &targetImg,
+        int featureType,
+        int matchingMethod,
+        int k,
+        std::vector<FeatureDatabase> &databases,
+        std::vector<int> &topKIndices,
+        ThreadPool *pool
+        ){
+    Query query;
+    buildQuery(targetImg, featureType, matchingMethod, query);
+    loadDatabases(query, databases);
+    std::vector<std::pair<float, int>> topK;
+    exactTopK(query, databases, k, topK, pool);
+    for (std::pair<float, int> &t : topK) topKIndices.push_back(t.second);
+    return 0;
+}
+
+// Print clusters of near-duplicate images, and optionally write all pairs to a CSV file
+// clusters - Clusters of row indices
+// pairs - Near-duplicate pairs of row indices
+// path - Image path of a row index
+// pairsFile - CSV file for the pairs (pathA,pathB,distance), or NULL
+template <typename PathFn>
+static int writeDuplicates(std::vector<std::vector<int>> &clusters, std::vector<JoinPair> &pairs, PathFn path, const char *pairsFile){
+    for (int c = 0; c<clusters.size(); c++){
+        printf("cluster %d (%lu images):", c+1, clusters[c].size());
+        for (int idx : clusters[c]) printf(" %s", path(idx));
+        printf("\n");
+    }
+    
+    if (pairsFile){
+        FILE *fp = fopen(pairsFile, "w");
+        if (!fp){
+            printf("Unable to open output file %s\n", pairsFile);
+            return -1;
+        }
+        for (JoinPair &p : pairs){
+            fprintf(fp, "%s,%s,%.4f\n", path(p.a), path(p.b), p.distance);
+        }
+        fclose(fp);
+    }
+    return 0;
+}
+
+// Near-duplicate detection: print every cluster of images whose pairwise
+// weighted distance is within threshold, and optionally write all pairs to a CSV file
+// featureType - Feature Type, ranging from 1 - 14
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// threshold - Maximum weighted distance of a near-duplicate pair, or maximum Hamming distance for featureType 11
+// numThreads - Number of worker threads, 0 uses one per core
+// pairsFile - CSV file for the pairs (pathA,pathB,distance), or NULL
+int findDuplicates(int featureType,
+                   int matchingMethod,
+                   float threshold,
+                   int numThreads,
+                   const char *pairsFile
+                   ){
+    std::vector<JoinPair> pairs;
+    std::vector<std::vector<int>> clusters;
+    
+    if (featureType == 15){
+        printf("Near-duplicate detection does not support featureType 15\n");
+        return -1;
+    }
+    if (featureType == 11){
+        HashIndex hashIndex;
+        if (hashIndex.load(PHASH_FEATURE) != 0) exit(-1);
+        auto start = std::chrono::steady_clock::now();
+        hashIndex.selfJoin((int)threshold, numThreads, pairs);
+        joinClusters(hashIndex.size(), pairs, clusters);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Found %lu near-duplicate pairs in %lu clusters among %d images in %.2f s\n",
+               pairs.size(), clusters.size(), hashIndex.size(), seconds);
+        return writeDuplicates(clusters, pairs, [&](int i){ return hashIndex.path(i); }, pairsFile);
+    }
+    
+    Query query;
+    std::vector<FeatureDatabase> databases;
+    featurePlan(featureType, matchingMethod, query);
+    loadDatabases(query, databases);
+    
+    auto start = std::chrono::steady_clock::now();
+    selfJoin(databases, query.weights, query.distanceMetric, threshold, 16, 4, numThreads, pairs);
+    joinClusters(databases[0].size(), pairs, clusters);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Found %lu near-duplicate pairs in %lu clusters among %d images in %.2f s\n",
+           pairs.size(), clusters.size(), databases[0].size(), seconds);
+    return writeDuplicates(clusters, pairs, [&](int i){ return databases[0].path(i); }, pairsFile);
+}
+
+
+// Parse an ingestion option into ingest. The ingestion options are
+//  --video - also index the keyframes of the videos in the image directory
+//  --frame-step=S - consider every S-th decoded video frame, default 5
+//  --scene-threshold=T - keep a considered frame if its histogram intersection distance to the
+//                        previous considered frame is at least T, default 0.2. 0 keeps every considered frame
+//  --keypoints=P - number of ORB keypoints extracted per image for featureType 15, default 500
+//  --words=W - number of visual words of the featureType 15 vocabulary, default 1000
+//  --manifest=FILE - index the files listed in FILE, one path per line, instead of the image directory.
+//                    Listed directories are crawled
+//  --crawl-threads=T - number of threads crawling the directories, default one per core
+// Returns 1 if arg is an ingestion option, 0 if it is not, and -1 if its value is invalid
+// arg - command line argument
+// ingest - Ingestion options
+int parseIngestOption(const char *arg, IngestOptions &ingest){
+    const char *value;
+    if (strcmp(arg, "--video") == 0) ingest.video = 1;
+    else if ((value = optionValue(arg, "--frame-step"))) ingest.frameStep = atoi(value);
+    else if ((value = optionValue(arg, "--scene-threshold"))) ingest.sceneThreshold = atof(value);
+    else if ((value = optionValue(arg, "--keypoints"))) ingest.orbKeypoints = atoi(value);
+    else if ((value = optionValue(arg, "--words"))) ingest.vocabularySize = atoi(value);
+    else if ((value = optionValue(arg, "--manifest"))) ingest.manifest = value;
+    else if ((value = optionValue(arg, "--crawl-threads"))) ingest.crawlThreads = atoi(value);
+    else return 0;
+    if (ingest.frameStep < 1) {
+        printf("--frame-step must be at least 1\n");
+        return -1;
+    }
+    if (ingest.orbKeypoints < 1 || ingest.vocabularySize < 2) {
+        printf("--keypoints must be at least 1 and --words at least 2\n");
+        return -1;
+    }
+    return 1;
+}
+
+// Return the value of a `--name=value` command line option, or NULL if arg is a different option
+// arg - command line argument
+// name - option name, including the leading dashes
+const char *optionValue(const char *arg, const char *name){
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=') return NULL;
+    return arg + len + 1;
+}
+
+// Parse a search option into options. The search options are
+//  --search=exact|pca|ivfpq|stream|anytime|vptree|twostage - exact search (default), PCA shortlist or IVF-PQ shortlist
+//                                    with exact re-ranking, exact search streaming the feature files instead of loading them,
+//                                    exact comparisons in IVF cluster order until the time budget runs out,
+//                                    exact search of a vantage-point tree, or shortlist by the --coarse features
+//                                    ranked by the features of the featureType, extracted for the shortlist only
+//  --pca-dims=D - number of PCA components, positive, default 48
+//  --shortlist=S - number of candidates re-ranked exactly, or ranked by the full features of the two-stage search,
+//                  default 20 times K
+//  --lists=L - number of IVF-PQ inverted lists, default sqrt(number of images)
+//  --code-bytes=M - IVF-PQ code bytes per image, default 32
+//  --probes=P - number of IVF-PQ lists probed per query, default 8
+//  --prefilter=R - only rank images whose perceptual hash (featureType 11) is within Hamming distance R of the target's
+//  --threads=T - number of worker threads, default one per core
+//  --memory-mb=M - memory budget of the streaming search in megabytes, default 64
+//  --budget-ms=B - time budget of the anytime search per query in milliseconds, default 50
+//  --rerank=R - number of bag-of-words candidates (featureType 15) verified geometrically, default 0
+//  --coarse=F - featureType of the two-stage shortlist, 1 to 14 except 11, default 2
+// Returns 1 if arg is a search option, 0 if it is not, and -1 if its value is invalid
+// arg - command line argument
+// options - Search options
+int parseSearchOption(const char *arg, SearchOptions &options){
+    const char *value;
+    if ((value = optionValue(arg, "--search"))) {
+        if (strcmp(value, "exact") == 0) options.mode = SEARCH_EXACT;
+        else if (strcmp(value, "pca") == 0) options.mode = SEARCH_PCA;
+        else if (strcmp(value, "ivfpq") == 0) options.mode = SEARCH_IVFPQ;
+        else if (strcmp(value, "stream") == 0) options.mode = SEARCH_STREAM;
+        else if (strcmp(value, "anytime") == 0) options.mode = SEARCH_ANYTIME;
+        else if (strcmp(value, "vptree") == 0) options.mode = SEARCH_VPTREE;
+        else if (strcmp(value, "twostage") == 0) options.mode = SEARCH_TWO_STAGE;
+        else {
+            printf("Unknown search mode %s\n", value);
+            return -1;
+        }
+    }
+    else if ((value = optionValue(arg, "--pca-dims"))) {
+        options.pcaDims = atoi(value);
+        if (options.pcaDims <= 0) {
+            printf("The number of PCA components must be positive\n");
+            return -1;
+        }
+    }
+    else if ((value = optionValue(arg, "--shortlist"))) options.shortlist = atoi(value);
+    else if ((value = optionValue(arg, "--lists"))) options.numLists = atoi(value);
+    else if ((value = optionValue(arg, "--code-bytes"))) options.codeBytes = atoi(value);
+    else if ((value = optionValue(arg, "--probes"))) options.numProbes = atoi(value);
+    else if ((value = optionValue(arg, "--prefilter"))) options.prefilterRadius = atoi(value);
+    else if ((value = optionValue(arg, "--threads"))) options.numThreads = atoi(value);
+    else if ((value = optionValue(arg, "--memory-mb"))) options.memoryMB = std::max(1, atoi(value));
+    else if ((value = optionValue(arg, "--budget-ms"))) options.budgetMs = std::max(0, atoi(value));
+    else if ((value = optionValue(arg, "--rerank"))) options.rerank = std::max(0, atoi(value));
+    else if ((value = optionValue(arg, "--coarse"))) {
+        options.coarseFeature = atoi(value);
+        if (options.coarseFeature < 1 || options.coarseFeature > 14 || options.coarseFeature == 11) {
+            printf("The coarse feature type must be a stored feature vector, 1 to 14 except 11\n");
+            return -1;
+        }
+    }
+    else return 0;
+    return 1;
+}
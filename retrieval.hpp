@@ -0,0 +1,417 @@
+//
+//  retrieval.hpp
+//  Project2
+//
+//  Content-Based Image Retrieval
+//  Computing the feature files of an image directory with createFeatureVector(),
+//  and searching them with knn() and the approximate search modes.
+//  The search modes are implemented in search_*.cpp; search_index.hpp puts them behind one index.
+//
+
+#ifndef retrieval_hpp
+#define retrieval_hpp
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "util.hpp"
+#include "feature_db.hpp"
+
+// Indexes of the search modes, declared in their own headers
+class PcaIndex;
+class IvfPqIndex;
+class FeatureRows;
+class HashIndex;
+class VpTree;
+class FeatureCache;
+class ThreadPool;
+class LiveIndex;
+
+// Feature filenames
+extern char MIDDLE_FEATURE [];
+extern char HIST_FEATURE [];
+extern char HIST_UPPERHALF_FEATURE [];
+extern char HIST_LOWERHALF_FEATURE [];
+extern char HIST_SOBEL_TEXTURE_FEATURE [];
+extern char HIST_SOFT_FEATURE [];
+extern char HIST_LAWS_FEATURE [];
+extern char HIST_GABOR_FEATURE [];
+extern char HIST_MIDDLE_MED_FEATURE [];
+extern char HIST_MIDDLE_SMALL_FEATURE [];
+extern char HIST_MIDDLE_SMALL_GABOR_FEATURE [];
+extern char HIST_MIDDLE_MED_GABOR_FEATURE [];
+extern char PHASH_FEATURE [];
+extern char HIST_HSV_FEATURE [];
+extern char HIST_LAB_FEATURE [];
+extern char HIST_OPPONENT_FEATURE [];
+extern char ORB_FEATURE [];
+extern char BOW_INDEX [];
+extern char CRAWL_CACHE [];
+
+// Query features of a target image, together with
+// the feature files, weights and distance metric they are matched with
+struct Query {
+    std::vector<char *> csvFiles;
+    std::vector<double> weights;
+    std::vector<std::vector<float>> vectors;
+    float(*distanceMetric)(const float *, const float *, int);
+    int sqrtTransform = 0; // the metric compares square-rooted features, in the query and the databases
+};
+
+// Search modes
+enum {
+    SEARCH_EXACT = 1, // compare the target to every image
+    SEARCH_PCA = 2,   // PCA shortlist with exact re-ranking
+    SEARCH_IVFPQ = 3, // IVF-PQ shortlist with exact re-ranking of the rows read from disk
+    SEARCH_STREAM = 4, // exact search reading the feature files block by block within a memory budget
+    SEARCH_ANYTIME = 5, // exact comparisons, nearest coarse clusters first, until a time budget runs out
+    SEARCH_VPTREE = 6, // exact search of a vantage-point tree, sum of squared differences metrics only
+    SEARCH_TWO_STAGE = 7 // shortlist by a cheap stored feature, rank the shortlist by features extracted on demand
+};
+
+// Options of openSearchIndex and searchIndex
+struct SearchOptions {
+    int mode = SEARCH_EXACT;
+    int pcaDims = 48;          // PCA components per feature file
+    int shortlist = 0;         // candidates re-ranked exactly, 0 is 20 times K
+    int numLists = 0;          // IVF-PQ inverted lists, 0 is sqrt(number of images)
+    int codeBytes = 32;        // IVF-PQ code bytes per image
+    int numProbes = 8;         // IVF-PQ lists probed per query
+    int prefilterRadius = -1;  // perceptual hash prefilter radius of the exact search, -1 is off
+    int numThreads = 0;        // worker threads, 0 is one per core
+    int memoryMB = 64;         // memory budget of the streaming search, in megabytes
+    int budgetMs = 50;         // time budget of the anytime search per query, in milliseconds
+    int rerank = 0;            // bag-of-words candidates verified geometrically, 0 is none
+    int coarseFeature = 2;     // stored feature type the two-stage search shortlists with
+    int rebuild = 0;           // rebuild saved indexes instead of loading them
+};
+
+// Options of createFeatureVector
+struct IngestOptions {
+    int video = 0;               // also index the keyframes of the videos in the directory
+    int frameStep = 5;           // consider every frameStep-th decoded video frame
+    float sceneThreshold = 0.2f; // keep a considered frame if its histogram intersection distance
+                                 // to the previous considered frame is at least this
+    int orbKeypoints = 500;      // ORB keypoints extracted per image, featureType 15
+    int vocabularySize = 1000;   // visual words of the bag-of-words vocabulary, featureType 15
+    const char *manifest = NULL; // file listing the paths to index instead of the image directory
+    int crawlThreads = 0;        // threads crawling the directories, 0 is one per core
+};
+
+// Crawls imgDir recursively, or the files of ingest.manifest,
+// compute feature vectors (according to featureType) of every image found
+// and store them in csv files. Images are processed as the crawl finds them.
+// The csv files are written under a temporary name and renamed into place at the end,
+// so they can be rewritten while queries read them.
+// With ingest.video, the keyframes of every video are indexed too, keyed as `path#seconds`.
+// imgDir - image Directory, ignored with ingest.manifest
+// featureType - Feature type, ranging from 1 to 15
+// ingest - Ingestion options
+int createFeatureVector(char *imgDir, int featureType, const IngestOptions &ingest = IngestOptions());
+
+// Load the image of a feature file key: an image path,
+// or `path#seconds` for the frame of a video at that time
+// key - Image path or video keyframe key
+cv::Mat loadKeyImage(const char *key);
+
+// Set up the feature files, weights and distance metric of a featureType,
+// without extracting any features
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// query - Query with one (empty) vector per feature file
+int featurePlan(int featureType, int matchingMethod, Query &query);
+
+// Extract the query features of a target image, one vector per feature file of featureType
+// targetImg - Target Image to be matched to
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// imageDataVec - Query features, one vector per feature file
+int extractQueryFeatures(cv::Mat &targetImg, int featureType, std::vector<std::vector<float>> &imageDataVec);
+
+// Apply the transform of the matching method to extracted query features,
+// the same transform loadDatabases applies to the feature databases
+// query - Query whose vectors were filled by extractQueryFeatures
+int transformQueryVectors(Query &query);
+
+// Extract the query features of a target image, and set up the feature files,
+// weights and distance metric they are matched with
+// targetImg - Target Image to be matched to
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// query - Query features, one vector per feature file
+int buildQuery(cv::Mat &targetImg, int featureType, int matchingMethod, Query &query);
+
+// Load the feature databases of a query
+// All feature files of a query list the images in the same order.
+// Freshly loaded features are transformed for the matching method of the query once, at load time.
+// query - Query built by buildQuery
+// databases - Feature databases, one per feature file. Loaded from the feature files if empty,
+//             otherwise they must have been loaded for the same matching method.
+int loadDatabases(Query &query, std::vector<FeatureDatabase> &databases);
+
+// Weighted distance between a query and one row of the databases
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// row - Row index
+float queryDistance(Query &query, std::vector<FeatureDatabase> &databases, int row);
+
+// Exact top K search: compare the query to every row of the databases
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// k - Number of top matching images to be returned
+// topK - (distance, row index) of the top K matching images, nearest first
+// pool - Threads scanning blocks of rows in parallel, or NULL to scan on the calling thread.
+//        The results are the same either way.
+int exactTopK(Query &query, std::vector<FeatureDatabase> &databases, int k, std::vector<std::pair<float, int>> &topK,
+              ThreadPool *pool = NULL);
+
+// Anytime top K search: compare the query to the rows of the databases list by list of an IVF index,
+// nearest coarse clusters first, and stop at the deadline with the best rows found so far.
+// The nearest list is always compared in full. Given the time to visit every list,
+// the results are the same as those of exactTopK.
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// ivfIndex - IVF-PQ index of the first database; only its coarse clusters are used, to order the rows
+// deadline - Time at which the search returns
+// k - Number of top matching images to be returned
+// topK - (distance, row index) of the top K matching images found, nearest first
+// coverage - Set to the fraction of the rows compared, 1 if the search completed
+// pool - Threads visiting lists in parallel, or NULL to visit them on the calling thread
+int anytimeTopK(Query &query, std::vector<FeatureDatabase> &databases, IvfPqIndex &ivfIndex,
+                std::chrono::steady_clock::time_point deadline, int k,
+                std::vector<std::pair<float, int>> &topK, float &coverage, ThreadPool *pool = NULL);
+
+// Exact top K search of a batch of queries. With the sum of squared differences metric (matchingMethods 1 and 3)
+// the queries are scored together by batchSumSquaredTopK, otherwise one at a time by exactTopK.
+// queries - Queries built by buildQuery, all for the same featureType and matchingMethod
+// databases - Feature databases loaded by loadDatabases
+// k - Number of top matching images to be returned per query
+// topK - (distance, row index) of the top K matching images of every query, nearest first
+// pool - Threads of the scan, or NULL to scan on the calling thread
+int batchExactTopK(std::vector<Query> &queries, std::vector<FeatureDatabase> &databases, int k,
+                   std::vector<std::vector<std::pair<float, int>>> &topK, ThreadPool *pool = NULL);
+
+// Find the K most similar images given a target image.
+// targetImg - Target Image to be matched to
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// k - Number of top matching images to be returned
+// databases - Feature databases of featureType, one per feature file.
+//             Loaded from the feature files if empty, so they can be reused across queries.
+// topKIndices - Row indices (into any of the databases) of the top K matching images
+// pool - Threads of the scan, or NULL to scan on the calling thread
+int knn(cv::Mat &targetImg,
+        int featureType,
+        int matchingMethod,
+        int k,
+        std::vector<FeatureDatabase> &databases,
+        std::vector<int> &topKIndices,
+        ThreadPool *pool = NULL
+        );
+
+// Load the PCA index of every feature database from <feature file>.pca,
+// or train, project and save it if the file is missing, stale or rebuild is set
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// components - number of principal components per database
+// rebuild - always rebuild the indexes
+// pcaIndexes - PCA indexes, one per database
+int loadPcaIndexes(Query &query, std::vector<FeatureDatabase> &databases, int components, int rebuild,
+                   std::vector<PcaIndex> &pcaIndexes);
+
+// PCA shortlist search: rank every row by the weighted squared distance between
+// PCA projections, then re-rank the shortlistSize best rows with the exact distance
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// pcaIndexes - PCA indexes loaded by loadPcaIndexes
+// k - Number of top matching images to be returned
+// shortlistSize - Number of candidates re-ranked with the exact distance
+// topK - (distance, row index) of the top K matching images, nearest first
+int pcaTopK(Query &query, std::vector<FeatureDatabase> &databases, std::vector<PcaIndex> &pcaIndexes,
+            int k, int shortlistSize, std::vector<std::pair<float, int>> &topK);
+
+// Report recall@K of pcaTopK against exactTopK for increasing shortlist sizes.
+// Evenly spaced database rows are used as the queries.
+// query - Query built by buildQuery, provides the weights and distance metric
+// databases - Feature databases loaded by loadDatabases
+// pcaIndexes - PCA indexes loaded by loadPcaIndexes
+// k - K of recall@K
+// numQueries - number of sample queries
+int reportPcaRecall(Query &query, std::vector<FeatureDatabase> &databases, std::vector<PcaIndex> &pcaIndexes,
+                    int k, int numQueries);
+
+// Load the IVF-PQ index of every feature database from <feature file>.ivfpq,
+// or train, build and save it if the file is missing, rebuild is set, or it was built
+// from another version of the feature file or with other numbers of lists or code bytes
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// numLists - number of inverted lists, 0 picks sqrt(number of images)
+// numSubspaces - number of PQ subspaces, i.e. code bytes per image
+// rebuild - always rebuild the indexes
+// ivfIndexes - IVF-PQ indexes, one per database
+int loadIvfPqIndexes(Query &query, std::vector<FeatureDatabase> &databases, int numLists, int numSubspaces,
+                     int rebuild, std::vector<IvfPqIndex> &ivfIndexes);
+
+// Open the feature files of a query for the IVF-PQ search without loading their feature vectors:
+// load the IVF-PQ index of every file from <feature file>.ivfpq and its row table from <feature file>.rows.
+// A file whose index or table is missing, stale or to be rebuilt is loaded while they are built and saved.
+// query - Query built by buildQuery
+// numLists - number of inverted lists, 0 picks sqrt(number of images)
+// numSubspaces - number of PQ subspaces, i.e. code bytes per image
+// rebuild - always rebuild the indexes
+// ivfIndexes - IVF-PQ indexes, one per feature file
+// rows - Row tables, one per feature file, to read the rows of the shortlist from
+int openIvfPqFiles(Query &query, int numLists, int numSubspaces, int rebuild, std::vector<IvfPqIndex> &ivfIndexes,
+                   std::vector<FeatureRows> &rows);
+
+// Load the vantage-point tree of the feature databases from <first feature file>.vpt,
+// or build and save it if the file is missing, was built for other features or weights, or rebuild is set
+// query - Query built by buildQuery, with the sum of squared differences metric
+// databases - Feature databases loaded by loadDatabases
+// rebuild - always rebuild the tree
+// tree - Vantage-point tree
+// pool - Threads computing the distances of the build, or NULL
+int loadVpTree(Query &query, std::vector<FeatureDatabase> &databases, int rebuild, VpTree &tree, ThreadPool *pool);
+
+// Two-stage top K search: shortlist the shortlistSize nearest rows by the coarse features,
+// then rank the shortlist by the features of featureType. Those are taken from the cache,
+// or extracted from the decoded candidate images in parallel and added to the cache.
+// Candidates whose image cannot be read are left out.
+// query - Query built by buildQuery for featureType
+// coarseQuery - Query built by buildQuery for the coarse feature type
+// coarseDatabases - Feature databases of the coarse query, loaded by loadDatabases
+// featureType - Feature Type of query, ranging from 1 - 14, except 11
+// cache - Feature cache opened with the dims of the vectors of query
+// k - Number of top matching images to be returned
+// shortlistSize - Number of candidates ranked by the features of featureType
+// topK - (distance, row index into coarseDatabases) of the top K matching images, nearest first
+// numExtracted - Set to the number of candidates whose features were extracted
+// pool - Threads of the shortlist scan and of the extraction, or NULL
+int twoStageTopK(Query &query, Query &coarseQuery, std::vector<FeatureDatabase> &coarseDatabases, int featureType,
+                 FeatureCache &cache, int k, int shortlistSize, std::vector<std::pair<float, int>> &topK,
+                 int &numExtracted, ThreadPool *pool = NULL);
+
+// IVF-PQ search: collect the shortlistSize approximate nearest rows of every
+// feature file, then re-rank their union with the exact distance. Only the rows of the shortlist
+// are read from the feature files; distances are summed as in exactTopK.
+// query - Query built by buildQuery
+// ivfIndexes - IVF-PQ indexes opened by openIvfPqFiles
+// rows - Row tables opened by openIvfPqFiles
+// k - Number of top matching images to be returned
+// numProbes - Number of inverted lists visited per feature file
+// shortlistSize - Number of candidates per feature file re-ranked with the exact distance
+// topK - (distance, row index) of the top K matching images, nearest first
+// pool - Threads reading the shortlist, or NULL to read it on the calling thread
+int ivfPqTopK(Query &query, std::vector<IvfPqIndex> &ivfIndexes, std::vector<FeatureRows> &rows,
+              int k, int numProbes, int shortlistSize, std::vector<std::pair<float, int>> &topK,
+              ThreadPool *pool = NULL);
+
+// Report recall@K of ivfPqTopK against exactTopK for increasing numbers of probed lists.
+// Evenly spaced database rows are used as the queries.
+// query - Query built by buildQuery, provides the weights and distance metric
+// databases - Feature databases loaded by loadDatabases, for the exact search
+// ivfIndexes - IVF-PQ indexes opened by openIvfPqFiles
+// rows - Row tables opened by openIvfPqFiles
+// k - K of recall@K
+// shortlistSize - Number of candidates per database re-ranked with the exact distance
+// numQueries - number of sample queries
+int reportIvfPqRecall(Query &query, std::vector<FeatureDatabase> &databases, std::vector<IvfPqIndex> &ivfIndexes,
+                      std::vector<FeatureRows> &rows, int k, int shortlistSize, int numQueries);
+
+// Exact top K search restricted to the images whose perceptual hash
+// is within Hamming distance radius of the target image's hash
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// hashIndex - Perceptual hashes of the images, loaded from PHASH_FEATURE
+// rowOfPath - Row of every image path of the databases; the hash file and the feature files
+//             may list the images in different orders
+// targetHash - Perceptual hash of the target image
+// radius - Maximum Hamming distance of a candidate
+// k - Number of top matching images to be returned
+// topK - (distance, row index) of the top K matching images, nearest first
+int prefilteredTopK(Query &query, std::vector<FeatureDatabase> &databases, HashIndex &hashIndex,
+                    const std::unordered_map<std::string, int> &rowOfPath, uint64_t targetHash, int radius, int k, std::vector<std::pair<float, int>> &topK);
+
+// Streaming exact top K search: read the feature files block by block, in lockstep,
+// instead of loading them, so memory stays within memoryBytes however many images there are.
+// The next block of every file is read in the background while the current one is compared to the query.
+// query - Query built by buildQuery
+// memoryBytes - Memory budget of the read buffers and parsed rows
+// k - Number of top matching images to be returned
+// topK - (distance, row index) of the top K matching images, nearest first. Same as exactTopK.
+// topPaths - Image paths of the rows in topK
+int streamTopK(Query &query, size_t memoryBytes, int k, std::vector<std::pair<float, int>> &topK,
+               std::unordered_map<int, std::string> &topPaths);
+
+// Load the feature files of a featureType into a live index, as its first segment
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// plan - Set to the feature files, weights and distance metric of the index
+// live - Live index
+int openLiveIndex(int featureType, int matchingMethod, Query &plan, LiveIndex &live);
+
+// Extract the features of an image and stage them for insertion into a live index.
+// They become visible to queries at the next live.commit().
+// live - Live index opened by openLiveIndex
+// plan - Plan set by openLiveIndex
+// featureType - Feature Type of the index
+// img - Image
+// path - Image path, its key in the index
+int liveInsertImage(LiveIndex &live, Query &plan, int featureType, cv::Mat &img, const char *path);
+
+// Find the top K matches of a target image in the current snapshot of a live index.
+// Inserts, deletes and merges running meanwhile do not affect the result.
+// live - Live index opened by openLiveIndex
+// plan - Plan set by openLiveIndex
+// featureType - Feature Type of the index
+// targetImg - Target Image to be matched to
+// k - Number of top matching images to be returned
+// topK - (distance, image path) of the top K matching images, nearest first
+int liveSearch(LiveIndex &live, Query &plan, int featureType, cv::Mat &targetImg, int k,
+               std::vector<std::pair<float, std::string>> &topK);
+
+// Serve queries on a live index of the feature files of a featureType while images are added and removed.
+// Commands are read from in, one per line: `add PATH`, `remove PATH`, `query PATH`, which writes the
+// top K matches as `target,rank,path,distance` CSV lines, and `sync`, which waits until the adds and removes
+// read so far are visible to the queries. Adds and removes are committed by a writer thread and merged
+// in the background; queries are answered from the current snapshot without waiting for them.
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// k - Number of top matching images to be returned per query
+// in - Commands
+// outputFile - File the query results are written to, - for stdout
+int serveLiveIndex(int featureType, int matchingMethod, int k, std::istream &in, const char *outputFile);
+
+// Near-duplicate detection: print every cluster of images whose pairwise
+// weighted distance is within threshold, and optionally write all pairs to a CSV file
+// featureType - Feature Type, ranging from 1 - 14
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// threshold - Maximum weighted distance of a near-duplicate pair, or maximum Hamming distance for featureType 11
+// numThreads - Number of worker threads, 0 uses one per core
+// pairsFile - CSV file for the pairs (pathA,pathB,distance), or NULL
+int findDuplicates(int featureType, int matchingMethod, float threshold, int numThreads, const char *pairsFile);
+
+// Parse an ingestion option (--video, --frame-step, --scene-threshold, --keypoints, --words,
+// --manifest or --crawl-threads) into ingest.
+// Returns 1 if arg is an ingestion option, 0 if it is not, and -1 if its value is invalid
+// arg - command line argument
+// ingest - Ingestion options
+int parseIngestOption(const char *arg, IngestOptions &ingest);
+
+// Return the value of a `--name=value` command line option, or NULL if arg is a different option
+// arg - command line argument
+// name - option name, including the leading dashes
+const char *optionValue(const char *arg, const char *name);
+
+// Parse a search option (--search, --pca-dims, --shortlist, --lists, --code-bytes,
+// --probes, --prefilter, --threads, --memory-mb, --budget-ms, --rerank or --coarse) into options.
+// Returns 1 if arg is a search option, 0 if it is not, and -1 if its value is invalid
+// arg - command line argument
+// options - Search options
+int parseSearchOption(const char *arg, SearchOptions &options);
+
+#endif /* retrieval_hpp */
@@ -0,0 +1,315 @@
+//
+//  search_exact.cpp
+//  Project2
+//
+//  Exact top K searches: the parallel scan of the loaded feature databases, the batched scan,
+//  the scan restricted by the perceptual hash prefilter, the streaming scan of the feature files,
+//  and the vantage-point tree the exact search can descend instead.
+//
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+#include <queue>
+#include <string>
+#include <unordered_map>
+
+#include "csv_util.hpp"
+#include "util.hpp"
+#include "retrieval.hpp"
+#include "batch_ssd.hpp"
+#include "hash_index.hpp"
+#include "thread_pool.hpp"
+#include "vp_tree.hpp"
+
+// Exact top K search split into blocks of rows that fit in the L2 cache, scanned by the threads
+// of a pool. Each thread keeps the top K of the blocks it scanned, and the top K of the threads are merged.
+// Every row distance is summed in the same order as in the serial scan, and (distance, row) pairs
+// are ranked the same way, so the results are identical.
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// k - Number of top matching images to be returned
+// topK - (distance, row index) of the top K matching images, nearest first
+// pool - Threads of the scan
+static int parallelTopK(Query &query,
+                        std::vector<FeatureDatabase> &databases,
+                        int k,
+                        std::vector<std::pair<float, int>> &topK,
+                        ThreadPool &pool
+                        ){
+    int numRows = databases[0].size();
+    k = std::min(k, numRows);
+    if (k <= 0) return 0;
+    
+    std::vector<DistanceMetric> metrics(databases.size());
+    size_t rowBytes = 0;
+    for (int i = 0; i<databases.size(); i++){
+        metrics[i] = specializeDistanceMetric(query.distanceMetric, databases[i].dims());
+        rowBytes += databases[i].stride()*sizeof(float);
+    }
+    const size_t blockBytes = 256*1024;
+    int blockRows = (int)std::max((size_t)64, blockBytes/std::max(rowBytes, (size_t)1));
+    int numBlocks = (numRows + blockRows - 1)/blockRows;
+    
+    // Max-heap per thread, the worst of its top K on top
+    std::vector<std::priority_queue<std::pair<float, int>>> best(pool.size());
+    pool.run(numBlocks, [&](int block, int worker){
+        std::priority_queue<std::pair<float, int>> &heap = best[worker];
+        int end = std::min(numRows, (block+1)*blockRows);
+        for (int j = block*blockRows; j < end; j++){
+            float total = 0;
+            for (int i = 0; i<databases.size(); i++){
+                const FeatureDatabase &db = databases[i];
+                float distance = query.weights[i] * metrics[i](query.vectors[i].data(), db.row(j), db.dims());
+                total = i == 0 ? distance : total + distance;
+            }
+            std::pair<float, int> candidate(total, j);
+            if ((int)heap.size() < k) heap.push(candidate);
+            else if (candidate < heap.top()){
+                heap.pop();
+                heap.push(candidate);
+            }
+        }
+    });
+    
+    std::vector<std::pair<float, int>> merged;
+    for (std::priority_queue<std::pair<float, int>> &heap : best){
+        for (; !heap.empty(); heap.pop()) merged.push_back(heap.top());
+    }
+    std::partial_sort(merged.begin(), merged.begin()+k, merged.end());
+    topK.insert(topK.end(), merged.begin(), merged.begin()+k);
+    return 0;
+}
+
+// Exact top K search: compare the query to every row of the databases
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// k - Number of top matching images to be returned
+// topK - (distance, row index) of the top K matching images, nearest first
+// pool - Threads scanning blocks of rows in parallel, or NULL to scan on the calling thread.
+//        The results are the same either way.
+int exactTopK(Query &query,
+              std::vector<FeatureDatabase> &databases,
+              int k,
+              std::vector<std::pair<float, int>> &topK,
+              ThreadPool *pool
+              ){
+    if (pool && pool->size() > 1) return parallelTopK(query, databases, k, topK, *pool);
+    
+    std::vector<double> &weightVec = query.weights;
+    std::vector<std::vector<float>> &imageDataVec = query.vectors;
+    
+    // Compute distance
+    // Loop through the databases, which have the same size as (populated) imageDataVec
+    int numRows = databases[0].size();
+    std::vector<std::pair<float, int>> distances(numRows);
+    for (int i = 0; i<databases.size(); i++){
+        const FeatureDatabase &db = databases[i];
+        DistanceMetric distanceMetric = specializeDistanceMetric(query.distanceMetric, db.dims());
+        
+        // For each database/imageData, Loop and compare to precompute Data
+        for(int j = 0; j < numRows; j++) {
+            float distance = weightVec[i] * distanceMetric(imageDataVec[i].data(), db.row(j), db.dims());
+            if (i==0){
+                distances[j] = std::pair<float, int>(distance, j);
+            } else {
+                distances[j].first += distance;
+            }
+        }
+    }
+
+    // Look for the top K (smallest distance)
+    k = std::min(k, numRows);
+    std::partial_sort(distances.begin(), distances.begin()+k, distances.end());
+    for (int i =0; i<k; i++){
+        topK.push_back(distances[i]);
+    }
+    
+    return 0;
+}
+
+// Exact top K search of a batch of queries. With the sum of squared differences metric
+// the queries are scored together by batchSumSquaredTopK, otherwise one at a time by exactTopK.
+// queries - Queries built by buildQuery, all for the same featureType and matchingMethod
+// databases - Feature databases loaded by loadDatabases
+// k - Number of top matching images to be returned per query
+// topK - (distance, row index) of the top K matching images of every query, nearest first
+// pool - Threads of the scan, or NULL to scan on the calling thread
+int batchExactTopK(std::vector<Query> &queries,
+                   std::vector<FeatureDatabase> &databases,
+                   int k,
+                   std::vector<std::vector<std::pair<float, int>>> &topK,
+                   ThreadPool *pool
+                   ){
+    float(*ssd)(const float *, const float *, int) = &sumSquared;
+    if (queries.empty() || queries[0].distanceMetric != ssd){
+        topK.assign(queries.size(), std::vector<std::pair<float, int>>());
+        for (int q = 0; q<queries.size(); q++) exactTopK(queries[q], databases, k, topK[q], pool);
+        return 0;
+    }
+    
+    // Pack the query vectors with the same padded stride as the databases
+    std::vector<FeatureDatabase> packed(databases.size());
+    for (int i = 0; i<databases.size(); i++){
+        packed[i].reset(databases[i].dims());
+        packed[i].reserve((int)queries.size());
+        for (Query &query : queries) packed[i].addRow("", query.vectors[i].data());
+    }
+    return batchSumSquaredTopK(packed, databases, queries[0].weights, k, pool, topK);
+}
+
+// Load the vantage-point tree of the feature databases from <first feature file>.vpt,
+// or build and save it if the file is missing, was built for other features or weights, or rebuild is set
+// query - Query built by buildQuery, with the sum of squared differences metric
+// databases - Feature databases loaded by loadDatabases
+// rebuild - always rebuild the tree
+// tree - Vantage-point tree
+// pool - Threads computing the distances of the build, or NULL
+int loadVpTree(Query &query,
+               std::vector<FeatureDatabase> &databases,
+               int rebuild,
+               VpTree &tree,
+               ThreadPool *pool
+               ){
+    std::string treeFile = std::string(query.csvFiles[0]) + (query.sqrtTransform ? ".sqrt.vpt" : ".vpt");
+    if (!rebuild && tree.load(treeFile.c_str()) == 0 && tree.matches(databases, query.weights)) return 0;
+    
+    printf("Building vantage-point tree %s\n", treeFile.c_str());
+    if (tree.build(databases, query.weights, pool) != 0){
+        printf("Unable to build vantage-point tree for %s\n", query.csvFiles[0]);
+        exit(-1);
+    }
+    tree.save(treeFile.c_str());
+    return 0;
+}
+
+// Exact top K search restricted to the images whose perceptual hash
+// is within Hamming distance radius of the target image's hash
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// hashIndex - Perceptual hashes of the images, loaded from PHASH_FEATURE
+// rowOfPath - Row of every image path of the databases; the hash file and the feature files
+//             may list the images in different orders
+// targetHash - Perceptual hash of the target image
+// radius - Maximum Hamming distance of a candidate
+// k - Number of top matching images to be returned
+// topK - (distance, row index) of the top K matching images, nearest first
+int prefilteredTopK(Query &query,
+                    std::vector<FeatureDatabase> &databases,
+                    HashIndex &hashIndex,
+                    const std::unordered_map<std::string, int> &rowOfPath,
+                    uint64_t targetHash,
+                    int radius,
+                    int k,
+                    std::vector<std::pair<float, int>> &topK
+                    ){
+    std::vector<std::pair<int, int>> matches;
+    hashIndex.radiusSearch(targetHash, radius, matches);
+    std::vector<std::pair<float, int>> candidates;
+    for (std::pair<int, int> &m : matches) {
+        auto it = rowOfPath.find(hashIndex.path(m.second));
+        if (it == rowOfPath.end()) continue;
+        candidates.push_back(std::pair<float, int>(queryDistance(query, databases, it->second), it->second));
+    }
+    printf("Perceptual hash prefilter kept %lu of %d images\n", candidates.size(), databases[0].size());
+    
+    k = std::min(k, (int)candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin()+k, candidates.end());
+    for (int i =0; i<k; i++){
+        topK.push_back(candidates[i]);
+    }
+    return 0;
+}
+
+// Streaming exact top K search: read the feature files block by block, in lockstep,
+// instead of loading them, so memory stays within memoryBytes however many images there are.
+// The next block of every file is read in the background while the current one is compared to the query.
+// query - Query built by buildQuery
+// memoryBytes - Memory budget of the read buffers and parsed rows
+// k - Number of top matching images to be returned
+// topK - (distance, row index) of the top K matching images, nearest first. Same as exactTopK.
+// topPaths - Image paths of the rows in topK
+int streamTopK(Query &query,
+               size_t memoryBytes,
+               int k,
+               std::vector<std::pair<float, int>> &topK,
+               std::unordered_map<int, std::string> &topPaths
+               ){
+    int numFiles = (int)query.csvFiles.size();
+    // Each file holds about six blocks at a time: the block being read, the block being parsed,
+    // the text carried over between them and the parsed rows, which can take twice the text
+    size_t blockBytes = memoryBytes / (6*numFiles);
+    std::vector<CsvStream> streams(numFiles);
+    std::vector<CsvChunk> chunks(numFiles);
+    std::vector<int> consumed(numFiles, 0);
+    std::vector<DistanceMetric> metrics(numFiles);
+    for (int i = 0; i<numFiles; i++){
+        if (open_image_data_csv_stream(query.csvFiles[i], blockBytes, streams[i]) != 0) exit(-1);
+    }
+    
+    // Max-heap of the top K so far, the worst match on top
+    std::priority_queue<std::pair<float, int>> best;
+    std::unordered_map<int, std::string> bestPaths;
+    int row = 0;
+    for (;;){
+        // Refill the files whose rows are used up, and compare the rows available in all of them
+        int available = INT_MAX;
+        int finished = 0;
+        for (int i = 0; i<numFiles; i++){
+            if (consumed[i] == (int)chunks[i].nameEnds.size()){
+                int n = read_image_data_csv_stream(streams[i], chunks[i]);
+                if (n < 0) exit(-1);
+                consumed[i] = 0;
+                if (n == 0) {
+                    finished++;
+                    continue;
+                }
+                if (streams[i].numFeatures != (int)query.vectors[i].size()) {
+                    printf("Feature file %s does not match the target image features\n", query.csvFiles[i]);
+                    exit(-1);
+                }
+                metrics[i] = specializeDistanceMetric(query.distanceMetric, streams[i].numFeatures);
+                if (query.sqrtTransform) sqrtFeatures(chunks[i].data.data(), (int)chunks[i].data.size());
+            }
+            available = std::min(available, (int)chunks[i].nameEnds.size() - consumed[i]);
+        }
+        if (finished == numFiles) break;
+        if (finished > 0) {
+            printf("Feature files of the query do not list the same images\n");
+            exit(-1);
+        }
+        
+        for (int r = 0; r<available; r++, row++){
+            float total = 0;
+            for (int i = 0; i<numFiles; i++){
+                int dims = streams[i].numFeatures;
+                const float *x = chunks[i].data.data() + (size_t)(consumed[i]+r)*dims;
+                float distance = query.weights[i] * metrics[i](query.vectors[i].data(), x, dims);
+                total = i == 0 ? distance : total + distance;
+            }
+            std::pair<float, int> candidate(total, row);
+            if ((int)best.size() < k || (k > 0 && candidate < best.top())){
+                if ((int)best.size() == k){
+                    bestPaths.erase(best.top().second);
+                    best.pop();
+                }
+                CsvChunk &names = chunks[0];
+                size_t idx = consumed[0] + r;
+                size_t start = idx == 0 ? 0 : names.nameEnds[idx-1];
+                bestPaths[row] = names.names.substr(start, names.nameEnds[idx] - start);
+                best.push(candidate);
+            }
+        }
+        for (int i = 0; i<numFiles; i++) consumed[i] += available;
+    }
+    for (int i = 0; i<numFiles; i++) close_image_data_csv_stream(streams[i]);
+    
+    size_t first = topK.size();
+    topK.resize(first + best.size());
+    for (size_t i = topK.size(); i > first; i--){
+        topK[i-1] = best.top();
+        best.pop();
+    }
+    topPaths.swap(bestPaths);
+    return 0;
+}
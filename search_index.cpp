@@ -0,0 +1,314 @@
+//
+//  search_index.cpp
+//  Project2
+//
+//  Search index of a featureType: opening the feature files and indexes of a search mode,
+//  dispatching queries to it, and writing the results.
+//
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "feature.hpp"
+#include "search_index.hpp"
+
+// Name of the feature cache of a featureType
+static std::string featureCacheFile(int featureType){
+    return "FeatureCache" + std::to_string(featureType) + ".bin";
+}
+
+// Open the feature files of a featureType for searching: load the feature databases,
+// and build or load the index of the search mode. Calling it again with another
+// search mode keeps what is already loaded.
+// The IVF-PQ search does not load the feature databases: it reads the rows of its shortlists from the feature files.
+// featureType - Feature Type, ranging from 1 - 15
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// options - Search options
+// index - Search index
+int openSearchIndex(int featureType,
+                    int matchingMethod,
+                    SearchOptions &options,
+                    SearchIndex &index
+                    ){
+    index.featureType = featureType;
+    if (featureType == 15){
+        if (index.bowIndex.size() == 0 && index.bowIndex.load(BOW_INDEX) != 0) exit(-1);
+        return 0;
+    }
+    if (featureType == 11 || options.prefilterRadius >= 0){
+        if (!index.hasHashes){
+            if (index.hashIndex.load(PHASH_FEATURE) != 0) exit(-1);
+            index.hasHashes = 1;
+        }
+        if (featureType == 11) return 0;
+    }
+    
+    if (index.query.csvFiles.empty()) featurePlan(featureType, matchingMethod, index.query);
+    if (options.mode == SEARCH_STREAM) return 0;
+    if (options.mode == SEARCH_TWO_STAGE){
+        // The feature cache is opened by the first search, once the dims of the features are known
+        if (index.coarseQuery.csvFiles.empty()){
+            index.coarseFeature = options.coarseFeature;
+            featurePlan(options.coarseFeature, matchingMethod, index.coarseQuery);
+            loadDatabases(index.coarseQuery, index.coarseDatabases);
+        }
+        if (!index.pool) index.pool.reset(new ThreadPool(options.numThreads));
+        return 0;
+    }
+    if (!index.pool) index.pool.reset(new ThreadPool(options.numThreads));
+    if (options.mode == SEARCH_IVFPQ){
+        // The feature vectors stay on disk, only the rows of the shortlist are read
+        if (index.featureRows.empty()){
+            openIvfPqFiles(index.query, options.numLists, options.codeBytes, options.rebuild, index.ivfIndexes, index.featureRows);
+        }
+        return 0;
+    }
+    loadDatabases(index.query, index.databases);
+    if (options.prefilterRadius >= 0 && index.rowOfPath.empty()){
+        for (int j = 0; j < index.databases[0].size(); j++) index.rowOfPath[index.databases[0].path(j)] = j;
+    }
+    if (options.mode == SEARCH_PCA && index.pcaIndexes.empty()){
+        loadPcaIndexes(index.query, index.databases, options.pcaDims, options.rebuild, index.pcaIndexes);
+    }
+    if (options.mode == SEARCH_ANYTIME && index.ivfIndexes.empty()){
+        loadIvfPqIndexes(index.query, index.databases, options.numLists, options.codeBytes, options.rebuild, index.ivfIndexes);
+    }
+    if (options.mode == SEARCH_VPTREE && index.vpTree.size() == 0){
+        float(*ssd)(const float *, const float *, int) = &sumSquared;
+        if (index.query.distanceMetric == ssd) loadVpTree(index.query, index.databases, options.rebuild, index.vpTree, index.pool.get());
+        else printf("The vantage-point tree needs a metric distance (matchingMethod 1 or 3), using the exact search\n");
+    }
+    return 0;
+}
+
+// Find the top K matches of a target image with the search mode of the options
+// index - Search index opened by openSearchIndex with the same search mode
+// targetImg - Target Image to be matched to, left unchanged
+// k - Number of top matching images to be returned
+// options - Search options
+// topK - (distance, row index) of the top K matching images, nearest first.
+//        searchResultPath gives the image path of a row.
+int searchIndex(SearchIndex &index,
+                cv::Mat &targetImg,
+                int k,
+                SearchOptions &options,
+                std::vector<std::pair<float, int>> &topK
+                ){
+    // The time budget of the anytime search covers the feature extraction too
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.budgetMs);
+    topK.clear();
+    index.resultPaths.clear();
+    index.coverage = 1;
+    index.vpTreeStats = VpTreeStats();
+    index.featuresExtracted = 0;
+    uint64_t targetHash = 0;
+    if (index.hasHashes) extractPerceptualHash(targetImg, targetHash);
+    if (index.featureType == 11){
+        std::vector<std::pair<int, int>> matches;
+        index.hashIndex.nearest(targetHash, k, matches);
+        for (std::pair<int, int> &m : matches) topK.push_back(std::pair<float, int>((float)m.first, m.second));
+        return 0;
+    }
+    if (index.featureType == 15){
+        std::vector<cv::KeyPoint> keypoints;
+        cv::Mat descriptors;
+        extractOrbFeatures(targetImg, index.bowIndex.keypointsPerImage(), keypoints, descriptors);
+        return index.bowIndex.search(keypoints, descriptors, k, options.rerank, topK);
+    }
+    
+    Query query = index.query;
+    cv::Mat img = targetImg;
+    extractQueryFeatures(img, index.featureType, query.vectors);
+    transformQueryVectors(query);
+    int shortlist = options.shortlist > 0 ? options.shortlist : 20*k;
+    switch (options.mode) {
+        case SEARCH_PCA:
+            return pcaTopK(query, index.databases, index.pcaIndexes, k, shortlist, topK);
+        case SEARCH_IVFPQ:
+            return ivfPqTopK(query, index.ivfIndexes, index.featureRows, k, options.numProbes, shortlist, topK, index.pool.get());
+        case SEARCH_STREAM:
+            return streamTopK(query, (size_t)options.memoryMB << 20, k, topK, index.resultPaths);
+        case SEARCH_ANYTIME:
+            return anytimeTopK(query, index.databases, index.ivfIndexes[0], deadline, k, topK, index.coverage, index.pool.get());
+        case SEARCH_VPTREE:
+            if (index.vpTree.size() == 0) return exactTopK(query, index.databases, k, topK, index.pool.get());
+            index.vpTree.search(index.databases, query.vectors, k, topK, index.vpTreeStats);
+            index.coverage = (float)index.vpTreeStats.distances / index.vpTree.size();
+            return 0;
+        case SEARCH_TWO_STAGE:{
+            if (!index.featureCache.isOpen()){
+                std::vector<int> dims;
+                for (std::vector<float> &v : query.vectors) dims.push_back((int)v.size());
+                index.featureCache.open(featureCacheFile(index.featureType).c_str(), dims);
+            }
+            Query coarseQuery = index.coarseQuery;
+            extractQueryFeatures(img, index.coarseFeature, coarseQuery.vectors);
+            transformQueryVectors(coarseQuery);
+            twoStageTopK(query, coarseQuery, index.coarseDatabases, index.featureType, index.featureCache,
+                         k, shortlist, topK, index.featuresExtracted, index.pool.get());
+            for (std::pair<float, int> &t : topK) index.resultPaths[t.second] = index.coarseDatabases[0].path(t.second);
+            int numRows = index.coarseDatabases[0].size();
+            index.coverage = numRows > 0 ? (float)std::min(std::max(shortlist, k), numRows) / numRows : 1;
+            return 0;
+        }
+        default:
+            if (options.prefilterRadius >= 0){
+                return prefilteredTopK(query, index.databases, index.hashIndex, index.rowOfPath, targetHash, options.prefilterRadius, k, topK);
+            }
+            return exactTopK(query, index.databases, k, topK, index.pool.get());
+    }
+}
+
+// Find the top K matches of a batch of target images with the search mode of the options.
+// The exact search without prefilter scores the whole batch at once with batchExactTopK;
+// the other search modes run searchIndex for every target.
+// index - Search index opened by openSearchIndex with the same search mode
+// targetImgs - Target Images to be matched to, left unchanged
+// k - Number of top matching images to be returned per target
+// options - Search options
+// topK - (distance, row index) of the top K matching images of every target, nearest first
+// topPaths - Image paths of the top K matching images of every target. The streaming and two-stage
+//            searches number their rows per target, so the paths are resolved after every search.
+int searchBatch(SearchIndex &index,
+                std::vector<cv::Mat> &targetImgs,
+                int k,
+                SearchOptions &options,
+                std::vector<std::vector<std::pair<float, int>>> &topK,
+                std::vector<std::vector<std::string>> &topPaths
+                ){
+    topK.assign(targetImgs.size(), std::vector<std::pair<float, int>>());
+    topPaths.assign(targetImgs.size(), std::vector<std::string>());
+    if (index.featureType == 11 || index.featureType == 15 || options.mode != SEARCH_EXACT || options.prefilterRadius >= 0){
+        for (int t = 0; t<targetImgs.size(); t++){
+            searchIndex(index, targetImgs[t], k, options, topK[t]);
+            for (std::pair<float, int> &r : topK[t]) topPaths[t].push_back(searchResultPath(index, r.second));
+        }
+        return 0;
+    }
+    
+    index.resultPaths.clear();
+    std::vector<Query> queries(targetImgs.size(), index.query);
+    for (int t = 0; t<targetImgs.size(); t++){
+        cv::Mat img = targetImgs[t];
+        extractQueryFeatures(img, index.featureType, queries[t].vectors);
+        transformQueryVectors(queries[t]);
+    }
+    batchExactTopK(queries, index.databases, k, topK, index.pool.get());
+    for (int t = 0; t<targetImgs.size(); t++){
+        for (std::pair<float, int> &r : topK[t]) topPaths[t].push_back(searchResultPath(index, r.second));
+    }
+    return 0;
+}
+
+// Image path of a row returned by searchIndex
+// index - Search index
+// row - Row index
+const char *searchResultPath(SearchIndex &index, int row){
+    if (index.featureType == 11) return index.hashIndex.path(row);
+    if (index.featureType == 15) return index.bowIndex.path(row);
+    auto it = index.resultPaths.find(row);
+    if (it != index.resultPaths.end()) return it->second.c_str();
+    if (index.databases.empty()) return index.featureRows[0].path(row);
+    return index.databases[0].path(row);
+}
+
+// Write a string as a JSON string literal
+// fp - Output file
+// str - String
+static void writeJsonString(FILE *fp, const char *str){
+    fputc('"', fp);
+    for (const char *c = str; *c; c++){
+        if (*c == '"' || *c == '\\') fprintf(fp, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20) fprintf(fp, "\\u%04x", *c);
+        else fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+// Write the results of a query to a file: JSON if the filename ends in .json,
+// CSV (rank,path,distance) otherwise, and CSV to stdout if the filename is "-"
+// filename - Output file
+// targetPath - Path of the target image
+// index - Search index the results come from
+// topK - Results of searchIndex
+int writeSearchResults(const char *filename,
+                       const char *targetPath,
+                       SearchIndex &index,
+                       std::vector<std::pair<float, int>> &topK
+                       ){
+    size_t len = strlen(filename);
+    bool json = len >= 5 && strcmp(filename + len - 5, ".json") == 0;
+    FILE *fp = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+    if (!fp){
+        printf("Unable to open output file %s\n", filename);
+        return -1;
+    }
+    
+    if (json){
+        fprintf(fp, "{\n  \"target\": ");
+        writeJsonString(fp, targetPath);
+        fprintf(fp, ",\n  \"results\": [");
+        for (int i = 0; i<topK.size(); i++){
+            fprintf(fp, "%s\n    {\"rank\": %d, \"path\": ", i ? "," : "", i+1);
+            writeJsonString(fp, searchResultPath(index, topK[i].second));
+            fprintf(fp, ", \"distance\": %.6f}", topK[i].first);
+        }
+        fprintf(fp, "\n  ]\n}\n");
+    } else {
+        fprintf(fp, "rank,path,distance\n");
+        for (int i = 0; i<topK.size(); i++){
+            fprintf(fp, "%d,%s,%.6f\n", i+1, searchResultPath(index, topK[i].second), topK[i].first);
+        }
+    }
+    if (fp != stdout) fclose(fp);
+    return 0;
+}
+
+// Write the results of a batch of queries to a file: a JSON array of {target, results} objects
+// if the filename ends in .json, CSV (target,rank,path,distance) otherwise, and CSV to stdout if the filename is "-"
+// filename - Output file
+// targetPaths - Paths of the target images
+// topK - Results of searchBatch
+// topPaths - Image paths of the results, from searchBatch
+int writeBatchResults(const char *filename,
+                      std::vector<std::string> &targetPaths,
+                      std::vector<std::vector<std::pair<float, int>>> &topK,
+                      std::vector<std::vector<std::string>> &topPaths
+                      ){
+    size_t len = strlen(filename);
+    bool json = len >= 5 && strcmp(filename + len - 5, ".json") == 0;
+    FILE *fp = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+    if (!fp){
+        printf("Unable to open output file %s\n", filename);
+        return -1;
+    }
+    
+    if (json){
+        fprintf(fp, "[");
+        for (int t = 0; t<topK.size(); t++){
+            fprintf(fp, "%s\n  {\"target\": ", t ? "," : "");
+            writeJsonString(fp, targetPaths[t].c_str());
+            fprintf(fp, ", \"results\": [");
+            for (int i = 0; i<topK[t].size(); i++){
+                fprintf(fp, "%s\n    {\"rank\": %d, \"path\": ", i ? "," : "", i+1);
+                writeJsonString(fp, topPaths[t][i].c_str());
+                fprintf(fp, ", \"distance\": %.6f}", topK[t][i].first);
+            }
+            fprintf(fp, "\n  ]}");
+        }
+        fprintf(fp, "\n]\n");
+    } else {
+        fprintf(fp, "target,rank,path,distance\n");
+        for (int t = 0; t<topK.size(); t++){
+            for (int i = 0; i<topK[t].size(); i++){
+                fprintf(fp, "%s,%d,%s,%.6f\n", targetPaths[t].c_str(), i+1, topPaths[t][i].c_str(), topK[t][i].first);
+            }
+        }
+    }
+    if (fp != stdout) fclose(fp);
+    return 0;
+}
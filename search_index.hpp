@@ -0,0 +1,116 @@
+//
+//  search_index.hpp
+//  Project2
+//
+//  Search index of a featureType: the feature databases and the indexes of the search modes,
+//  opened once and searched by target image with any of the modes.
+//
+
+#ifndef search_index_hpp
+#define search_index_hpp
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "retrieval.hpp"
+#include "pca_index.hpp"
+#include "ivfpq.hpp"
+#include "feature_rows.hpp"
+#include "hash_index.hpp"
+#include "bow_index.hpp"
+#include "vp_tree.hpp"
+#include "feature_cache.hpp"
+#include "thread_pool.hpp"
+
+// Feature databases of a featureType and the indexes of the search modes
+struct SearchIndex {
+    int featureType = 0;
+    Query query;
+    std::vector<FeatureDatabase> databases;
+    std::vector<PcaIndex> pcaIndexes;
+    std::vector<IvfPqIndex> ivfIndexes;
+    std::vector<FeatureRows> featureRows; // row tables of the feature files, the IVF-PQ search reads its shortlist
+                                          // from the files instead of loading the databases
+    HashIndex hashIndex;
+    int hasHashes = 0;
+    std::unordered_map<std::string, int> rowOfPath; // row of every image path of the databases, for the
+                                                    // perceptual hash prefilter
+    BowIndex bowIndex;                // bag of visual words of featureType 15
+    VpTree vpTree;                    // vantage-point tree of the databases, empty if the metric is not SSD
+    VpTreeStats vpTreeStats;          // nodes visited and rows compared by the last vantage-point tree search
+    std::unordered_map<int, std::string> resultPaths; // image paths of the rows found by the streaming
+                                                      // and two-stage searches
+    int coarseFeature = 0;            // feature type of the coarse databases
+    Query coarseQuery;                // plan of the coarse feature files of the two-stage search
+    std::vector<FeatureDatabase> coarseDatabases;
+    FeatureCache featureCache;        // features of featureType extracted by the two-stage search
+    int featuresExtracted = 0;        // shortlisted images whose features the last two-stage search extracted
+    std::unique_ptr<ThreadPool> pool; // worker threads of the exact search, reused across queries
+    float coverage = 1;               // fraction of the images compared by the last search; below 1 when
+                                      // the anytime search ran out of time
+};
+
+// Open the feature files of a featureType for searching: load the feature databases,
+// and build or load the index of the search mode. Calling it again with another
+// search mode keeps what is already loaded.
+// The IVF-PQ search does not load the feature databases: it reads the rows of its shortlists from the feature files.
+// The two-stage search only loads the feature files of options.coarseFeature; the features of featureType
+// are extracted for the shortlisted images and kept in FeatureCache<featureType>.bin for later queries.
+// featureType - Feature Type, ranging from 1 - 15
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// options - Search options
+// index - Search index
+int openSearchIndex(int featureType, int matchingMethod, SearchOptions &options, SearchIndex &index);
+
+// Find the top K matches of a target image with the search mode of the options
+// index - Search index opened by openSearchIndex with the same search mode
+// targetImg - Target Image to be matched to, left unchanged
+// k - Number of top matching images to be returned
+// options - Search options
+// topK - (distance, row index) of the top K matching images, nearest first.
+//        searchResultPath gives the image path of a row.
+int searchIndex(SearchIndex &index, cv::Mat &targetImg, int k, SearchOptions &options,
+                std::vector<std::pair<float, int>> &topK);
+
+// Find the top K matches of a batch of target images with the search mode of the options.
+// The exact search without prefilter scores the whole batch at once with batchExactTopK;
+// the other search modes run searchIndex for every target.
+// index - Search index opened by openSearchIndex with the same search mode
+// targetImgs - Target Images to be matched to, left unchanged
+// k - Number of top matching images to be returned per target
+// options - Search options
+// topK - (distance, row index) of the top K matching images of every target, nearest first
+// topPaths - Image paths of the top K matching images of every target. The streaming and two-stage
+//            searches number their rows per target, so the paths are resolved after every search.
+int searchBatch(SearchIndex &index, std::vector<cv::Mat> &targetImgs, int k, SearchOptions &options,
+                std::vector<std::vector<std::pair<float, int>>> &topK,
+                std::vector<std::vector<std::string>> &topPaths);
+
+// Image path of a row returned by searchIndex
+// index - Search index
+// row - Row index
+const char *searchResultPath(SearchIndex &index, int row);
+
+// Write the results of a query to a file: JSON if the filename ends in .json,
+// CSV (rank,path,distance) otherwise, and CSV to stdout if the filename is "-"
+// filename - Output file
+// targetPath - Path of the target image
+// index - Search index the results come from
+// topK - Results of searchIndex
+int writeSearchResults(const char *filename, const char *targetPath, SearchIndex &index,
+                       std::vector<std::pair<float, int>> &topK);
+
+// Write the results of a batch of queries to a file: a JSON array of {target, results} objects
+// if the filename ends in .json, CSV (target,rank,path,distance) otherwise, and CSV to stdout if the filename is "-"
+// filename - Output file
+// targetPaths - Paths of the target images
+// topK - Results of searchBatch
+// topPaths - Image paths of the results, from searchBatch
+int writeBatchResults(const char *filename, std::vector<std::string> &targetPaths,
+                      std::vector<std::vector<std::pair<float, int>>> &topK,
+                      std::vector<std::vector<std::string>> &topPaths);
+
+#endif /* search_index_hpp */
@@ -0,0 +1,265 @@
+//
+//  search_ivfpq.cpp
+//  Project2
+//
+//  IVF-PQ searches: the shortlist of product-quantized distances re-ranked with the rows
+//  read from the feature files, and the anytime search visiting the IVF lists nearest first.
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <queue>
+#include <string>
+
+#include "util.hpp"
+#include "retrieval.hpp"
+#include "ivfpq.hpp"
+#include "feature_rows.hpp"
+#include "thread_pool.hpp"
+
+// Anytime top K search: compare the query to the rows of the databases list by list of an IVF index,
+// nearest coarse clusters first, and stop at the deadline with the best rows found so far.
+// Lists are handed out to the threads nearest first; the deadline is checked every 256 rows.
+// The nearest list is always compared in full, so there are results even if the deadline has passed.
+// Distances are summed, and ties ranked, as in exactTopK, so a completed search gives the same results.
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// ivfIndex - IVF-PQ index of the first database; only its coarse clusters are used, to order the rows
+// deadline - Time at which the search returns
+// k - Number of top matching images to be returned
+// topK - (distance, row index) of the top K matching images found, nearest first
+// coverage - Set to the fraction of the rows compared, 1 if the search completed
+// pool - Threads visiting lists in parallel, or NULL to visit them on the calling thread
+int anytimeTopK(Query &query,
+                std::vector<FeatureDatabase> &databases,
+                IvfPqIndex &ivfIndex,
+                std::chrono::steady_clock::time_point deadline,
+                int k,
+                std::vector<std::pair<float, int>> &topK,
+                float &coverage,
+                ThreadPool *pool
+                ){
+    int numRows = databases[0].size();
+    coverage = 1;
+    k = std::min(k, numRows);
+    if (k <= 0) return 0;
+    if (ivfIndex.size() != numRows){
+        printf("The IVF-PQ index does not match the feature databases\n");
+        exit(-1);
+    }
+    
+    std::vector<DistanceMetric> metrics(databases.size());
+    for (int i = 0; i<databases.size(); i++){
+        metrics[i] = specializeDistanceMetric(query.distanceMetric, databases[i].dims());
+    }
+    std::vector<int> order;
+    ivfIndex.listOrder(query.vectors[0].data(), order);
+    
+    // Max-heap per thread, the worst of its top K on top
+    int numWorkers = pool ? pool->size() : 1;
+    std::vector<std::priority_queue<std::pair<float, int>>> best(numWorkers);
+    std::atomic<long> compared(0);
+    auto visit = [&](int task, int worker){
+        std::priority_queue<std::pair<float, int>> &heap = best[worker];
+        const std::vector<int> &rows = ivfIndex.listMembers(order[task]);
+        for (size_t r = 0; r < rows.size(); r++){
+            if (task > 0 && r % 256 == 0 && std::chrono::steady_clock::now() >= deadline){
+                compared += r;
+                return;
+            }
+            int j = rows[r];
+            float total = 0;
+            for (int i = 0; i<databases.size(); i++){
+                const FeatureDatabase &db = databases[i];
+                float distance = query.weights[i] * metrics[i](query.vectors[i].data(), db.row(j), db.dims());
+                total = i == 0 ? distance : total + distance;
+            }
+            std::pair<float, int> candidate(total, j);
+            if ((int)heap.size() < k) heap.push(candidate);
+            else if (candidate < heap.top()){
+                heap.pop();
+                heap.push(candidate);
+            }
+        }
+        compared += rows.size();
+    };
+    if (numWorkers > 1) pool->run((int)order.size(), visit);
+    else for (int task = 0; task < order.size(); task++) visit(task, 0);
+    
+    std::vector<std::pair<float, int>> merged;
+    for (std::priority_queue<std::pair<float, int>> &heap : best){
+        for (; !heap.empty(); heap.pop()) merged.push_back(heap.top());
+    }
+    int found = std::min(k, (int)merged.size());
+    std::partial_sort(merged.begin(), merged.begin()+found, merged.end());
+    topK.insert(topK.end(), merged.begin(), merged.begin()+found);
+    coverage = (float)compared / numRows;
+    return 0;
+}
+
+// Load the IVF-PQ index of every feature database from <feature file>.ivfpq,
+// or train, build and save it if the file is missing, rebuild is set, or it was built
+// from another version of the feature file or with other numbers of lists or code bytes
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// numLists - number of inverted lists, 0 picks sqrt(number of images)
+// numSubspaces - number of PQ subspaces, i.e. code bytes per image
+// rebuild - always rebuild the indexes
+// ivfIndexes - IVF-PQ indexes, one per database
+int loadIvfPqIndexes(Query &query,
+                     std::vector<FeatureDatabase> &databases,
+                     int numLists,
+                     int numSubspaces,
+                     int rebuild,
+                     std::vector<IvfPqIndex> &ivfIndexes
+                     ){
+    ivfIndexes.assign(databases.size(), IvfPqIndex());
+    for (int i = 0; i<databases.size(); i++){
+        std::string indexFile = std::string(query.csvFiles[i]) + (query.sqrtTransform ? ".sqrt.ivfpq" : ".ivfpq");
+        const FeatureDatabase &db = databases[i];
+        int lists = numLists > 0 ? numLists : std::max(1, (int)std::sqrt((double)db.size()));
+        int subspaces = std::min(numSubspaces, db.dims());
+        // The rows of a rewritten feature file can be in another order, so the index is keyed on the file stamp
+        if (!rebuild && ivfIndexes[i].load(indexFile.c_str()) == 0 && ivfIndexes[i].size() == db.size() &&
+            ivfIndexes[i].matches(db.fileStamp(), db.dims(), lists, subspaces)) continue;
+        
+        printf("Building IVF-PQ index %s: %d lists, %d bytes per image\n", indexFile.c_str(), lists, subspaces);
+        if (ivfIndexes[i].build(db, lists, subspaces) != 0){
+            printf("Unable to build IVF-PQ index for %s\n", query.csvFiles[i]);
+            exit(-1);
+        }
+        ivfIndexes[i].save(indexFile.c_str());
+    }
+    return 0;
+}
+
+// Open the feature files of a query for the IVF-PQ search without loading their feature vectors:
+// load the IVF-PQ index of every file from <feature file>.ivfpq and its row table from <feature file>.rows.
+// A file whose index or table is missing, stale or to be rebuilt is loaded while they are built and saved.
+// query - Query built by buildQuery
+// numLists - number of inverted lists, 0 picks sqrt(number of images)
+// numSubspaces - number of PQ subspaces, i.e. code bytes per image
+// rebuild - always rebuild the indexes
+// ivfIndexes - IVF-PQ indexes, one per feature file
+// rows - Row tables, one per feature file, to read the rows of the shortlist from
+int openIvfPqFiles(Query &query,
+                   int numLists,
+                   int numSubspaces,
+                   int rebuild,
+                   std::vector<IvfPqIndex> &ivfIndexes,
+                   std::vector<FeatureRows> &rows
+                   ){
+    ivfIndexes.assign(query.csvFiles.size(), IvfPqIndex());
+    rows.clear();
+    rows.resize(query.csvFiles.size());
+    for (int i = 0; i<query.csvFiles.size(); i++){
+        std::string indexFile = std::string(query.csvFiles[i]) + (query.sqrtTransform ? ".sqrt.ivfpq" : ".ivfpq");
+        // A feature file replaced while its index is built is opened again
+        for (int attempt = 0; ; attempt++){
+            if (rows[i].open(query.csvFiles[i]) != 0) exit(-1);
+            if (!rebuild && rows[i].isCurrent() && ivfIndexes[i].load(indexFile.c_str()) == 0){
+                int lists = numLists > 0 ? numLists : std::max(1, (int)std::sqrt((double)rows[i].size()));
+                int subspaces = std::min(numSubspaces, rows[i].dims());
+                if (ivfIndexes[i].size() == rows[i].size() &&
+                    ivfIndexes[i].matches(rows[i].fileStamp(), rows[i].dims(), lists, subspaces)) break;
+            }
+            
+            FeatureDatabase db;
+            std::vector<size_t> offsets;
+            if (db.load(query.csvFiles[i], 0, &offsets) != 0) exit(-1);
+            if (db.fileStamp() != rows[i].fileStamp()){
+                if (attempt < 2) continue;
+                printf("Feature file %s keeps changing while its index is built\n", query.csvFiles[i]);
+                exit(-1);
+            }
+            if (rows[i].build(db, offsets) != 0) exit(-1);
+            if (query.sqrtTransform) db.sqrtRows();
+            int lists = numLists > 0 ? numLists : std::max(1, (int)std::sqrt((double)db.size()));
+            int subspaces = std::min(numSubspaces, db.dims());
+            printf("Building IVF-PQ index %s: %d lists, %d bytes per image\n", indexFile.c_str(), lists, subspaces);
+            if (ivfIndexes[i].build(db, lists, subspaces) != 0){
+                printf("Unable to build IVF-PQ index for %s\n", query.csvFiles[i]);
+                exit(-1);
+            }
+            ivfIndexes[i].save(indexFile.c_str());
+            break;
+        }
+        if ((!query.vectors[i].empty() && rows[i].dims() != (int)query.vectors[i].size()) ||
+            rows[i].size() != rows[0].size()) {
+            printf("Feature file %s does not match the target image features\n", query.csvFiles[i]);
+            exit(-1);
+        }
+    }
+    return 0;
+}
+
+// IVF-PQ search: collect the shortlistSize approximate nearest rows of every
+// feature file, then re-rank their union with the exact distance. Only the rows of the shortlist
+// are read from the feature files, in parallel; distances are summed as in exactTopK.
+// query - Query built by buildQuery
+// ivfIndexes - IVF-PQ indexes opened by openIvfPqFiles
+// rows - Row tables opened by openIvfPqFiles
+// k - Number of top matching images to be returned
+// numProbes - Number of inverted lists visited per feature file
+// shortlistSize - Number of candidates per feature file re-ranked with the exact distance
+// topK - (distance, row index) of the top K matching images, nearest first
+// pool - Threads reading the shortlist, or NULL to read it on the calling thread
+int ivfPqTopK(Query &query,
+              std::vector<IvfPqIndex> &ivfIndexes,
+              std::vector<FeatureRows> &rows,
+              int k,
+              int numProbes,
+              int shortlistSize,
+              std::vector<std::pair<float, int>> &topK,
+              ThreadPool *pool
+              ){
+    int numFiles = (int)rows.size();
+    std::vector<int> shortlist;
+    std::vector<std::pair<float, int>> results;
+    for (int i = 0; i<numFiles; i++){
+        ivfIndexes[i].search(query.vectors[i].data(), std::max(shortlistSize, k), numProbes, results);
+        for (std::pair<float, int> &r : results) shortlist.push_back(r.second);
+    }
+    std::sort(shortlist.begin(), shortlist.end());
+    shortlist.erase(std::unique(shortlist.begin(), shortlist.end()), shortlist.end());
+    
+    // Re-rank the shortlist with the exact distance, reading its rows from disk.
+    // Rows that cannot be read are left out.
+    std::vector<DistanceMetric> metrics(numFiles);
+    for (int i = 0; i<numFiles; i++) metrics[i] = specializeDistanceMetric(query.distanceMetric, rows[i].dims());
+    int numWorkers = pool ? pool->size() : 1;
+    std::vector<std::vector<float>> buffers(numWorkers * numFiles);
+    for (int w = 0; w<numWorkers; w++){
+        for (int i = 0; i<numFiles; i++) buffers[w*numFiles + i].resize(rows[i].dims());
+    }
+    std::vector<std::pair<float, int>> candidates(shortlist.size());
+    auto rerank = [&](int c, int worker){
+        int row = shortlist[c];
+        float total = 0;
+        for (int i = 0; i<numFiles; i++){
+            float *x = buffers[worker*numFiles + i].data();
+            if (rows[i].read(row, x) != 0){
+                candidates[c] = std::pair<float, int>(0.0f, -1);
+                return;
+            }
+            if (query.sqrtTransform) sqrtFeatures(x, rows[i].dims());
+            float distance = query.weights[i] * metrics[i](query.vectors[i].data(), x, rows[i].dims());
+            total = i == 0 ? distance : total + distance;
+        }
+        candidates[c] = std::pair<float, int>(total, row);
+    };
+    if (pool) pool->run((int)shortlist.size(), rerank);
+    else for (int c = 0; c<shortlist.size(); c++) rerank(c, 0);
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                    [](const std::pair<float, int> &c){ return c.second < 0; }), candidates.end());
+    
+    k = std::min(k, (int)candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin()+k, candidates.end());
+    for (int i =0; i<k; i++){
+        topK.push_back(candidates[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+//
+//  search_live.cpp
+//  Project2
+//
+//  Live search: queries answered from snapshots of a LiveIndex while images are added and removed.
+//
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "retrieval.hpp"
+#include "live_index.hpp"
+
+// Load the feature files of a featureType into a live index, as its first segment
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// plan - Set to the feature files, weights and distance metric of the index
+// live - Live index
+int openLiveIndex(int featureType, int matchingMethod, Query &plan, LiveIndex &live){
+    if (featureType == 11 || featureType == 15) {
+        printf("The live index does not support featureType %d\n", featureType);
+        return -1;
+    }
+    featurePlan(featureType, matchingMethod, plan);
+    std::vector<FeatureDatabase> databases;
+    if (loadDatabases(plan, databases) != 0) return -1;
+    live.reset(std::move(databases));
+    return 0;
+}
+
+// Extract the features of an image and stage them for insertion into a live index.
+// They become visible to queries at the next live.commit().
+// live - Live index opened by openLiveIndex
+// plan - Plan set by openLiveIndex
+// featureType - Feature Type of the index
+// img - Image
+// path - Image path, its key in the index
+int liveInsertImage(LiveIndex &live, Query &plan, int featureType, cv::Mat &img, const char *path){
+    Query query = plan;
+    extractQueryFeatures(img, featureType, query.vectors);
+    transformQueryVectors(query);
+    return live.insert(path, query.vectors);
+}
+
+// Find the top K matches of a target image in the current snapshot of a live index.
+// Inserts, deletes and merges running meanwhile do not affect the result.
+// live - Live index opened by openLiveIndex
+// plan - Plan set by openLiveIndex
+// featureType - Feature Type of the index
+// targetImg - Target Image to be matched to
+// k - Number of top matching images to be returned
+// topK - (distance, image path) of the top K matching images, nearest first
+int liveSearch(LiveIndex &live, Query &plan, int featureType, cv::Mat &targetImg, int k,
+               std::vector<std::pair<float, std::string>> &topK){
+    Query query = plan;
+    extractQueryFeatures(targetImg, featureType, query.vectors);
+    transformQueryVectors(query);
+    std::shared_ptr<const LiveIndex::Snapshot> snap = live.snapshot();
+    return LiveIndex::search(*snap, query.vectors, query.weights, query.distanceMetric, k, topK);
+}
+
+// Adds and removes queued for the writer thread of serveLiveIndex
+struct LiveWrites {
+    std::mutex mutex;
+    std::condition_variable wake; // a command was queued, or closing was set
+    std::condition_variable idle; // the queue was emptied and committed
+    std::deque<std::pair<bool, std::string>> queue; // (add, image path)
+    bool busy = false;
+    bool closing = false;
+};
+
+// Apply the queued adds and removes to a live index, until closing is set and the queue is empty.
+// The staged changes are committed whenever the queue runs empty, and at least every maxStaged commands.
+// live - Live index opened by openLiveIndex
+// plan - Plan set by openLiveIndex
+// featureType - Feature Type of the index
+// writes - Queue of commands
+// maxStaged - Most commands staged between commits
+static void liveWriter(LiveIndex &live, Query &plan, int featureType, LiveWrites &writes, int maxStaged){
+    std::unique_lock<std::mutex> lock(writes.mutex);
+    for (;;){
+        writes.wake.wait(lock, [&]{ return writes.closing || !writes.queue.empty(); });
+        if (writes.queue.empty()) return;
+        writes.busy = true;
+        for (int staged = 0; staged < maxStaged && !writes.queue.empty(); staged++){
+            std::pair<bool, std::string> command = writes.queue.front();
+            writes.queue.pop_front();
+            lock.unlock();
+            const char *path = command.second.c_str();
+            if (!command.first) live.remove(path);
+            else {
+                cv::Mat img = loadKeyImage(path);
+                if (img.empty()) printf("Unable to read image %s\n", path);
+                else {
+                    // Removing the path first makes adding an indexed image replace its row
+                    live.remove(path);
+                    liveInsertImage(live, plan, featureType, img, path);
+                }
+            }
+            lock.lock();
+        }
+        lock.unlock();
+        live.commit();
+        lock.lock();
+        writes.busy = false;
+        writes.idle.notify_all();
+    }
+}
+
+// Serve queries on a live index of the feature files of a featureType while images are added and removed.
+// Commands are read from in, one per line:
+//  add PATH - extract the features of an image and add it to the index, replacing the row of PATH if there is one
+//  remove PATH - remove the row of PATH from the index
+//  query PATH - write the top K matches of an image as `target,rank,path,distance` CSV lines
+//  sync - wait until every add and remove read so far is visible to the queries
+// Adds and removes are applied by a writer thread, which commits them as a new segment whenever it runs out
+// of commands, and a background merger folds the segments together. Queries are answered on the reading
+// thread from the current snapshot, so they never wait for the writer or the merger.
+// featureType - Feature Type, ranging from 1 - 14, except 11
+// matchingMethod - matching method, ranging from 1 - 5. aka distance metric
+// k - Number of top matching images to be returned per query
+// in - Commands
+// outputFile - File the query results are written to, - for stdout
+int serveLiveIndex(int featureType, int matchingMethod, int k, std::istream &in, const char *outputFile){
+    Query plan;
+    LiveIndex live;
+    if (openLiveIndex(featureType, matchingMethod, plan, live) != 0) return -1;
+    FILE *fp = strcmp(outputFile, "-") == 0 ? stdout : fopen(outputFile, "w");
+    if (!fp){
+        printf("Unable to open output file %s\n", outputFile);
+        return -1;
+    }
+    fprintf(fp, "target,rank,path,distance\n");
+    fflush(fp);
+
+    live.startMerger();
+    LiveWrites writes;
+    std::thread writer(liveWriter, std::ref(live), std::ref(plan), featureType, std::ref(writes), 64);
+    for (std::string line; std::getline(in, line); ){
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        size_t space = line.find(' ');
+        std::string command = line.substr(0, space);
+        std::string path = space == std::string::npos ? "" : line.substr(space + 1);
+        if ((command == "add" || command == "remove") && !path.empty()){
+            std::lock_guard<std::mutex> lock(writes.mutex);
+            writes.queue.push_back(std::pair<bool, std::string>(command == "add", path));
+            writes.wake.notify_one();
+        }
+        else if (command == "query" && !path.empty()){
+            cv::Mat img = loadKeyImage(path.c_str());
+            if (img.empty()){
+                printf("Unable to read target image %s\n", path.c_str());
+                continue;
+            }
+            std::vector<std::pair<float, std::string>> topK;
+            liveSearch(live, plan, featureType, img, k, topK);
+            for (int i = 0; i<topK.size(); i++){
+                fprintf(fp, "%s,%d,%s,%.6f\n", path.c_str(), i+1, topK[i].second.c_str(), topK[i].first);
+            }
+            fflush(fp);
+        }
+        else if (command == "sync"){
+            std::unique_lock<std::mutex> lock(writes.mutex);
+            writes.idle.wait(lock, [&]{ return writes.queue.empty() && !writes.busy; });
+        }
+        else printf("Unknown command %s\n", line.c_str());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(writes.mutex);
+        writes.closing = true;
+    }
+    writes.wake.notify_one();
+    writer.join();
+    live.stopMerger();
+    if (fp != stdout) fclose(fp);
+    return 0;
+}
@@ -0,0 +1,85 @@
+//
+//  search_pca.cpp
+//  Project2
+//
+//  PCA shortlist search: rank the rows by their PCA projections, re-rank the shortlist exactly.
+//
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+
+#include "util.hpp"
+#include "retrieval.hpp"
+#include "pca_index.hpp"
+
+// Load the PCA index of every feature database from <feature file>.pca,
+// or train, project and save it if the file is missing, stale or rebuild is set
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// components - number of principal components per database
+// rebuild - always rebuild the indexes
+// pcaIndexes - PCA indexes, one per database
+int loadPcaIndexes(Query &query, std::vector<FeatureDatabase> &databases, int components, int rebuild,
+                   std::vector<PcaIndex> &pcaIndexes){
+    pcaIndexes.assign(databases.size(), PcaIndex());
+    for (int i = 0; i<databases.size(); i++){
+        std::string indexFile = std::string(query.csvFiles[i]) + (query.sqrtTransform ? ".sqrt.pca" : ".pca");
+        if (!rebuild && pcaIndexes[i].load(indexFile.c_str()) == 0 && pcaIndexes[i].matches(databases[i], components)) continue;
+        
+        printf("Building PCA index %s: %d components\n", indexFile.c_str(), components);
+        if (pcaIndexes[i].build(databases[i], components) != 0){
+            printf("Unable to build PCA index for an empty feature database\n");
+            exit(-1);
+        }
+        pcaIndexes[i].save(indexFile.c_str());
+    }
+    return 0;
+}
+
+// PCA shortlist search: rank every row by the weighted squared distance between
+// PCA projections, then re-rank the shortlistSize best rows with the exact distance
+// query - Query built by buildQuery
+// databases - Feature databases loaded by loadDatabases
+// pcaIndexes - PCA indexes loaded by loadPcaIndexes
+// k - Number of top matching images to be returned
+// shortlistSize - Number of candidates re-ranked with the exact distance
+// topK - (distance, row index) of the top K matching images, nearest first
+int pcaTopK(Query &query,
+            std::vector<FeatureDatabase> &databases,
+            std::vector<PcaIndex> &pcaIndexes,
+            int k,
+            int shortlistSize,
+            std::vector<std::pair<float, int>> &topK
+            ){
+    std::vector<std::vector<float>> projectedQuery(databases.size());
+    for (int i = 0; i<databases.size(); i++){
+        projectedQuery[i].resize(pcaIndexes[i].components());
+        pcaIndexes[i].project(query.vectors[i].data(), projectedQuery[i].data());
+    }
+    
+    // Shortlist by the distance in PCA space
+    int numRows = databases[0].size();
+    std::vector<std::pair<float, int>> candidates(numRows);
+    for (int j = 0; j < numRows; j++) {
+        float distance = 0;
+        for (int i = 0; i<databases.size(); i++){
+            distance += query.weights[i] * sumSquared(projectedQuery[i].data(), pcaIndexes[i].projected(j), pcaIndexes[i].components());
+        }
+        candidates[j] = std::pair<float, int>(distance, j);
+    }
+    shortlistSize = std::min(std::max(shortlistSize, k), numRows);
+    std::partial_sort(candidates.begin(), candidates.begin()+shortlistSize, candidates.end());
+    
+    // Re-rank the shortlist with the exact distance
+    candidates.resize(shortlistSize);
+    for (std::pair<float, int> &c : candidates) {
+        c.first = queryDistance(query, databases, c.second);
+    }
+    k = std::min(k, shortlistSize);
+    std::partial_sort(candidates.begin(), candidates.begin()+k, candidates.end());
+    for (int i =0; i<k; i++){
+        topK.push_back(candidates[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+//
+//  search_recall.cpp
+//  Project2
+//
+//  Recall reports of the approximate search modes against the exact search.
+//
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+
+#include "retrieval.hpp"
+#include "pca_index.hpp"
+#include "ivfpq.hpp"
+#include "feature_rows.hpp"
+
+// Use evenly spaced database rows as sample queries, and find their exact top K
+// query - Query built by buildQuery, provides the weights and distance metric
+// databases - Feature databases loaded by loadDatabases
+// k - Number of top matching images
+// numQueries - number of sample queries
+// samples - Sample queries
+// exact - Exact top K of each sample query
+static int sampleQueries(Query &query,
+                         std::vector<FeatureDatabase> &databases,
+                         int k,
+                         int numQueries,
+                         std::vector<Query> &samples,
+                         std::vector<std::vector<std::pair<float, int>>> &exact
+                         ){
+    int numRows = databases[0].size();
+    numQueries = std::min(numQueries, numRows);
+    samples.assign(numQueries, query);
+    for (int q = 0; q<numQueries; q++){
+        int row = (int)((long long)q*numRows/numQueries);
+        for (int i = 0; i<databases.size(); i++){
+            const float *src = databases[i].row(row);
+            samples[q].vectors[i].assign(src, src+databases[i].dims());
+        }
+    }
+    return batchExactTopK(samples, databases, k, exact);
+}
+
+// Return the number of exact results that are also in the approximate results
+// exact - Exact top K
+// approx - Approximate top K
+static int countHits(std::vector<std::pair<float, int>> &exact, std::vector<std::pair<float, int>> &approx){
+    int hits = 0;
+    for (std::pair<float, int> &a : approx) {
+        for (std::pair<float, int> &e : exact) hits += (e.second == a.second);
+    }
+    return hits;
+}
+
+// Report recall@K of pcaTopK against exactTopK for increasing shortlist sizes.
+// Evenly spaced database rows are used as the queries.
+// query - Query built by buildQuery, provides the weights and distance metric
+// databases - Feature databases loaded by loadDatabases
+// pcaIndexes - PCA indexes loaded by loadPcaIndexes
+// k - K of recall@K
+// numQueries - number of sample queries
+int reportPcaRecall(Query &query,
+                    std::vector<FeatureDatabase> &databases,
+                    std::vector<PcaIndex> &pcaIndexes,
+                    int k,
+                    int numQueries
+                    ){
+    std::vector<Query> samples;
+    std::vector<std::vector<std::pair<float, int>>> exact;
+    sampleQueries(query, databases, k, numQueries, samples, exact);
+    numQueries = (int)samples.size();
+    if (numQueries == 0) return 0;
+    
+    int numRows = databases[0].size();
+    printf("PCA recall@%d over %d queries\n", k, numQueries);
+    for (int shortlist = k; ; shortlist *= 2){
+        shortlist = std::min(shortlist, numRows);
+        double hits = 0, total = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int q = 0; q<numQueries; q++){
+            std::vector<std::pair<float, int>> approx;
+            pcaTopK(samples[q], databases, pcaIndexes, k, shortlist, approx);
+            hits += countHits(exact[q], approx);
+            total += exact[q].size();
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("  shortlist %7d  recall %.4f  %.3f ms/query\n", shortlist, hits/total, ms/numQueries);
+        if (shortlist == numRows) break;
+    }
+    return 0;
+}
+
+// Report recall@K of ivfPqTopK against exactTopK for increasing numbers of probed lists.
+// Evenly spaced database rows are used as the queries.
+// query - Query built by buildQuery, provides the weights and distance metric
+// databases - Feature databases loaded by loadDatabases, for the exact search
+// ivfIndexes - IVF-PQ indexes opened by openIvfPqFiles
+// rows - Row tables opened by openIvfPqFiles
+// k - K of recall@K
+// shortlistSize - Number of candidates per database re-ranked with the exact distance
+// numQueries - number of sample queries
+int reportIvfPqRecall(Query &query,
+                      std::vector<FeatureDatabase> &databases,
+                      std::vector<IvfPqIndex> &ivfIndexes,
+                      std::vector<FeatureRows> &rows,
+                      int k,
+                      int shortlistSize,
+                      int numQueries
+                      ){
+    std::vector<Query> samples;
+    std::vector<std::vector<std::pair<float, int>>> exact;
+    sampleQueries(query, databases, k, numQueries, samples, exact);
+    numQueries = (int)samples.size();
+    if (numQueries == 0) return 0;
+    
+    int numLists = ivfIndexes[0].lists();
+    printf("IVF-PQ recall@%d over %d queries, shortlist %d\n", k, numQueries, shortlistSize);
+    for (int probes = 1; ; probes *= 2){
+        probes = std::min(probes, numLists);
+        double hits = 0, total = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int q = 0; q<numQueries; q++){
+            std::vector<std::pair<float, int>> approx;
+            ivfPqTopK(samples[q], ivfIndexes, rows, k, probes, shortlistSize, approx);
+            hits += countHits(exact[q], approx);
+            total += exact[q].size();
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("  probes %5d  recall %.4f  %.3f ms/query\n", probes, hits/total, ms/numQueries);
+        if (probes == numLists) break;
+    }
+    return 0;
+}
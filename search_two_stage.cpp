@@ -0,0 +1,131 @@
+//
+//  search_two_stage.cpp
+//  Project2
+//
+//  Two-stage search: shortlist by a cheap stored feature, rank the shortlist by features
+//  extracted on demand and kept in a feature cache.
+//
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <sys/stat.h>
+
+#include "util.hpp"
+#include "retrieval.hpp"
+#include "crawler.hpp"
+#include "feature_cache.hpp"
+#include "thread_pool.hpp"
+
+// Modification time and size of the file of a feature file key, the video file of `path#seconds` keys
+// key - Image path or video keyframe key
+// mtime - Set to the modification time of the file in nanoseconds
+// fileSize - Set to the size of the file
+// Returns non-zero if the file cannot be found
+static int keyFileStamp(const char *key, int64_t &mtime, int64_t &fileSize){
+    const char *hash = strrchr(key, '#');
+    std::string path(key, hash ? hash - key : strlen(key));
+    if (!hash || !isVideoFile(path.c_str())) path = key;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return -1;
+    mtime = modificationTime(st);
+    fileSize = st.st_size;
+    return 0;
+}
+
+// Two-stage top K search: shortlist the shortlistSize nearest rows by the coarse features,
+// then rank the shortlist by the features of featureType. Those are taken from the cache,
+// or extracted from the decoded candidate images in parallel and added to the cache.
+// Candidates whose image cannot be read are left out.
+// query - Query built by buildQuery for featureType
+// coarseQuery - Query built by buildQuery for the coarse feature type
+// coarseDatabases - Feature databases of the coarse query, loaded by loadDatabases
+// featureType - Feature Type of query, ranging from 1 - 14, except 11
+// cache - Feature cache opened with the dims of the vectors of query
+// k - Number of top matching images to be returned
+// shortlistSize - Number of candidates ranked by the features of featureType
+// topK - (distance, row index into coarseDatabases) of the top K matching images, nearest first
+// numExtracted - Set to the number of candidates whose features were extracted
+// pool - Threads of the shortlist scan and of the extraction, or NULL
+int twoStageTopK(Query &query,
+                 Query &coarseQuery,
+                 std::vector<FeatureDatabase> &coarseDatabases,
+                 int featureType,
+                 FeatureCache &cache,
+                 int k,
+                 int shortlistSize,
+                 std::vector<std::pair<float, int>> &topK,
+                 int &numExtracted,
+                 ThreadPool *pool
+                 ){
+    numExtracted = 0;
+    
+    // Stage one: shortlist by the coarse features
+    std::vector<std::pair<float, int>> candidates;
+    exactTopK(coarseQuery, coarseDatabases, std::max(shortlistSize, k), candidates, pool);
+    
+    // Stage two: features of the candidates from the cache, or extracted from their images
+    struct Candidate {
+        const char *key;
+        int64_t mtime = 0;
+        int64_t fileSize = 0;
+        int cacheRow = -1;
+    };
+    std::vector<Candidate> shortlist(candidates.size());
+    std::vector<int> missing;
+    for (int c = 0; c<candidates.size(); c++){
+        Candidate &s = shortlist[c];
+        s.key = coarseDatabases[0].path(candidates[c].second);
+        if (keyFileStamp(s.key, s.mtime, s.fileSize) == 0) s.cacheRow = cache.find(s.key, s.mtime, s.fileSize);
+        if (s.cacheRow < 0) missing.push_back(c);
+    }
+    std::vector<std::vector<std::vector<float>>> extracted(missing.size());
+    auto extract = [&](int task, int worker){
+        const char *key = shortlist[missing[task]].key;
+        cv::Mat img = loadKeyImage(key);
+        if (img.empty()){
+            printf("Unable to read image file %s\n", key);
+            return;
+        }
+        extracted[task].assign(query.vectors.size(), std::vector<float>());
+        extractQueryFeatures(img, featureType, extracted[task]);
+    };
+    if (pool && pool->size() > 1 && missing.size() > 1) pool->run((int)missing.size(), extract);
+    else for (int t = 0; t<missing.size(); t++) extract(t, 0);
+    for (int t = 0; t<missing.size(); t++){
+        if (extracted[t].empty()) continue;
+        Candidate &s = shortlist[missing[t]];
+        s.cacheRow = cache.insert(s.key, s.mtime, s.fileSize, extracted[t]);
+        numExtracted += s.cacheRow >= 0;
+    }
+    cache.flush();
+    
+    // Rank the candidates by the features of featureType, summed in the same order as exactTopK.
+    // The cache holds the features as extracted; the transform of the matching method is applied here.
+    const std::vector<int> &dims = cache.vectorDims();
+    std::vector<DistanceMetric> metrics(dims.size());
+    for (int i = 0; i<dims.size(); i++) metrics[i] = specializeDistanceMetric(query.distanceMetric, dims[i]);
+    std::vector<float> features(cache.rowFloats());
+    std::vector<std::pair<float, int>> ranked;
+    for (int c = 0; c<shortlist.size(); c++){
+        if (shortlist[c].cacheRow < 0) continue;
+        const float *x = cache.row(shortlist[c].cacheRow);
+        if (query.sqrtTransform){
+            std::copy(x, x + features.size(), features.begin());
+            sqrtFeatures(features.data(), (int)features.size());
+            x = features.data();
+        }
+        float total = 0;
+        for (int i = 0; i<dims.size(); i++){
+            float distance = query.weights[i] * metrics[i](query.vectors[i].data(), x, dims[i]);
+            total = i == 0 ? distance : total + distance;
+            x += dims[i];
+        }
+        ranked.push_back(std::pair<float, int>(total, candidates[c].second));
+    }
+    k = std::min(k, (int)ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin()+k, ranked.end());
+    topK.insert(topK.end(), ranked.begin(), ranked.begin()+k);
+    return 0;
+}
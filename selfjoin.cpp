@@ -0,0 +1,171 @@
+//
+//  selfjoin.cpp
+//  Project2
+//
+//  Near-duplicate detection: find all pairs of images of a feature database
+//  within a distance threshold, and group them into clusters.
+//
+
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include "selfjoin.hpp"
+#include "util.hpp"
+
+// Run work(t) for t in [0, numThreads) on numThreads threads
+template <typename Work>
+static void runThreads(int numThreads, Work work){
+    std::vector<std::thread> workers;
+    for (int t = 1; t < numThreads; t++) workers.emplace_back(work, t);
+    work(0);
+    for (std::thread &w : workers) w.join();
+}
+
+// Find all pairs of rows whose weighted distance is at most threshold.
+int selfJoin(const std::vector<FeatureDatabase> &databases,
+             const std::vector<double> &weights,
+             float(*distanceMetric)(const float *, const float *, int),
+             float threshold,
+             int numTables,
+             int hashesPerTable,
+             int numThreads,
+             std::vector<JoinPair> &pairs){
+    pairs.clear();
+    if (databases.empty() || databases[0].size() < 2) return 0;
+    const FeatureDatabase &db = databases[0];
+    int numRows = db.size();
+    int dims = db.dims();
+    if (numThreads <= 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numTables = std::max(1, numTables);
+    hashesPerTable = std::max(1, hashesPerTable);
+
+    // A pair within threshold is within radius of each other in L2 on the first database:
+    // sumSquared is the squared L2 distance, and for histograms that sum to one
+    // histIntersectionNormalized is half the L1 distance, which bounds the L2 distance,
+    // chiSquare is at least half the squared L2 distance since every x+y is at most 2, and
+    // bhattacharyyaSqrt -ln(x.y) is at least 1 - x.y, half the squared L2 distance of unit vectors.
+    double limit = threshold / std::max(weights[0], 1e-12);
+    float(*ssd)(const float *, const float *, int) = &sumSquared;
+    float(*chi)(const float *, const float *, int) = &chiSquare;
+    float(*bhattacharyya)(const float *, const float *, int) = &bhattacharyyaSqrt;
+    double radius = 2.0*limit;
+    if (distanceMetric == ssd) radius = std::sqrt(limit);
+    else if (distanceMetric == chi || distanceMetric == bhattacharyya) radius = std::sqrt(2.0*limit);
+    double bucketWidth = std::max(4.0*radius, 1e-6);
+
+    // p-stable LSH: h(x) = floor((a.x + b) / bucketWidth), a ~ N(0, I), b ~ U[0, bucketWidth)
+    int numHashes = numTables*hashesPerTable;
+    std::mt19937 rng(12345);
+    std::normal_distribution<float> gaussian(0.0f, 1.0f);
+    std::uniform_real_distribution<double> uniform(0.0, bucketWidth);
+    std::vector<float> projections((size_t)numHashes*dims);
+    std::vector<double> offsets(numHashes);
+    for (float &a : projections) a = gaussian(rng);
+    for (double &b : offsets) b = uniform(rng);
+
+    // Bucket key of every row in every table
+    std::vector<uint64_t> keys((size_t)numTables*numRows);
+    runThreads(numThreads, [&](int t){
+        for (int i = t; i < numRows; i += numThreads){
+            const float *x = db.row(i);
+            for (int table = 0; table < numTables; table++){
+                uint64_t key = 1469598103934665603ULL;
+                for (int h = 0; h < hashesPerTable; h++){
+                    const float *a = &projections[(size_t)(table*hashesPerTable + h)*dims];
+                    double dot = 0.0;
+                    for (int d = 0; d < dims; d++) dot += a[d]*x[d];
+                    int64_t bucket = (int64_t)std::floor((dot + offsets[table*hashesPerTable + h]) / bucketWidth);
+                    key = (key ^ (uint64_t)bucket) * 1099511628211ULL;
+                }
+                keys[(size_t)table*numRows + i] = key;
+            }
+        }
+    });
+
+    // Rows of each table sorted by key; a bucket is a run of equal keys
+    struct Bucket { int table; int begin; int end; };
+    std::vector<std::vector<int>> order(numTables);
+    std::vector<Bucket> buckets;
+    for (int table = 0; table < numTables; table++){
+        const uint64_t *k = &keys[(size_t)table*numRows];
+        std::vector<int> &o = order[table];
+        o.resize(numRows);
+        for (int i = 0; i < numRows; i++) o[i] = i;
+        std::sort(o.begin(), o.end(), [k](int x, int y){ return k[x] != k[y] ? k[x] < k[y] : x < y; });
+        for (int begin = 0, end; begin < numRows; begin = end){
+            for (end = begin+1; end < numRows && k[o[end]] == k[o[begin]]; end++);
+            if (end - begin > 1) buckets.push_back(Bucket{table, begin, end});
+        }
+    }
+    // Largest buckets first, for load balance
+    std::sort(buckets.begin(), buckets.end(), [](const Bucket &x, const Bucket &y){ return x.end - x.begin > y.end - y.begin; });
+
+    // Compare every pair within a bucket, unless an earlier table already produced it
+    std::atomic<size_t> next(0);
+    std::vector<std::vector<JoinPair>> found(numThreads);
+    runThreads(numThreads, [&](int t){
+        for (size_t b = next++; b < buckets.size(); b = next++){
+            const Bucket &bucket = buckets[b];
+            const std::vector<int> &o = order[bucket.table];
+            for (int x = bucket.begin; x < bucket.end; x++){
+                for (int y = x+1; y < bucket.end; y++){
+                    int i = std::min(o[x], o[y]);
+                    int j = std::max(o[x], o[y]);
+                    bool seen = false;
+                    for (int table = 0; table < bucket.table && !seen; table++){
+                        seen = keys[(size_t)table*numRows + i] == keys[(size_t)table*numRows + j];
+                    }
+                    if (seen) continue;
+
+                    float distance = 0.0f;
+                    for (int d = 0; d < databases.size() && distance <= threshold; d++){
+                        distance += weights[d] * distanceMetric(databases[d].row(i), databases[d].row(j), databases[d].dims());
+                    }
+                    if (distance <= threshold) found[t].push_back(JoinPair{i, j, distance});
+                }
+            }
+        }
+    });
+
+    for (std::vector<JoinPair> &f : found) pairs.insert(pairs.end(), f.begin(), f.end());
+    std::sort(pairs.begin(), pairs.end(), [](const JoinPair &x, const JoinPair &y){ return x.a != y.a ? x.a < y.a : x.b < y.b; });
+    return 0;
+}
+
+// Root of row i in the union-find forest, with path halving
+static int findRoot(std::vector<int> &parent, int i){
+    while (parent[i] != i){
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// Group rows into the connected components of the pair graph.
+int joinClusters(int numRows, const std::vector<JoinPair> &pairs, std::vector<std::vector<int>> &clusters){
+    std::vector<int> parent(numRows);
+    for (int i = 0; i < numRows; i++) parent[i] = i;
+    for (const JoinPair &p : pairs){
+        int ra = findRoot(parent, p.a);
+        int rb = findRoot(parent, p.b);
+        if (ra != rb) parent[std::max(ra, rb)] = std::min(ra, rb);
+    }
+
+    std::vector<int> clusterOf(numRows, -1);
+    clusters.clear();
+    for (int i = 0; i < numRows; i++){
+        int root = findRoot(parent, i);
+        if (clusterOf[root] < 0){
+            clusterOf[root] = (int)clusters.size();
+            clusters.push_back(std::vector<int>());
+        }
+        clusters[clusterOf[root]].push_back(i);
+    }
+    clusters.erase(std::remove_if(clusters.begin(), clusters.end(), [](const std::vector<int> &c){ return c.size() < 2; }), clusters.end());
+    std::stable_sort(clusters.begin(), clusters.end(), [](const std::vector<int> &x, const std::vector<int> &y){ return x.size() > y.size(); });
+    return 0;
+}
@@ -0,0 +1,53 @@
+//
+//  selfjoin.hpp
+//  Project2
+//
+//  Near-duplicate detection: find all pairs of images of a feature database
+//  within a distance threshold, and group them into clusters.
+//  Candidate pairs are blocked with p-stable LSH buckets over the first
+//  feature database, so only images sharing a bucket are compared.
+//
+
+#ifndef selfjoin_hpp
+#define selfjoin_hpp
+
+#include <vector>
+#include "feature_db.hpp"
+
+// A pair of rows a < b whose weighted distance is at most the join threshold
+struct JoinPair {
+    int a;
+    int b;
+    float distance;
+};
+
+// Find all pairs of rows whose weighted distance is at most threshold.
+// The weighted distance of rows a and b is sum_i weights[i] * distanceMetric(databases[i].row(a), databases[i].row(b)),
+// where distanceMetric is sumSquared, histIntersectionNormalized, chiSquare or bhattacharyyaSqrt.
+// Rows are bucketed by numTables LSH tables of hashesPerTable p-stable hashes of the first database;
+// a pair is compared only if it shares a bucket in at least one table.
+// databases - Feature databases, all with the same rows
+// weights - Weight of each database
+// distanceMetric - Distance metric applied to every database
+// threshold - Maximum weighted distance of a pair
+// numTables - Number of LSH tables; more tables miss fewer pairs
+// hashesPerTable - Number of hashes per table; more hashes give smaller buckets
+// numThreads - Number of worker threads, 0 uses one per core
+// pairs - All pairs within threshold, sorted by (a, b)
+int selfJoin(const std::vector<FeatureDatabase> &databases,
+             const std::vector<double> &weights,
+             float(*distanceMetric)(const float *, const float *, int),
+             float threshold,
+             int numTables,
+             int hashesPerTable,
+             int numThreads,
+             std::vector<JoinPair> &pairs);
+
+// Group rows into the connected components of the pair graph.
+// Rows without any pair are left out.
+// numRows - Number of rows
+// pairs - Pairs found by selfJoin
+// clusters - Connected components with at least two rows, each sorted, largest first
+int joinClusters(int numRows, const std::vector<JoinPair> &pairs, std::vector<std::vector<int>> &clusters);
+
+#endif /* selfjoin_hpp */
@@ -0,0 +1,68 @@
+//
+//  thread_pool.cpp
+//  Project2
+//
+//  Fixed set of worker threads, reused for every parallel loop of a search.
+//
+
+#include <algorithm>
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(int numThreads) : job(nullptr), nextTask(0), numTasks(0), active(0), generation(0), stopping(false) {
+    if (numThreads <= 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int w = 1; w < numThreads; w++) workers.emplace_back(&ThreadPool::workerLoop, this, w);
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &w : workers) w.join();
+}
+
+// Run tasks until none is left
+// worker - index of the calling thread
+void ThreadPool::runTasks(int worker){
+    for (int i = nextTask++; i < numTasks; i = nextTask++) (*job)(i, worker);
+}
+
+// Wait for run() to publish tasks, run them, and report back
+// worker - index of the thread
+void ThreadPool::workerLoop(int worker){
+    long seen = 0;
+    for (;;){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]{ return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        runTasks(worker);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--active == 0) done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run(int numTasks, const std::function<void(int, int)> &task){
+    if (workers.empty() || numTasks <= 1){
+        for (int i = 0; i < numTasks; i++) task(i, 0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        this->numTasks = numTasks;
+        nextTask = 0;
+        active = (int)workers.size();
+        generation++;
+    }
+    wake.notify_all();
+    runTasks(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]{ return active == 0; });
+    job = nullptr;
+}
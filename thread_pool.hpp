@@ -0,0 +1,53 @@
+//
+//  thread_pool.hpp
+//  Project2
+//
+//  Fixed set of worker threads, reused for every parallel loop of a search
+//  so that queries do not pay for thread creation.
+//
+
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // numThreads - number of threads running tasks, including the thread calling run(). 0 uses one per core.
+    explicit ThreadPool(int numThreads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Number of threads running tasks, including the thread calling run()
+    int size() const { return (int)workers.size() + 1; }
+
+    // Run task(i, worker) for every i in [0, numTasks) and wait until all are done.
+    // Tasks are handed out in order to whichever thread is free. worker, in [0, size()),
+    // identifies the thread running the task, for per-thread state. Not reentrant.
+    // numTasks - number of tasks
+    // task - task function
+    void run(int numTasks, const std::function<void(int, int)> &task);
+
+private:
+    void workerLoop(int worker);
+    void runTasks(int worker);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int, int)> *job;
+    std::atomic<int> nextTask;
+    int numTasks;
+    int active;
+    long generation;
+    bool stopping;
+};
+
+#endif /* thread_pool_hpp */
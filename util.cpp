@@ -6,6 +6,7 @@
 //
 
 #include "util.hpp"
+#include "kernels.hpp"
 
 // Return the input number but clamp/limit the value to be within [lower, upper]
 // input - input number
@@ -20,9 +21,17 @@ int clamp(int input, int lower, int upper){
 // Return distance =  sum of squared differences between x and y
 // x - a vector of float numbers
 // y - another vector of float numbers
-float sumSquared(std::vector<float> x, std::vector<float> y){
+float sumSquared(const std::vector<float> &x, const std::vector<float> &y){
+    return sumSquared(x.data(), y.data(), (int)x.size());
+}
+
+// Return distance =  sum of squared differences between the n floats at x and y
+// x - pointer to n float numbers
+// y - pointer to another n float numbers
+// n - number of elements
+float sumSquared(const float *x, const float *y, int n){
     float result = 0.0f;
-    for (std::size_t i = 0; i < x.size(); i++){
+    for (int i = 0; i < n; i++){
         result += (x[i] - y[i])*(x[i] - y[i]);
     }
     return result;
@@ -31,14 +40,212 @@ float sumSquared(std::vector<float> x, std::vector<float> y){
 // Return distance =  1 - normalized histogram intersection between x and y
 // x - a vector of float numbers
 // y - another vector of float numbers
-float histIntersectionNormalized(std::vector<float> x, std::vector<float> y){
+float histIntersectionNormalized(const std::vector<float> &x, const std::vector<float> &y){
+    return histIntersectionNormalized(x.data(), y.data(), (int)x.size());
+}
+
+// Return distance =  1 - normalized histogram intersection between the n floats at x and y
+// x - pointer to n float numbers
+// y - pointer to another n float numbers
+// n - number of elements
+float histIntersectionNormalized(const float *x, const float *y, int n){
     float result = 0.0f;
-    for (std::size_t i = 0; i < x.size(); i++){
+    for (int i = 0; i < n; i++){
         result += std::min(x[i], y[i]);
     }
     return 1-result;
 }
 
+// Return distance =  chi-square distance, the sum of (x-y)^2/(x+y), between x and y
+// x - a vector of float numbers
+// y - another vector of float numbers
+float chiSquare(const std::vector<float> &x, const std::vector<float> &y){
+    return chiSquare(x.data(), y.data(), (int)x.size());
+}
+
+// Return distance =  chi-square distance, the sum of (x-y)^2/(x+y), between the n floats at x and y
+// Bins that are zero in both are skipped. Summed in 8 interleaved partial sums, like chiSquareKernel.
+// x - pointer to n float numbers
+// y - pointer to another n float numbers
+// n - number of elements
+float chiSquare(const float *x, const float *y, int n){
+    float lanes[8] = {0};
+    int i = 0;
+    for (; i + 8 <= n; i += 8){
+        for (int u = 0; u < 8; u++){
+            lanes[u] += chiSquareTerm(x[i+u], y[i+u]);
+        }
+    }
+    float result = sumLanes(lanes);
+    for (; i < n; i++){
+        result += chiSquareTerm(x[i], y[i]);
+    }
+    return result;
+}
+
+// Return distance =  Bhattacharyya distance -ln(sum(x*y)) between x and y
+// x - a vector of float numbers
+// y - another vector of float numbers
+float bhattacharyyaSqrt(const std::vector<float> &x, const std::vector<float> &y){
+    return bhattacharyyaSqrt(x.data(), y.data(), (int)x.size());
+}
+
+// Return distance =  Bhattacharyya distance -ln(sum(x*y)) between the n floats at x and y,
+// the square roots of two normalized histograms. Summed in 8 interleaved partial sums, like bhattacharyyaKernel.
+// x - pointer to n float numbers
+// y - pointer to another n float numbers
+// n - number of elements
+float bhattacharyyaSqrt(const float *x, const float *y, int n){
+    float lanes[8] = {0};
+    int i = 0;
+    for (; i + 8 <= n; i += 8){
+        for (int u = 0; u < 8; u++){
+            lanes[u] += x[i+u]*y[i+u];
+        }
+    }
+    float result = sumLanes(lanes);
+    for (; i < n; i++){
+        result += x[i]*y[i];
+    }
+    return bhattacharyyaFromCoefficient(result);
+}
+
+// Replace the n floats at x by their square roots
+// x - pointer to n float numbers
+// n - number of elements
+void sqrtFeatures(float *x, int n){
+    for (int i = 0; i < n; i++){
+        x[i] = std::sqrt(std::max(x[i], 0.0f));
+    }
+}
+
+// Return the kernel of sumSquared, histIntersectionNormalized, chiSquare or bhattacharyyaSqrt
+// specialized on the vector length n
+// metric - sumSquared, histIntersectionNormalized, chiSquare or bhattacharyyaSqrt
+// n - number of elements
+DistanceMetric specializeDistanceMetric(DistanceMetric metric, int n){
+    if (metric == (DistanceMetric)&sumSquared){
+        switch (n) {
+            case 4*4*4: return &sumSquaredKernel<4*4*4>;
+            case 8*8*8: return &sumSquaredKernel<8*8*8>;
+            case 16*16*16: return &sumSquaredKernel<16*16*16>;
+            case 32*32*32: return &sumSquaredKernel<32*32*32>;
+        }
+    }
+    if (metric == (DistanceMetric)&histIntersectionNormalized){
+        switch (n) {
+            case 4*4*4: return &histIntersectionKernel<4*4*4>;
+            case 8*8*8: return &histIntersectionKernel<8*8*8>;
+            case 16*16*16: return &histIntersectionKernel<16*16*16>;
+            case 32*32*32: return &histIntersectionKernel<32*32*32>;
+        }
+    }
+    if (metric == (DistanceMetric)&chiSquare){
+        switch (n) {
+            case 4*4*4: return &chiSquareKernel<4*4*4>;
+            case 8*8*8: return &chiSquareKernel<8*8*8>;
+            case 16*16*16: return &chiSquareKernel<16*16*16>;
+            case 32*32*32: return &chiSquareKernel<32*32*32>;
+        }
+    }
+    if (metric == (DistanceMetric)&bhattacharyyaSqrt){
+        switch (n) {
+            case 4*4*4: return &bhattacharyyaKernel<4*4*4>;
+            case 8*8*8: return &bhattacharyyaKernel<8*8*8>;
+            case 16*16*16: return &bhattacharyyaKernel<16*16*16>;
+            case 32*32*32: return &bhattacharyyaKernel<32*32*32>;
+        }
+    }
+    return metric;
+}
+
+// Row pass [-1, 0, 1] of sobelX3x3 on one row. The first and last pixels are 0.
+// sptr - cols source pixels
+// dptr - cols destination pixels
+// cols - number of pixels
+void sobelXRow(const cv::Vec3b *sptr, cv::Vec3s *dptr, int cols){
+    for(int c=0;c<3;c++){
+        dptr[0][c] = 0;
+        dptr[cols-1][c] = 0;
+    }
+    for(int j=1; j<cols-1; j++){
+        for(int c=0;c<3;c++){
+            dptr[j][c] =
+            (
+             -1*sptr[j-1][c]
+             +1*sptr[j+1][c]
+            );
+        }
+    }
+}
+
+// Row pass [1, 2, 1]/4 of sobelY3x3 on one row. The first and last pixels are 0.
+// sptr - cols source pixels
+// dptr - cols destination pixels
+// cols - number of pixels
+void sobelYRow(const cv::Vec3b *sptr, cv::Vec3s *dptr, int cols){
+    for(int c=0;c<3;c++){
+        dptr[0][c] = 0;
+        dptr[cols-1][c] = 0;
+    }
+    for(int j=1; j<cols-1; j++){
+        for(int c=0;c<3;c++){
+            dptr[j][c] =
+            (
+             1*sptr[j-1][c]
+             +2*sptr[j][c]
+             +1*sptr[j+1][c]
+            )/4;
+        }
+    }
+}
+
+// Column pass [1, 2, 1]/4 of sobelX3x3 on one row, from the row passes of the rows above, at and below it
+// above, at, below - cols row pass pixels
+// dptr - cols destination pixels
+// cols - number of pixels
+void sobelXColumn(const cv::Vec3s *above, const cv::Vec3s *at, const cv::Vec3s *below, cv::Vec3s *dptr, int cols){
+    for(int j=0; j<cols; j++){
+        for(int c=0;c<3;c++){
+            dptr[j][c] =
+            (
+             1*above[j][c]
+             +2*at[j][c]
+             +1*below[j][c]
+             )/4;
+        }
+    }
+}
+
+// Column pass [1, 0, -1] of sobelY3x3 on one row, from the row passes of the rows above and below it
+// above, below - cols row pass pixels
+// dptr - cols destination pixels
+// cols - number of pixels
+void sobelYColumn(const cv::Vec3s *above, const cv::Vec3s *below, cv::Vec3s *dptr, int cols){
+    for(int j=0; j<cols; j++){
+        for(int c=0;c<3;c++){
+            dptr[j][c] =
+            (
+             1*above[j][c]
+             -1*below[j][c]
+             );
+        }
+    }
+}
+
+// Sobel Magnitude of one row
+// sxptr - cols pixels with `sobelX3x3` applied
+// syptr - cols pixels with `sobelY3x3` applied
+// dptr - cols destination pixels
+// cols - number of pixels
+void magnitudeRow(const cv::Vec3s *sxptr, const cv::Vec3s *syptr, cv::Vec3b *dptr, int cols){
+    for(int j=0;j<cols;j++){
+        for(int c=0;c<3;c++){
+            dptr[j][c] = sqrt(pow(sxptr[j][c], 2)+pow(syptr[j][c], 2));
+        }
+    }
+}
+
 // Apply a 3x3 Sobel filter (X direction) onto the source image
 // src - Source image
 // dst - Destination image
@@ -52,18 +259,7 @@ int sobelX3x3(cv::Mat &src, cv::Mat &dst){
     // Row 1D
     // [-1, 0, 1]
     for(int i=0; i<src.rows; i++){
-        cv::Vec3b *sptr = src.ptr<cv::Vec3b>(i);
-        // Destination pointer
-        cv::Vec3s *dptr = dst.ptr<cv::Vec3s>(i);
-        for(int j=1; j<src.cols-1; j++){
-            for(int c=0;c<3;c++){
-                dptr[j][c] =
-                (
-                 -1*sptr[j-1][c]
-                 +1*sptr[j+1][c]
-                );
-            }
-        }
+        sobelXRow(src.ptr<cv::Vec3b>(i), dst.ptr<cv::Vec3s>(i), src.cols);
     }
     
     cv::Mat temp;
@@ -73,17 +269,9 @@ int sobelX3x3(cv::Mat &src, cv::Mat &dst){
     //    [1]
     //    [2]
     //    [1]
-    for(int j=0; j<src.cols; j++){
-        for(int i=1; i<src.rows-1; i++){
-            for(int c=0;c<3;c++){
-                dst.at<cv::Vec3s>(i, j)[c] =
-                (
-                 1*temp.at<cv::Vec3s>(i-1, j)[c]
-                 +2*temp.at<cv::Vec3s>(i, j)[c]
-                 +1*temp.at<cv::Vec3s>(i+1, j)[c]
-                 )/4;
-            }
-        }
+    for(int i=1; i<src.rows-1; i++){
+        sobelXColumn(temp.ptr<cv::Vec3s>(i-1), temp.ptr<cv::Vec3s>(i), temp.ptr<cv::Vec3s>(i+1),
+                     dst.ptr<cv::Vec3s>(i), src.cols);
     }
     
      return 0;
@@ -102,19 +290,7 @@ int sobelY3x3(cv::Mat &src, cv::Mat &dst){
     // Row 1D
     // [1, 2, 1]
     for(int i=0; i<src.rows; i++){
-        cv::Vec3b *sptr = src.ptr<cv::Vec3b>(i);
-        // Destination pointer
-        cv::Vec3s *dptr = dst.ptr<cv::Vec3s>(i);
-        for(int j=1; j<src.cols-1; j++){
-            for(int c=0;c<3;c++){
-                dptr[j][c] =
-                (
-                 1*sptr[j-1][c]
-                 +2*sptr[j][c]
-                 +1*sptr[j+1][c]
-                )/4;
-            }
-        }
+        sobelYRow(src.ptr<cv::Vec3b>(i), dst.ptr<cv::Vec3s>(i), src.cols);
     }
     
     cv::Mat temp;
@@ -123,16 +299,8 @@ int sobelY3x3(cv::Mat &src, cv::Mat &dst){
     //    [+1]
     //    [0]
     //    [-1]
-    for(int j=0; j<src.cols; j++){
-        for(int i=1; i<src.rows-1; i++){
-            for(int c=0;c<3;c++){
-                dst.at<cv::Vec3s>(i, j)[c] =
-                (
-                 1*temp.at<cv::Vec3s>(i-1, j)[c]
-                 -1*temp.at<cv::Vec3s>(i+1, j)[c]
-                 );
-            }
-        }
+    for(int i=1; i<src.rows-1; i++){
+        sobelYColumn(temp.ptr<cv::Vec3s>(i-1), temp.ptr<cv::Vec3s>(i+1), dst.ptr<cv::Vec3s>(i), src.cols);
     }
      return 0;
 }
@@ -144,17 +312,7 @@ int sobelY3x3(cv::Mat &src, cv::Mat &dst){
 int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst){
     dst = cv::Mat::zeros(sx.size(), CV_8UC3); // unsigned short data type
     for(int i=0;i<sx.rows;i++){
-        // sx, sy pointers
-        cv::Vec3s *sxptr = sx.ptr<cv::Vec3s>(i);
-        cv::Vec3s *syptr = sy.ptr<cv::Vec3s>(i);
-        // destination pointer
-        cv::Vec3b *dptr = dst.ptr<cv::Vec3b>(i);
-        
-        for(int j=0;j<sx.cols;j++){
-            for(int c=0;c<3;c++){
-                dptr[j][c] = sqrt(pow(sxptr[j][c], 2)+pow(syptr[j][c], 2));
-            }
-       }
+        magnitudeRow(sx.ptr<cv::Vec3s>(i), sy.ptr<cv::Vec3s>(i), dst.ptr<cv::Vec3b>(i), sx.cols);
      }
     return 0;
 }
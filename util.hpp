@@ -18,12 +18,67 @@ int clamp(int input, int lower, int upper);
 // Return distance =  sum of squared differences between x and y
 // x - a vector of float numbers
 // y - another vector of float numbers
-float sumSquared(std::vector<float> x, std::vector<float> y);
+float sumSquared(const std::vector<float> &x, const std::vector<float> &y);
+
+// Return distance =  sum of squared differences between the n floats at x and y
+// x - pointer to n float numbers
+// y - pointer to another n float numbers
+// n - number of elements
+float sumSquared(const float *x, const float *y, int n);
 
 // Return distance =  1 - normalized histogram intersection between x and y
 // x - a vector of float numbers
 // y - another vector of float numbers
-float histIntersectionNormalized(std::vector<float> x, std::vector<float> y);
+float histIntersectionNormalized(const std::vector<float> &x, const std::vector<float> &y);
+
+// Return distance =  1 - normalized histogram intersection between the n floats at x and y
+// x - pointer to n float numbers
+// y - pointer to another n float numbers
+// n - number of elements
+float histIntersectionNormalized(const float *x, const float *y, int n);
+
+// Return distance =  chi-square distance, the sum of (x-y)^2/(x+y), between x and y
+// x - a vector of float numbers
+// y - another vector of float numbers
+float chiSquare(const std::vector<float> &x, const std::vector<float> &y);
+
+// Return distance =  chi-square distance, the sum of (x-y)^2/(x+y), between the n floats at x and y.
+// Bins that are zero in both are skipped. The sum is accumulated in 8 interleaved partial sums,
+// so that the loop vectorizes.
+// x - pointer to n float numbers
+// y - pointer to another n float numbers
+// n - number of elements
+float chiSquare(const float *x, const float *y, int n);
+
+// Return distance =  Bhattacharyya distance -ln(sum(x*y)) between x and y,
+// the square roots of two normalized histograms
+// x - a vector of float numbers
+// y - another vector of float numbers
+float bhattacharyyaSqrt(const std::vector<float> &x, const std::vector<float> &y);
+
+// Return distance =  Bhattacharyya distance -ln(sum(x*y)) between the n floats at x and y,
+// the square roots of two normalized histograms (see sqrtFeatures). The Bhattacharyya
+// coefficient of the histograms is then a plain dot product.
+// x - pointer to n float numbers
+// y - pointer to another n float numbers
+// n - number of elements
+float bhattacharyyaSqrt(const float *x, const float *y, int n);
+
+// Replace the n floats at x by their square roots.
+// sumSquared of square-rooted normalized histograms is twice their squared Hellinger distance.
+// x - pointer to n float numbers
+// n - number of elements
+void sqrtFeatures(float *x, int n);
+
+// A distance metric between the n floats at x and y
+typedef float (*DistanceMetric)(const float *x, const float *y, int n);
+
+// Return the kernel of sumSquared, histIntersectionNormalized, chiSquare or bhattacharyyaSqrt specialized
+// on the vector length n, for the lengths of 3D histograms with 4, 8, 16 and 32 bins (64, 512, 4096 and 32768).
+// The kernels return exactly the same distances. Other metrics and lengths are returned unchanged.
+// metric - sumSquared, histIntersectionNormalized, chiSquare or bhattacharyyaSqrt
+// n - number of elements
+DistanceMetric specializeDistanceMetric(DistanceMetric metric, int n);
 
 // Filters for SobelMagnitude
 // Apply a 3x3 Sobel filter (X direction) onto the source image
@@ -41,4 +96,39 @@ int sobelY3x3(cv::Mat &src, cv::Mat &dst);
 // sy - Image with `sobelY3x3` applied
 // dst - Destination image
 int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst);
+
+// Row and column passes of sobelX3x3 and sobelY3x3, and magnitude, one row at a time.
+// The whole-image functions are built from them, so code streaming an image through
+// them row by row computes exactly the same values.
+
+// Row pass [-1, 0, 1] of sobelX3x3 on one row. The first and last pixels are 0.
+// sptr - cols source pixels
+// dptr - cols destination pixels
+// cols - number of pixels
+void sobelXRow(const cv::Vec3b *sptr, cv::Vec3s *dptr, int cols);
+
+// Row pass [1, 2, 1]/4 of sobelY3x3 on one row. The first and last pixels are 0.
+// sptr - cols source pixels
+// dptr - cols destination pixels
+// cols - number of pixels
+void sobelYRow(const cv::Vec3b *sptr, cv::Vec3s *dptr, int cols);
+
+// Column pass [1, 2, 1]/4 of sobelX3x3 on one row, from the row passes of the rows above, at and below it
+// above, at, below - cols row pass pixels
+// dptr - cols destination pixels
+// cols - number of pixels
+void sobelXColumn(const cv::Vec3s *above, const cv::Vec3s *at, const cv::Vec3s *below, cv::Vec3s *dptr, int cols);
+
+// Column pass [1, 0, -1] of sobelY3x3 on one row, from the row passes of the rows above and below it
+// above, below - cols row pass pixels
+// dptr - cols destination pixels
+// cols - number of pixels
+void sobelYColumn(const cv::Vec3s *above, const cv::Vec3s *below, cv::Vec3s *dptr, int cols);
+
+// Sobel Magnitude of one row
+// sxptr - cols pixels with `sobelX3x3` applied
+// syptr - cols pixels with `sobelY3x3` applied
+// dptr - cols destination pixels
+// cols - number of pixels
+void magnitudeRow(const cv::Vec3s *sxptr, const cv::Vec3s *syptr, cv::Vec3b *dptr, int cols);
 #endif /* util_hpp */
@@ -0,0 +1,267 @@
+//
+//  vp_tree.cpp
+//  Project2
+//
+//  Vantage-point tree over the rows of feature databases, for exact top K search
+//  under the weighted sum of squared differences.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <queue>
+#include "vp_tree.hpp"
+#include "util.hpp"
+
+static const char VPTREE_MAGIC[8] = "VPTREE2";
+
+// Rows compared per task when the distances to a vantage row are computed in parallel
+static const int DISTANCE_CHUNK = 4096;
+
+// Weighted sum of squared differences between a query and a row,
+// summed over the databases in the same order as exactTopK
+// databases - Feature databases
+// metrics - sumSquared specialized to the dims of every database
+// weights - Weight of every database
+// query - One vector per database
+// row - Row index
+static inline float rowDistance(const std::vector<FeatureDatabase> &databases, const std::vector<DistanceMetric> &metrics,
+                                const std::vector<double> &weights, const float *const *query, int row){
+    float total = 0;
+    for (int i = 0; i < databases.size(); i++){
+        const FeatureDatabase &db = databases[i];
+        float distance = weights[i] * metrics[i](query[i], db.row(row), db.dims());
+        total = i == 0 ? distance : total + distance;
+    }
+    return total;
+}
+
+// sumSquared specialized to the dims of every database
+static void ssdMetrics(const std::vector<FeatureDatabase> &databases, std::vector<DistanceMetric> &metrics){
+    metrics.resize(databases.size());
+    for (int i = 0; i < databases.size(); i++) metrics[i] = specializeDistanceMetric(&sumSquared, databases[i].dims());
+}
+
+// Distances are rounded to floats, so the triangle inequality only holds up to a relative error.
+// The sum of n squared differences, weighted and summed over the databases, is within (n + 2) float
+// roundings per database of the exact value, and its square root within half as many.
+// A subtree is skipped only if its bound exceeds the Kth best distance by more than this fraction,
+// twice that error, of the distances the bound was computed from.
+static float pruneSlack(const std::vector<int> &dims){
+    int roundings = 4;
+    for (int d : dims) roundings += d + 2;
+    return roundings*FLT_EPSILON;
+}
+
+VpTree::VpTree() : numRows(0), slack(0) {
+}
+
+int VpTree::build(const std::vector<FeatureDatabase> &databases, const std::vector<double> &weights,
+                  ThreadPool *pool, unsigned seed){
+    tree.clear();
+    order.clear();
+    numRows = 0;
+    if (databases.empty() || databases.size() != weights.size() || databases[0].size() == 0) return -1;
+    for (const FeatureDatabase &db : databases){
+        if (db.size() != databases[0].size()) return -1;
+    }
+    numRows = databases[0].size();
+    dims.clear();
+    for (const FeatureDatabase &db : databases) dims.push_back(db.dims());
+    this->weights = weights;
+    slack = pruneSlack(dims);
+    sources.clear();
+    for (const FeatureDatabase &db : databases) sources.push_back(db.fileStamp());
+
+    order.resize(numRows);
+    for (int r = 0; r < numRows; r++) order[r] = r;
+    tree.reserve(2*(numRows/LEAF_SIZE + 1));
+    std::vector<float> distances(numRows);
+    uint32_t rng = seed ? seed : 1;
+    buildNode(databases, 0, numRows, pool, distances, rng);
+    return 0;
+}
+
+int VpTree::buildNode(const std::vector<FeatureDatabase> &databases, int begin, int end, ThreadPool *pool,
+                      std::vector<float> &distances, uint32_t &rng){
+    int node = (int)tree.size();
+    tree.push_back(Node{-1, 0, -1, -1, begin, end});
+    int n = end - begin;
+    if (n <= LEAF_SIZE) return node;
+
+    // Random vantage row, moved to the front of the range
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    std::swap(order[begin], order[begin + rng % n]);
+    int vantage = order[begin];
+
+    // Distances of the other rows to the vantage row, indexed by row
+    std::vector<DistanceMetric> metrics;
+    ssdMetrics(databases, metrics);
+    std::vector<const float *> v(databases.size());
+    for (int i = 0; i < databases.size(); i++) v[i] = databases[i].row(vantage);
+    auto computeRange = [&](int from, int to){
+        for (int j = from; j < to; j++){
+            distances[order[j]] = rowDistance(databases, metrics, weights, v.data(), order[j]);
+        }
+    };
+    int numChunks = (n - 1 + DISTANCE_CHUNK - 1)/DISTANCE_CHUNK;
+    if (pool && pool->size() > 1 && numChunks > 1){
+        pool->run(numChunks, [&](int chunk, int){
+            computeRange(begin + 1 + chunk*DISTANCE_CHUNK, std::min(end, begin + 1 + (chunk+1)*DISTANCE_CHUNK));
+        });
+    } else {
+        computeRange(begin + 1, end);
+    }
+
+    // Split at the median distance: rows before mid are within the radius, rows from mid on are not nearer
+    int mid = begin + 1 + (n - 1)/2;
+    std::nth_element(order.begin() + begin + 1, order.begin() + mid, order.begin() + end,
+                     [&](int a, int b){ return distances[a] < distances[b]; });
+    float radius = std::sqrt(distances[order[mid]]);
+
+    int inside = buildNode(databases, begin + 1, mid, pool, distances, rng);
+    int outside = buildNode(databases, mid, end, pool, distances, rng);
+    tree[node] = Node{vantage, radius, inside, outside, begin, end};
+    return node;
+}
+
+int VpTree::search(const std::vector<FeatureDatabase> &databases, const std::vector<std::vector<float>> &query,
+                   int k, std::vector<std::pair<float, int>> &results, VpTreeStats &stats) const {
+    results.clear();
+    stats = VpTreeStats();
+    k = std::min(k, numRows);
+    if (k <= 0 || tree.empty()) return 0;
+
+    std::vector<DistanceMetric> metrics;
+    ssdMetrics(databases, metrics);
+    std::vector<const float *> q(query.size());
+    for (int i = 0; i < query.size(); i++) q[i] = query[i].data();
+
+    // Max-heap of the best (distance, row) pairs, the Kth best on top
+    std::priority_queue<std::pair<float, int>> best;
+    auto consider = [&](int row){
+        std::pair<float, int> candidate(rowDistance(databases, metrics, weights, q.data(), row), row);
+        stats.distances++;
+        if ((int)best.size() < k) best.push(candidate);
+        else if (candidate < best.top()){
+            best.pop();
+            best.push(candidate);
+        }
+        return candidate.first;
+    };
+
+    // Depth first, nearer child first. Each entry carries a lower bound of the distance
+    // of its rows to the query, checked against the Kth best when the entry is popped.
+    std::vector<std::pair<int, float>> stack;
+    stack.push_back(std::pair<int, float>(0, 0.0f));
+    while (!stack.empty()){
+        std::pair<int, float> entry = stack.back();
+        stack.pop_back();
+        float kth = (int)best.size() < k ? INFINITY : std::sqrt(best.top().first);
+        if (entry.second > kth) continue;
+
+        const Node &node = tree[entry.first];
+        stats.nodesVisited++;
+        if (node.vantage < 0){
+            for (int j = node.begin; j < node.end; j++) consider(order[j]);
+            continue;
+        }
+        float d = std::sqrt(consider(node.vantage));
+        float error = slack*(d + node.radius);
+        std::pair<int, float> inside(node.inside, d - node.radius - error);
+        std::pair<int, float> outside(node.outside, node.radius - d - error);
+        if (d < node.radius){
+            stack.push_back(outside);
+            stack.push_back(inside);
+        } else {
+            stack.push_back(inside);
+            stack.push_back(outside);
+        }
+    }
+
+    for (; !best.empty(); best.pop()) results.push_back(best.top());
+    std::reverse(results.begin(), results.end());
+    return 0;
+}
+
+bool VpTree::matches(const std::vector<FeatureDatabase> &databases, const std::vector<double> &weights) const {
+    if (tree.empty() || databases.size() != dims.size() || weights != this->weights) return false;
+    for (int i = 0; i < databases.size(); i++){
+        if (databases[i].size() != numRows || databases[i].dims() != dims[i] || databases[i].fileStamp() != sources[i]) return false;
+    }
+    return true;
+}
+
+int VpTree::save(const char *filename) const {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp){
+        printf("Unable to open index file %s\n", filename);
+        return -1;
+    }
+    int header[3] = {(int)dims.size(), numRows, (int)tree.size()};
+    fwrite(VPTREE_MAGIC, 1, sizeof(VPTREE_MAGIC), fp);
+    fwrite(header, sizeof(int), 3, fp);
+    fwrite(dims.data(), sizeof(int), dims.size(), fp);
+    fwrite(weights.data(), sizeof(double), weights.size(), fp);
+    for (const FeatureFileStamp &source : sources){
+        fwrite(&source.fileSize, sizeof(int64_t), 1, fp);
+        fwrite(&source.mtime, sizeof(int64_t), 1, fp);
+    }
+    fwrite(tree.data(), sizeof(Node), tree.size(), fp);
+    fwrite(order.data(), sizeof(int), order.size(), fp);
+    int err = ferror(fp);
+    fclose(fp);
+    return err ? -1 : 0;
+}
+
+// Read the stamps of the feature files a tree was built from
+static bool readStamps(FILE *fp, std::vector<FeatureFileStamp> &sources){
+    for (FeatureFileStamp &source : sources){
+        if (fread(&source.fileSize, sizeof(int64_t), 1, fp) != 1 || fread(&source.mtime, sizeof(int64_t), 1, fp) != 1) return false;
+    }
+    return true;
+}
+
+int VpTree::load(const char *filename){
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return -1;
+    char magic[sizeof(VPTREE_MAGIC)];
+    int header[3];
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, VPTREE_MAGIC, sizeof(magic)) != 0 ||
+        fread(header, sizeof(int), 3, fp) != 3 || header[0] < 0 || header[1] < 0 || header[2] < 0){
+        printf("Invalid index file %s\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    numRows = header[1];
+    dims.resize(header[0]);
+    weights.resize(header[0]);
+    sources.resize(header[0]);
+    tree.resize(header[2]);
+    order.resize(numRows);
+    bool ok = fread(dims.data(), sizeof(int), dims.size(), fp) == dims.size() &&
+              fread(weights.data(), sizeof(double), weights.size(), fp) == weights.size() &&
+              readStamps(fp, sources) &&
+              fread(tree.data(), sizeof(Node), tree.size(), fp) == tree.size() &&
+              fread(order.data(), sizeof(int), order.size(), fp) == order.size();
+    fclose(fp);
+    for (int r = 0; ok && r < numRows; r++) ok = order[r] >= 0 && order[r] < numRows;
+    // Children come after their parent, so a search always terminates
+    for (int i = 0; ok && i < (int)tree.size(); i++){
+        const Node &node = tree[i];
+        ok = node.begin >= 0 && node.begin <= node.end && node.end <= numRows && node.vantage < numRows &&
+             (node.vantage < 0 || (node.inside > i && node.inside < (int)tree.size() &&
+                                   node.outside > i && node.outside < (int)tree.size()));
+    }
+    if (!ok){
+        printf("Truncated index file %s\n", filename);
+        *this = VpTree();
+        return -1;
+    }
+    slack = pruneSlack(dims);
+    return 0;
+}
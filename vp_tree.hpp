@@ -0,0 +1,95 @@
+//
+//  vp_tree.hpp
+//  Project2
+//
+//  Vantage-point tree over the rows of feature databases, for exact top K search
+//  under the weighted sum of squared differences. The square root of that distance
+//  is a metric (Euclidean distance on the weighted concatenated rows), so subtrees
+//  that the triangle inequality puts beyond the current Kth best can be skipped.
+//  Each node splits its rows at the median distance to a vantage row; leaves hold
+//  a few rows that are compared directly.
+//
+
+#ifndef vp_tree_hpp
+#define vp_tree_hpp
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "feature_db.hpp"
+#include "thread_pool.hpp"
+
+// Work done by one VpTree search
+struct VpTreeStats {
+    int nodesVisited = 0; // tree nodes entered
+    int distances = 0;    // rows compared to the query
+};
+
+class VpTree {
+public:
+    // Maximum number of rows of a leaf
+    static const int LEAF_SIZE = 16;
+
+    VpTree();
+
+    // Build the tree over the rows of feature databases listing the same images,
+    // for the distance sum_i weights[i] * sumSquared(x_i, y_i)
+    // databases - Feature databases
+    // weights - Weight of every database
+    // pool - Threads computing the distances to the vantage rows, or NULL
+    // seed - Random seed of the vantage rows
+    // Returns non-zero if the databases are empty or do not match
+    int build(const std::vector<FeatureDatabase> &databases, const std::vector<double> &weights,
+              ThreadPool *pool = NULL, unsigned seed = 1);
+
+    // Exact top K search. The distances are summed over the databases in the same order as exactTopK,
+    // and ties ranked by row, so the results are identical to those of exactTopK.
+    // databases - Feature databases the tree was built over
+    // query - One vector per database
+    // k - Number of results
+    // results - (distance, row) pairs, nearest first
+    // stats - Set to the nodes visited and rows compared
+    int search(const std::vector<FeatureDatabase> &databases, const std::vector<std::vector<float>> &query,
+               int k, std::vector<std::pair<float, int>> &results, VpTreeStats &stats) const;
+
+    // True if the tree was built over these databases with these weights, loaded from the same
+    // versions of their feature files
+    bool matches(const std::vector<FeatureDatabase> &databases, const std::vector<double> &weights) const;
+
+    // Write the tree to a binary file. Returns non-zero on error
+    int save(const char *filename) const;
+    // Read a tree written by save. Returns non-zero on error
+    int load(const char *filename);
+
+    // Number of rows
+    int size() const { return numRows; }
+    // Number of nodes
+    int nodes() const { return (int)tree.size(); }
+
+private:
+    // A node splits rows begin .. end of order, except its vantage row, at the median
+    // distance radius: the inside child holds the rows within radius, the outside child the others.
+    // Leaves have no vantage row and hold rows begin .. end.
+    struct Node {
+        int vantage;  // row, -1 for a leaf
+        float radius; // distance, the square root of the weighted sum of squared differences
+        int inside;   // child nodes
+        int outside;
+        int begin;    // range of order
+        int end;
+    };
+
+    // Build the subtree of rows begin .. end of order and return its node
+    int buildNode(const std::vector<FeatureDatabase> &databases, int begin, int end, ThreadPool *pool,
+                  std::vector<float> &distances, uint32_t &rng);
+
+    int numRows;
+    std::vector<int> dims;       // dims of every database
+    std::vector<double> weights; // weight of every database
+    std::vector<FeatureFileStamp> sources; // stamps of the feature files the tree was built from
+    float slack;                 // relative rounding error of the distances, allowed for when pruning
+    std::vector<Node> tree;      // root first
+    std::vector<int> order;      // rows, grouped by subtree
+};
+
+#endif /* vp_tree_hpp */